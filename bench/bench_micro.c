@@ -0,0 +1,379 @@
+/* Microbenchmarks of the generator building blocks.
+ *
+ * Every benchmark runs a few warm-up samples that also calibrate how many
+ * operations go into one timed sample, then records the time per operation
+ * of each sample and reports the median and the 99th percentile. The seeds
+ * and areas are fixed so that runs on different builds are comparable.
+ *
+ * The layers are timed in isolation: their parents are replaced by a layer
+ * that replays a cached copy of the parent output. The full stacks are timed
+ * separately.
+ *
+ * The results are written as CSV, one benchmark per line.
+ *
+ * usage: bench_micro [--cpu=level] [--samples=N] [--filter=text] [--out=file]
+ */
+
+#include "layers.h"
+#include "generator.h"
+#include "finders.h"
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define BENCH_SEED      -4172144997902289642LL
+#define WARMUP_SAMPLES  3
+#define SAMPLE_NS       200000      // target duration of one sample
+#define BENCH_NS        500000000   // stop sampling a benchmark after this
+#define MIN_SAMPLES     11
+#define POS_NUM         64
+#define REGION_NUM      256
+
+static const int areaSizes[] = {16, 64, 256};
+
+
+//==============================================================================
+// Benchmark Runner
+//==============================================================================
+
+typedef void (*BenchFn)(void *arg, int64_t i);
+
+static FILE *out;
+static const char *filter;
+static int maxSamples = 101;
+static volatile int sink;
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t timeOps(BenchFn fn, void *arg, int64_t *i, int64_t ops)
+{
+    int64_t k, start = nowNs();
+    for (k = 0; k < ops; k++)
+        fn(arg, (*i)++);
+    return nowNs() - start;
+}
+
+/* Times 'fn' and writes one CSV line. 'items' is the work done per operation,
+ * e.g. the number of cells of a generated area, so that per item costs can be
+ * derived from the report.
+ */
+static void runBench(const char *name, const char *stack, int size, int64_t items,
+        BenchFn fn, void *arg)
+{
+    double *samples;
+    int64_t i = 0, ops = 1, t, total = 0;
+    int s, n;
+
+    if (filter && !strstr(name, filter))
+        return;
+
+    // warm-up, doubling the operations per sample until one sample is long enough
+    for (s = 0; s < WARMUP_SAMPLES; s++)
+    {
+        while (timeOps(fn, arg, &i, ops) < SAMPLE_NS)
+            ops *= 2;
+    }
+
+    samples = (double *) malloc(maxSamples * sizeof(*samples));
+    for (n = 0; n < maxSamples && (n < MIN_SAMPLES || total < BENCH_NS); n++)
+    {
+        t = timeOps(fn, arg, &i, ops);
+        total += t;
+        samples[n] = (double)t / ops;
+    }
+
+    qsort(samples, n, sizeof(*samples), cmpDouble);
+    fprintf(out, "%s,%s,%d,%" PRId64 ",%d,%" PRId64 ",%.1f,%.1f,%.1f,%s\n",
+            name, stack, size, items, n, ops,
+            samples[n/2], samples[(n*99 + 99) / 100 - 1], samples[0],
+            simdLevelName(getSimdLevel()));
+    fflush(out);
+    free(samples);
+}
+
+
+//==============================================================================
+// Layers
+//==============================================================================
+
+/* Replays the output of 'src' for the last area it was asked for. The layer
+ * has to be the first member so that the map function can get back to the
+ * cache.
+ */
+STRUCT(CachedLayer)
+{
+    Layer l;
+    Layer *src;
+    int x, z, w, h;
+    int *data;
+};
+
+static void mapCached(Layer *layer, int *out, int x, int z, int w, int h)
+{
+    CachedLayer *c = (CachedLayer *) layer;
+
+    if (c->data && x == c->x && z == c->z && w == c->w && h == c->h)
+    {
+        memcpy(out, c->data, w*h*sizeof(*out));
+        return;
+    }
+    c->src->getMap(c->src, out, x, z, w, h);
+    c->data = (int *) realloc(c->data, w*h*sizeof(*out));
+    memcpy(c->data, out, w*h*sizeof(*out));
+    c->x = x; c->z = z; c->w = w; c->h = h;
+}
+
+static void setupCachedLayer(CachedLayer *c, Layer *src)
+{
+    memset(c, 0, sizeof(*c));
+    if (src == NULL)
+        return;
+    c->l = *src;
+    c->l.getMap = mapCached;
+    c->l.pipeline = NULL;
+    c->l.p = c->l.p2 = NULL;
+    c->src = src;
+}
+
+STRUCT(AreaArgs)
+{
+    Layer *l;
+    int *buf;
+    int x, z, size;
+};
+
+static void benchArea(void *arg, int64_t i)
+{
+    AreaArgs *a = (AreaArgs *) arg;
+    (void) i;
+    genArea(a->l, a->buf, a->x, a->z, a->size, a->size);
+    sink = a->buf[0];
+}
+
+static void benchLayers(const char *stack, LayerStack g)
+{
+    const int sizeNum = sizeof(areaSizes) / sizeof(*areaSizes);
+    char name[64];
+    int i, j, s;
+
+    for (i = 0; i < g.layerNum; i++)
+    {
+        Layer *l = &g.layers[i];
+        // layers that are not reachable from the top layer are never seeded
+        if (l->worldSeed == 0)
+            continue;
+        for (j = 0; j < i; j++)
+        {
+            if (g.layers[j].getMap == l->getMap && g.layers[j].worldSeed != 0)
+                break;
+        }
+        if (j < i)
+            continue;
+
+        CachedLayer p, p2;
+        Layer self = *l;
+        setupCachedLayer(&p, l->p);
+        setupCachedLayer(&p2, l->p2);
+        self.p = l->p ? &p.l : NULL;
+        self.p2 = l->p2 ? &p2.l : NULL;
+        self.pipeline = NULL;
+        snprintf(name, sizeof(name), "layer/%s", getLayerName(l));
+
+        for (s = 0; s < sizeNum; s++)
+        {
+            AreaArgs a = { &self, NULL, -areaSizes[s] / 2, areaSizes[s] / 3, areaSizes[s] };
+            a.buf = (int *) malloc(calcRequiredBuf(l, a.size, a.size) * sizeof(int));
+            runBench(name, stack, a.size, a.size * a.size, benchArea, &a);
+            free(a.buf);
+        }
+        free(p.data);
+        free(p2.data);
+    }
+
+    for (s = 0; s < sizeNum; s++)
+    {
+        AreaArgs a = { &g.layers[g.layerNum-1], NULL, -areaSizes[s] / 2, areaSizes[s] / 3, areaSizes[s] };
+        a.buf = allocCache(a.l, a.size, a.size);
+        runBench("stack/genArea", stack, a.size, a.size * a.size, benchArea, &a);
+        free(a.buf);
+    }
+}
+
+
+//==============================================================================
+// Seeding and Lookups
+//==============================================================================
+
+STRUCT(StackArgs)
+{
+    LayerStack g;
+    Pos pos[POS_NUM];
+};
+
+static void benchApplySeed(void *arg, int64_t i)
+{
+    StackArgs *a = (StackArgs *) arg;
+    applySeed(&a->g, BENCH_SEED + i);
+}
+
+static void benchSetWorldSeed(void *arg, int64_t i)
+{
+    StackArgs *a = (StackArgs *) arg;
+    setWorldSeed(&a->g.layers[L_BIOME_256], BENCH_SEED + i);
+}
+
+static void benchBiomeAtPos(void *arg, int64_t i)
+{
+    StackArgs *a = (StackArgs *) arg;
+    sink = getBiomeAtPos(a->g, a->pos[i % POS_NUM]);
+}
+
+static void benchSeeding(const char *stack, LayerStack g)
+{
+    StackArgs a;
+    int i;
+
+    a.g = g;
+    for (i = 0; i < POS_NUM; i++)
+    {
+        a.pos[i].x = (i * 7919) % 60000 - 30000;
+        a.pos[i].z = (i * 104729) % 60000 - 30000;
+    }
+
+    runBench("seed/applySeed", stack, g.layerNum, g.layerNum, benchApplySeed, &a);
+    runBench("seed/setWorldSeed", stack, L_BIOME_256 + 1, L_BIOME_256 + 1, benchSetWorldSeed, &a);
+    applySeed(&a.g, BENCH_SEED);
+    runBench("lookup/getBiomeAtPos", stack, 1, 1, benchBiomeAtPos, &a);
+}
+
+
+//==============================================================================
+// Structures and Filters
+//==============================================================================
+
+STRUCT(RegionArgs)
+{
+    StructureConfig config;
+    Layer dummy;
+    Pos *huts;      // REGION_NUM x REGION_NUM hut positions, column major
+    Pos batch[REGION_NUM];
+};
+
+static void benchStructurePos(void *arg, int64_t i)
+{
+    RegionArgs *a = (RegionArgs *) arg;
+    Pos p = getStructurePos(a->config, BENCH_SEED, (int)(i / REGION_NUM), (int)(i % REGION_NUM));
+    sink = p.x;
+}
+
+static void benchStructurePosBatch(void *arg, int64_t i)
+{
+    RegionArgs *a = (RegionArgs *) arg;
+    getStructurePosBatch(a->config, BENCH_SEED, (int)(i % REGION_NUM), 0, REGION_NUM, a->batch);
+    sink = a->batch[0].x;
+}
+
+static void benchCloseHuts(void *arg, int64_t i)
+{
+    RegionArgs *a = (RegionArgs *) arg;
+    int x = (int)(i / (REGION_NUM-1) % (REGION_NUM-1));
+    int z = (int)(i % (REGION_NUM-1));
+    Pos qhpos[4];
+
+    qhpos[0] = a->huts[x*REGION_NUM + z];
+    qhpos[1] = a->huts[x*REGION_NUM + z+1];
+    qhpos[2] = a->huts[(x+1)*REGION_NUM + z];
+    qhpos[3] = a->huts[(x+1)*REGION_NUM + z+1];
+    sink = hasCloseHuts(qhpos);
+}
+
+static void benchSwampCandidates(void *arg, int64_t i)
+{
+    RegionArgs *a = (RegionArgs *) arg;
+    sink = countSwampCandidates(&a->dummy, (int)(i >> 16), (int)(i & 0xffff));
+}
+
+static void benchStructures(const char *stack, StructureConfig config)
+{
+    RegionArgs a;
+    int x;
+
+    a.config = config;
+    setupLayer(256, &a.dummy, NULL, 200, NULL);
+    setWorldSeed(&a.dummy, BENCH_SEED);
+    a.huts = (Pos *) malloc(REGION_NUM * REGION_NUM * sizeof(*a.huts));
+    for (x = 0; x < REGION_NUM; x++)
+        getStructurePosBatch(config, BENCH_SEED, x, 0, REGION_NUM, a.huts + x*REGION_NUM);
+
+    runBench("struct/getStructurePos", stack, 1, 1, benchStructurePos, &a);
+    runBench("struct/getStructurePosBatch", stack, REGION_NUM, REGION_NUM, benchStructurePosBatch, &a);
+    runBench("filter/hasCloseHuts", stack, 4, 4, benchCloseHuts, &a);
+    runBench("filter/countSwampCandidates", stack, 4, 4, benchSwampCandidates, &a);
+    free(a.huts);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int simdLevel = -1;
+    int i;
+
+    out = stdout;
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--cpu=", 6) == 0)
+            simdLevel = parseSimdLevel(argv[i] + 6);
+        else if (strncmp(argv[i], "--samples=", 10) == 0)
+            maxSamples = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--filter=", 9) == 0)
+            filter = argv[i] + 9;
+        else if (strncmp(argv[i], "--out=", 6) == 0)
+            out = fopen(argv[i] + 6, "w");
+        else
+            out = NULL;
+
+        if (out == NULL || maxSamples < 1)
+        {
+            fprintf(stderr, "usage: bench_micro [--cpu=level] [--samples=N] [--filter=text] [--out=file]\n");
+            return 1;
+        }
+    }
+
+    setSimdLevel(simdLevel);
+    initBiomes();
+
+    fprintf(out, "benchmark,stack,size,items,samples,ops_per_sample,median_ns,p99_ns,min_ns,cpu\n");
+
+    LayerStack g17 = setupGeneratorMC17();
+    LayerStack g113 = setupGeneratorMC113();
+    applySeed(&g17, BENCH_SEED);
+    applySeed(&g113, BENCH_SEED);
+
+    benchLayers("MC17", g17);
+    benchLayers("MC113", g113);
+    benchSeeding("MC17", g17);
+    benchSeeding("MC113", g113);
+    benchStructures("MC17", FEATURE_CONFIG);
+    benchStructures("MC113", SWAMP_HUT_CONFIG);
+
+    freeGenerator(g113);
+    freeGenerator(g17);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
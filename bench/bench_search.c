@@ -0,0 +1,190 @@
+/* End-to-end scaling benchmark of the quad hut search.
+ *
+ * The full search runs on a fixed corpus of seeds for every version, search
+ * range and thread count asked for. Each CSV line sums up the corpus for one
+ * combination: wall time, regions and candidates per second and the speedup
+ * over the first thread count of the list. The lines are appended to the file
+ * with the start time and the git revision of the run, so that runs of
+ * different revisions can be compared, the header is only written to an empty
+ * file.
+ *
+ * usage: bench_search [--threads=1,2,4] [--ranges=25000,50000] [--versions=1.7,1.14]
+ *                     [--seeds=N] [--cpu=level] [--out=file]
+ */
+
+#include "layers.h"
+#include "generator.h"
+#include "finders.h"
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define MAX_LIST 32
+
+static const char *versionNames[] = {"1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.13.2", "1.14", "1.15"};
+
+static const int64_t seedCorpus[] =
+{
+    1, 181201211981019340LL, -4172144997902289642LL, 2020, -6524879234862371LL,
+    123456789, 8675309, -1,
+};
+
+/* Writes the short git revision of the source tree, "unknown" outside of a
+ * checkout. A tree with uncommitted changes gets a "-dirty" suffix.
+ */
+static void getRevision(char *rev, int len)
+{
+    FILE *fp = NULL;
+    strcpy(rev, "unknown");
+#ifdef SOURCE_DIR
+    fp = popen("git -C \"" SOURCE_DIR "\" describe --always --dirty 2>/dev/null", "r");
+#endif
+    if (fp == NULL)
+        return;
+    if (fgets(rev, len, fp) == NULL || rev[0] == '\n')
+        strcpy(rev, "unknown");
+    rev[strcspn(rev, "\n")] = 0;
+    pclose(fp);
+}
+
+static double nowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Parses a comma separated list of integers, returns the number of entries. */
+static int parseList(const char *s, int *list)
+{
+    int n = 0;
+    while (*s && n < MAX_LIST)
+    {
+        list[n++] = atoi(s);
+        s = strchr(s, ',');
+        if (!s)
+            break;
+        s++;
+    }
+    return n;
+}
+
+static int parseVersions(const char *s, int *list)
+{
+    int n = 0;
+    while (*s && n < MAX_LIST)
+    {
+        size_t len = strcspn(s, ",");
+        unsigned int v;
+        for (v = 0; v < sizeof(versionNames) / sizeof(*versionNames); v++)
+        {
+            if (strlen(versionNames[v]) == len && strncmp(versionNames[v], s, len) == 0)
+                list[n++] = v;
+        }
+        s += len;
+        if (*s)
+            s++;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads[MAX_LIST], ranges[MAX_LIST], versions[MAX_LIST];
+    int threadNum = 0, rangeNum, versionNum, seedNum = 3;
+    int simdLevel = -1;
+    FILE *out = stdout;
+    char timestamp[32], revision[64];
+    time_t startTime = time(NULL);
+    int i, t, r, v, s;
+
+    rangeNum = parseList("25000,50000,100000", ranges);
+    for (versionNum = 0; versionNum <= MC_1_15; versionNum++)
+        versions[versionNum] = versionNum;
+    for (t = 1; t < getCpuCount(); t *= 2)
+        threads[threadNum++] = t;
+    threads[threadNum++] = getCpuCount();
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--threads=", 10) == 0)
+            threadNum = parseList(argv[i] + 10, threads);
+        else if (strncmp(argv[i], "--ranges=", 9) == 0)
+            rangeNum = parseList(argv[i] + 9, ranges);
+        else if (strncmp(argv[i], "--versions=", 11) == 0)
+            versionNum = parseVersions(argv[i] + 11, versions);
+        else if (strncmp(argv[i], "--seeds=", 8) == 0)
+            seedNum = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--cpu=", 6) == 0)
+            simdLevel = parseSimdLevel(argv[i] + 6);
+        else if (strncmp(argv[i], "--out=", 6) == 0)
+            out = fopen(argv[i] + 6, "a");
+        else
+            out = NULL;
+
+        if (out == NULL)
+            break;
+    }
+    if (out == NULL || threadNum == 0 || rangeNum == 0 || versionNum == 0 ||
+        seedNum < 1 || seedNum > (int)(sizeof(seedCorpus) / sizeof(*seedCorpus)))
+    {
+        fprintf(stderr, "usage: bench_search [--threads=1,2,4] [--ranges=25000,50000] [--versions=1.7,1.14]\n"
+                        "                    [--seeds=N] [--cpu=level] [--out=file]\n");
+        return 1;
+    }
+
+    setSimdLevel(simdLevel);
+    initBiomes();
+
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&startTime));
+    getRevision(revision, sizeof(revision));
+
+    // a file that already holds runs only gets the new lines
+    if (fseek(out, 0, SEEK_END) != 0 || ftell(out) == 0)
+        fprintf(out, "timestamp,revision,version,range_blocks,seeds,threads,regions,candidates,clusters,wall_ms,"
+                "regions_per_s,candidates_per_s,speedup,cpu\n");
+
+    for (v = 0; v < versionNum; v++)
+    {
+        for (r = 0; r < rangeNum; r++)
+        {
+            double baseTime = 0;
+            for (t = 0; t < threadNum; t++)
+            {
+                SearchStats total;
+                double elapsed = 0;
+                memset(&total, 0, sizeof(total));
+
+                for (s = 0; s < seedNum; s++)
+                {
+                    SearchConfig config = {versions[v], seedCorpus[s], ranges[r] / 32 / 16, 2, 1, threads[t]};
+                    SearchStats stats;
+                    double start = nowSec();
+                    searchQuadHuts(&config, NULL, NULL, &stats);
+                    elapsed += nowSec() - start;
+
+                    total.regions += stats.regions;
+                    total.candidates += stats.candidates;
+                    total.clusters[0] += stats.clusters[0] + stats.clusters[1] + stats.clusters[2];
+                }
+                if (t == 0)
+                    baseTime = elapsed;
+
+                fprintf(out, "%s,%s,%s,%d,%d,%d,%" PRId64 ",%" PRId64 ",%" PRId64 ",%.1f,%.0f,%.0f,%.2f,%s\n",
+                        timestamp, revision, versionNames[versions[v]], ranges[r], seedNum, threads[t],
+                        total.regions, total.candidates, total.clusters[0], elapsed * 1e3,
+                        total.regions / elapsed, total.candidates / elapsed, baseTime / elapsed,
+                        simdLevelName(getSimdLevel()));
+                fflush(out);
+            }
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
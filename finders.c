@@ -35,11 +35,123 @@ Pos getStructurePos(const StructureConfig config, int64_t seed, const int region
 		pos.z = (int) ((uint64_t)seed >> 17u) % config.chunkRange;
 	}
 
-	pos.x = (int)((uint64_t )(regionX * config.regionSize + pos.x) << 4u) + 8;
-	pos.z = (int)((uint64_t )(regionZ * config.regionSize + pos.z) << 4u) + 8;
+	pos.x = (int)(((int64_t)regionX * config.regionSize + pos.x) * 16 + 8);
+	pos.z = (int)(((int64_t)regionZ * config.regionSize + pos.z) * 16 + 8);
 	return pos;
 }
 
+#ifdef SIMD_X86
+
+/* (seed * 0x5deece66d + 0xb) & ((1 << 48) - 1), with the 64-bit product built
+ * from 32-bit multiplies as AVX2 has no 64-bit multiply.
+ */
+TARGET_AVX2 static inline __m256i nextSeed4(__m256i s) {
+	const __m256i ml = _mm256_set1_epi64x(0xdeece66dLL);
+	__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(s, _mm256_set1_epi64x(0x5)),
+			_mm256_mul_epu32(_mm256_srli_epi64(s, 32), ml));
+	s = _mm256_add_epi64(_mm256_mul_epu32(s, ml), _mm256_slli_epi64(cross, 32));
+	s = _mm256_add_epi64(s, _mm256_set1_epi64x(0xbLL));
+	return _mm256_and_si256(s, _mm256_set1_epi64x(0xffffffffffffLL));
+}
+
+/* Reduces the 31-bit RNG outputs (seed >> 17) of 4 lanes to [0, chunkRange).
+ * The division is exact in double precision for values below 2^31.
+ */
+TARGET_AVX2 static inline __m128i chunkOffset4(__m256i s, const StructureConfig config) {
+	__m256i r = _mm256_srli_epi64(s, 17);
+	if ((uint64_t)config.properties & USE_POW2_RNG) {
+		r = _mm256_srli_epi64(_mm256_mul_epu32(r, _mm256_set1_epi64x(config.chunkRange)), 31);
+		return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(r, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+	}
+	__m256d v = _mm256_cvtepi32_pd(_mm256_castsi256_si128(
+			_mm256_permutevar8x32_epi32(r, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6))));
+	__m256d range = _mm256_set1_pd(config.chunkRange);
+	__m256d q = _mm256_floor_pd(_mm256_div_pd(v, range));
+	return _mm256_cvttpd_epi32(_mm256_sub_pd(v, _mm256_mul_pd(q, range)));
+}
+
+TARGET_AVX2 static int getStructureOffsetsAVX2(const StructureConfig config, int64_t seed,
+		const int regionX, const int regionZ, const int n, int *offX, int *offZ) {
+	const uint64_t stepZ = 132897987541ULL;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		uint64_t s0 = (uint64_t)regionX * 341873128712ULL + (uint64_t)(regionZ + i) * stepZ + seed + config.seed;
+		__m256i s = _mm256_add_epi64(_mm256_set1_epi64x(s0),
+				_mm256_setr_epi64x(0, stepZ, 2 * stepZ, 3 * stepZ));
+		s = _mm256_xor_si256(s, _mm256_set1_epi64x(0x5deece66dLL));
+
+		s = nextSeed4(s);
+		_mm_storeu_si128((__m128i *)(offX + i), chunkOffset4(s, config));
+		s = nextSeed4(s);
+		_mm_storeu_si128((__m128i *)(offZ + i), chunkOffset4(s, config));
+	}
+	return i;
+}
+
+TARGET_AVX512 static inline __m512i nextSeed8(__m512i s) {
+	s = _mm512_mullo_epi64(s, _mm512_set1_epi64(0x5deece66dLL));
+	s = _mm512_add_epi64(s, _mm512_set1_epi64(0xbLL));
+	return _mm512_and_si512(s, _mm512_set1_epi64(0xffffffffffffLL));
+}
+
+TARGET_AVX512 static inline __m256i chunkOffset8(__m512i s, const StructureConfig config) {
+	__m512i r = _mm512_srli_epi64(s, 17);
+	if ((uint64_t)config.properties & USE_POW2_RNG) {
+		r = _mm512_srli_epi64(_mm512_mul_epu32(r, _mm512_set1_epi64(config.chunkRange)), 31);
+		return _mm512_cvtepi64_epi32(r);
+	}
+	__m512d v = _mm512_cvtepi64_pd(r);
+	__m512d range = _mm512_set1_pd(config.chunkRange);
+	__m512d q = _mm512_roundscale_pd(_mm512_div_pd(v, range), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	return _mm512_cvttpd_epi32(_mm512_sub_pd(v, _mm512_mul_pd(q, range)));
+}
+
+TARGET_AVX512 static int getStructureOffsetsAVX512(const StructureConfig config, int64_t seed,
+		const int regionX, const int regionZ, const int n, int *offX, int *offZ) {
+	const uint64_t stepZ = 132897987541ULL;
+	const __m512i lane = _mm512_mullo_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(stepZ));
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint64_t s0 = (uint64_t)regionX * 341873128712ULL + (uint64_t)(regionZ + i) * stepZ + seed + config.seed;
+		__m512i s = _mm512_add_epi64(_mm512_set1_epi64(s0), lane);
+		s = _mm512_xor_si512(s, _mm512_set1_epi64(0x5deece66dLL));
+
+		s = nextSeed8(s);
+		_mm256_storeu_si256((__m256i *)(offX + i), chunkOffset8(s, config));
+		s = nextSeed8(s);
+		_mm256_storeu_si256((__m256i *)(offZ + i), chunkOffset8(s, config));
+	}
+	return i;
+}
+
+#endif
+
+void getStructurePosBatch(const StructureConfig config, int64_t seed,
+		const int regionX, const int regionZ, const int n, Pos *out) {
+	int offX[64], offZ[64];
+	int i, k, cnt, done;
+	int level = getSimdLevel();
+
+	for (i = 0; i < n; i += cnt) {
+		cnt = n - i < 64 ? n - i : 64;
+		done = 0;
+#ifdef SIMD_X86
+		if (level >= SIMD_AVX512)
+			done = getStructureOffsetsAVX512(config, seed, regionX, regionZ + i, cnt, offX, offZ);
+		else if (level >= SIMD_AVX2)
+			done = getStructureOffsetsAVX2(config, seed, regionX, regionZ + i, cnt, offX, offZ);
+#endif
+		for (k = 0; k < done; k++) {
+			out[i + k].x = (int)(((int64_t)regionX * config.regionSize + offX[k]) * 16 + 8);
+			out[i + k].z = (int)(((int64_t)(regionZ + i + k) * config.regionSize + offZ[k]) * 16 + 8);
+		}
+		for (; k < cnt; k++)
+			out[i + k] = getStructurePos(config, seed, regionX, regionZ + i + k);
+	}
+}
+
 int getBiomeAtPos(const LayerStack g, const Pos pos) {
 	int *map = allocCache(&g.layers[g.layerNum - 1], 1, 1);
 	genArea(&g.layers[g.layerNum - 1], map, pos.x, pos.z, 1, 1);
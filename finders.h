@@ -72,6 +72,12 @@ extern Biome biomes[256];
 Pos getStructurePos(const StructureConfig config, int64_t seed,
         const int regionX, const int regionZ);
 
+/* Same as getStructurePos() for the n regions regionZ, regionZ+1, ... of the
+ * column regionX, vectorised according to getSimdLevel().
+ */
+void getStructurePosBatch(const StructureConfig config, int64_t seed,
+        const int regionX, const int regionZ, const int n, Pos *out);
+
 //==============================================================================
 // Checking Biomes & Biome Helper Functions
 //==============================================================================
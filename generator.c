@@ -1,10 +1,30 @@
 #include "generator.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #define LARGE 1
 
+#ifdef LAYER_TRACE
+static void setTraceIds(LayerStack *g);
+#endif
+
+/* Switches the layers of a built-in stack to their specialised pipeline. The
+ * traced builds keep the generic map functions, whose parent calls are
+ * recorded.
+ */
+static void setPipeline(LayerStack *g, void (*const *pipeline)(Layer *, int *, int, int, int, int), int num)
+{
+#ifndef LAYER_TRACE
+    int i;
+    if (g->layerNum != num)
+        return;
+    for (i = 0; i < num; i++)
+        g->layers[i].pipeline = pipeline[i];
+#endif
+}
+
 void setupLayer(int scale, Layer *l, Layer *p, int s, void (*getMap)(Layer *layer, int *out, int x, int z, int w, int h))
 {
     setBaseSeed(l, s);
@@ -12,7 +32,11 @@ void setupLayer(int scale, Layer *l, Layer *p, int s, void (*getMap)(Layer *laye
     l->p = p;
     l->p2 = NULL;
     l->getMap = getMap;
+    l->pipeline = NULL;
     l->oceanRnd = NULL;
+#ifdef LAYER_TRACE
+    l->traceId = -1;
+#endif
 }
 
 void setupMultiLayer(int scale, Layer *l, Layer *p1, Layer *p2, int s, void (*getMap)(Layer *layer, int *out, int x, int z, int w, int h))
@@ -22,7 +46,11 @@ void setupMultiLayer(int scale, Layer *l, Layer *p1, Layer *p2, int s, void (*ge
     l->p = p1;
     l->p2 = p2;
     l->getMap = getMap;
+    l->pipeline = NULL;
     l->oceanRnd = NULL;
+#ifdef LAYER_TRACE
+    l->traceId = -1;
+#endif
 }
 
 
@@ -105,6 +133,7 @@ LayerStack setupGeneratorMC17()
 
     setupMultiLayer(4, &g.layers[44], &g.layers[35], &g.layers[43], 100, mapRiverMix);
     setupLayer(   1, &g.layers[45], &g.layers[44],   10, mapVoronoiZoom);
+    setPipeline(&g, pipelineMC17, PIPELINE_MC17_NUM);
 #else
     setupMultiLayer(64, &g.layers[25], &g.layers[21], &g.layers[24], 1000, mapHills);
 
@@ -129,6 +158,9 @@ LayerStack setupGeneratorMC17()
 
     setupMultiLayer(4, &g.layers[42], &g.layers[33], &g.layers[41], 100, mapRiverMix);
     setupLayer(   1, &g.layers[43], &g.layers[42],   10, mapVoronoiZoom);
+#endif
+#ifdef LAYER_TRACE
+    setTraceIds(&g);
 #endif
     return g;
 }
@@ -222,6 +254,7 @@ LayerStack setupGeneratorMC113()
     setupMultiLayer(4, &g.layers[52], &g.layers[44], &g.layers[51], 100, mapOceanMix);
 
     setupLayer(1, &g.layers[53], &g.layers[52],   10, mapVoronoiZoom);
+    setPipeline(&g, pipelineMC113, PIPELINE_MC113_NUM);
 #else
     setupLayer(   4, &g.layers[33], &g.layers[32], 1000, mapSmooth);
 
@@ -250,6 +283,9 @@ LayerStack setupGeneratorMC113()
     setupMultiLayer(4, &g.layers[50], &g.layers[42], &g.layers[49], 100, mapOceanMix);
 
     setupLayer(1, &g.layers[51], &g.layers[50],   10, mapVoronoiZoom);
+#endif
+#ifdef LAYER_TRACE
+    setTraceIds(&g);
 #endif
     return g;
 }
@@ -281,8 +317,8 @@ static void getMaxArea(Layer *layer, int areaX, int areaZ, int *maxX, int *maxZ)
     }
     else if (layer->getMap == mapVoronoiZoom)
     {
-        areaX = (areaX >> 2) + 2;
-        areaZ = (areaZ >> 2) + 2;
+        areaX = ((areaX + 6) >> 2) + 1;
+        areaZ = ((areaZ + 6) >> 2) + 1;
     }
     else if (layer->getMap == mapOceanMix)
     {
@@ -340,10 +376,446 @@ void applySeed(LayerStack *g, int64_t seed)
 void genArea(Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight)
 {
     memset(out, 0, areaWidth*areaHeight*sizeof(*out));
-    layer->getMap(layer, out, areaX, areaZ, areaWidth, areaHeight);
+    if (layer->pipeline)
+        layer->pipeline(layer, out, areaX, areaZ, areaWidth, areaHeight);
+    else
+        CALL_MAP(layer, out, areaX, areaZ, areaWidth, areaHeight);
+}
+
+int getLayerBits(const Layer *layer)
+{
+    int bits, bits2;
+
+    if (layer == NULL || layer->getMap == mapNull)
+        return 8;
+    if (layer->getMap == mapRiverInit || layer->getMap == mapRiver)
+        return 32;
+    if (layer->getMap == mapSpecial)
+        return 16;
+    if (layer->getMap == mapIsland ||
+        layer->getMap == mapBiome ||
+        layer->getMap == mapHills ||
+        layer->getMap == mapHills113 ||
+        layer->getMap == mapRiverMix ||
+        layer->getMap == mapOceanTemp ||
+        layer->getMap == mapOceanMix)
+        return 8;
+
+    // the other layers move or replace the values of their parents
+    bits = getLayerBits(layer->p);
+    bits2 = layer->p2 ? getLayerBits(layer->p2) : 8;
+    return bits > bits2 ? bits : bits2;
+}
+
+static const struct { void (*getMap)(Layer *, int *, int, int, int, int); const char *name; } layerNames[] =
+{
+    {mapIsland, "mapIsland"}, {mapZoom, "mapZoom"}, {mapAddIsland, "mapAddIsland"},
+    {mapRemoveTooMuchOcean, "mapRemoveTooMuchOcean"}, {mapAddSnow, "mapAddSnow"},
+    {mapCoolWarm, "mapCoolWarm"}, {mapHeatIce, "mapHeatIce"}, {mapSpecial, "mapSpecial"},
+    {mapAddMushroomIsland, "mapAddMushroomIsland"}, {mapDeepOcean, "mapDeepOcean"},
+    {mapBiome, "mapBiome"}, {mapRiverInit, "mapRiverInit"}, {mapBiomeEdge, "mapBiomeEdge"},
+    {mapHills, "mapHills"}, {mapHills113, "mapHills113"}, {mapRiver, "mapRiver"},
+    {mapSmooth, "mapSmooth"}, {mapRareBiome, "mapRareBiome"}, {mapShore, "mapShore"},
+    {mapRiverMix, "mapRiverMix"}, {mapOceanTemp, "mapOceanTemp"}, {mapOceanMix, "mapOceanMix"},
+    {mapVoronoiZoom, "mapVoronoiZoom"},
+};
+
+const char *getLayerName(const Layer *layer)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(layerNames) / sizeof(*layerNames); i++)
+    {
+        if (layerNames[i].getMap == layer->getMap)
+            return layerNames[i].name;
+    }
+    return "custom";
+}
+
+STRUCT(LayerList)
+{
+    const Layer **layers;
+    int num, cap;
+};
+
+/* Lists the layers of the graph of 'l' once each, 'l' first. */
+static void listLayers(LayerList *list, const Layer *l)
+{
+    int i;
+
+    if (l == NULL)
+        return;
+    for (i = 0; i < list->num; i++)
+    {
+        if (list->layers[i] == l)
+            return;
+    }
+    if (list->num == list->cap)
+    {
+        list->cap = list->cap ? 2 * list->cap : 64;
+        list->layers = (const Layer **) realloc(list->layers, list->cap * sizeof(*list->layers));
+    }
+    list->layers[list->num++] = l;
+    listLayers(list, l->p);
+    listLayers(list, l->p2);
+}
+
+/* Gives every thread its own copy of the layers, as the layers keep their
+ * RNG state while generating. The copies share the read-only ocean noise.
+ */
+static Layer *cloneLayers(const Layer *layer, Layer **mem)
+{
+    LayerList list = {NULL, 0, 0};
+    Layer *copy;
+    int i, j;
+
+    listLayers(&list, layer);
+    copy = (Layer *) malloc(list.num * sizeof(Layer));
+    for (i = 0; i < list.num; i++)
+    {
+        // shared parents stay shared
+        copy[i] = *list.layers[i];
+        for (j = 0; j < list.num; j++)
+        {
+            if (list.layers[i]->p == list.layers[j])
+                copy[i].p = &copy[j];
+            if (list.layers[i]->p2 == list.layers[j])
+                copy[i].p2 = &copy[j];
+        }
+    }
+    free(list.layers);
+    *mem = copy;
+    return &copy[0];
+}
+
+STRUCT(TiledArea)
+{
+    Layer *layer;
+    void *out;
+    int bytes;
+    int areaX, areaZ, areaWidth, areaHeight;
+    int tileW, tileH, tilesX, tileNum;
+    int nextTile;
+};
+
+static void *genTiles(void *arg)
+{
+    TiledArea *a = (TiledArea *) arg;
+    Layer *mem;
+    Layer *layer = cloneLayers(a->layer, &mem);
+    int *buf = allocCache(layer, a->tileW, a->tileH);
+    int tile, i, j;
+
+    while ((tile = __atomic_fetch_add(&a->nextTile, 1, __ATOMIC_RELAXED)) < a->tileNum)
+    {
+        int x = (tile % a->tilesX) * a->tileW;
+        int z = (tile / a->tilesX) * a->tileH;
+        int w = a->areaWidth - x < a->tileW ? a->areaWidth - x : a->tileW;
+        int h = a->areaHeight - z < a->tileH ? a->areaHeight - z : a->tileH;
+
+        genArea(layer, buf, a->areaX + x, a->areaZ + z, w, h);
+
+        // the tile rows go straight to their place in the output
+        for (j = 0; j < h; j++)
+        {
+            const int *row = buf + j*w;
+            size_t idx = x + (size_t)(z + j) * a->areaWidth;
+            if (a->bytes == 4)
+            {
+                memcpy((int *) a->out + idx, row, w * sizeof(int));
+            }
+            else if (a->bytes == 2)
+            {
+                uint16_t *dst = (uint16_t *) a->out + idx;
+                for (i = 0; i < w; i++)
+                    dst[i] = (uint16_t) row[i];
+            }
+            else
+            {
+                uint8_t *dst = (uint8_t *) a->out + idx;
+                for (i = 0; i < w; i++)
+                    dst[i] = (uint8_t) row[i];
+            }
+        }
+    }
+
+    free(buf);
+    free(mem);
+    return NULL;
+}
+
+/* Generates the area in tiles of at most GEN_TILE_CELLS cells on 'threads'
+ * threads and stores them with 'bytes' per value.
+ */
+static void genAreaTiles(Layer *layer, void *out, int bytes, int areaX, int areaZ,
+        int areaWidth, int areaHeight, int threads)
+{
+    TiledArea a;
+    pthread_t *tids;
+    int i;
+
+    if (areaWidth <= 0 || areaHeight <= 0)
+        return;
+
+    a.layer = layer;
+    a.out = out;
+    a.bytes = bytes;
+    a.areaX = areaX;
+    a.areaZ = areaZ;
+    a.areaWidth = areaWidth;
+    a.areaHeight = areaHeight;
+    a.tileW = areaWidth < 512 ? areaWidth : 512;
+    a.tileH = GEN_TILE_CELLS / a.tileW;
+    if (a.tileH > areaHeight)
+        a.tileH = areaHeight;
+    a.tilesX = (areaWidth + a.tileW - 1) / a.tileW;
+    a.tileNum = a.tilesX * ((areaHeight + a.tileH - 1) / a.tileH);
+    a.nextTile = 0;
+
+    if (threads > a.tileNum)
+        threads = a.tileNum;
+    if (threads <= 1)
+    {
+        genTiles(&a);
+        return;
+    }
+
+    tids = (pthread_t *) malloc(threads * sizeof(*tids));
+    for (i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, genTiles, &a);
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+void genAreaTiled(Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads)
+{
+    genAreaTiles(layer, out, 4, areaX, areaZ, areaWidth, areaHeight, threads);
+}
+
+int genArea8(Layer *layer, uint8_t *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads)
+{
+    if (getLayerBits(layer) > 8)
+        return -1;
+    genAreaTiles(layer, out, 1, areaX, areaZ, areaWidth, areaHeight, threads);
+    return 0;
 }
 
+int genArea16(Layer *layer, uint16_t *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads)
+{
+    if (getLayerBits(layer) > 16)
+        return -1;
+    genAreaTiles(layer, out, 2, areaX, areaZ, areaWidth, areaHeight, threads);
+    return 0;
+}
+
+
+//==============================================================================
+// Layer Tracing
+//==============================================================================
 
+#ifdef LAYER_TRACE
 
+#include <time.h>
 
+#define TRACE_LAYERS    64      // layer indices that are told apart
+#define TRACE_DEPTH     64      // deepest parent chain that is followed
+#define TRACE_PATHS     4096    // distinct call paths kept for the folded stacks
+
+STRUCT(TracePath)
+{
+    int64_t selfNs;
+    int depth;
+    unsigned char ids[TRACE_DEPTH];
+};
+
+/* The trace of one thread, all the traces are merged when printed. */
+STRUCT(LayerTrace)
+{
+    int64_t calls[TRACE_LAYERS];
+    int64_t cells[TRACE_LAYERS];
+    int64_t totalNs[TRACE_LAYERS];
+    int64_t selfNs[TRACE_LAYERS];
+    const char *names[TRACE_LAYERS];
+
+    // parent chain of the running calls and the time spent in their parents
+    int depth;
+    unsigned char ids[TRACE_DEPTH];
+    int64_t childNs[TRACE_DEPTH];
+
+    TracePath paths[TRACE_PATHS];
+    int64_t lostPaths;
+    LayerTrace *next;
+};
+
+static __thread LayerTrace *threadTrace;
+static LayerTrace *traces;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void setTraceIds(LayerStack *g)
+{
+    int i;
+    for (i = 0; i < g->layerNum; i++)
+        g->layers[i].traceId = i < TRACE_LAYERS-1 ? i : TRACE_LAYERS-1;
+}
+
+static int64_t traceNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static LayerTrace *getThreadTrace(void)
+{
+    if (threadTrace == NULL)
+    {
+        threadTrace = (LayerTrace *) calloc(1, sizeof(LayerTrace));
+        pthread_mutex_lock(&traceLock);
+        threadTrace->next = traces;
+        traces = threadTrace;
+        pthread_mutex_unlock(&traceLock);
+    }
+    return threadTrace;
+}
+
+/* Adds the self time of the innermost call to its call path. */
+static void addTracePath(LayerTrace *t, int64_t selfNs)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i, k;
+
+    for (i = 0; i < t->depth; i++)
+        h = (h ^ t->ids[i]) * 1099511628211ULL;
+
+    for (k = 0; k < TRACE_PATHS; k++)
+    {
+        TracePath *p = &t->paths[(h + k) % TRACE_PATHS];
+        if (p->depth == 0)
+        {
+            p->depth = t->depth;
+            memcpy(p->ids, t->ids, t->depth);
+        }
+        if (p->depth == t->depth && memcmp(p->ids, t->ids, t->depth) == 0)
+        {
+            p->selfNs += selfNs;
+            return;
+        }
+    }
+    t->lostPaths++;
+}
+
+void traceLayerMap(Layer *l, int *out, int x, int z, int w, int h)
+{
+    LayerTrace *t = getThreadTrace();
+    int id = l->traceId >= 0 ? l->traceId : TRACE_LAYERS-1;
+    int64_t start, ns;
+
+    if (t->depth == TRACE_DEPTH)
+    {
+        l->getMap(l, out, x, z, w, h);
+        return;
+    }
+    t->ids[t->depth] = id;
+    t->childNs[t->depth] = 0;
+    t->depth++;
+
+    start = traceNs();
+    l->getMap(l, out, x, z, w, h);
+    ns = traceNs() - start;
+
+    t->names[id] = getLayerName(l);
+    t->calls[id]++;
+    t->cells[id] += (int64_t)w * h;
+    t->totalNs[id] += ns;
+    t->selfNs[id] += ns - t->childNs[t->depth-1];
+    addTracePath(t, ns - t->childNs[t->depth-1]);
+
+    t->depth--;
+    if (t->depth > 0)
+        t->childNs[t->depth-1] += ns;
+}
+
+void resetLayerTrace(void)
+{
+    LayerTrace *t;
+
+    pthread_mutex_lock(&traceLock);
+    for (t = traces; t; t = t->next)
+    {
+        // the parent chain belongs to the thread, only the records are cleared
+        memset(t->calls, 0, sizeof(t->calls));
+        memset(t->cells, 0, sizeof(t->cells));
+        memset(t->totalNs, 0, sizeof(t->totalNs));
+        memset(t->selfNs, 0, sizeof(t->selfNs));
+        memset(t->paths, 0, sizeof(t->paths));
+        t->lostPaths = 0;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+void printLayerTrace(FILE *fp)
+{
+    int64_t calls[TRACE_LAYERS] = {0}, cells[TRACE_LAYERS] = {0};
+    int64_t totalNs[TRACE_LAYERS] = {0}, selfNs[TRACE_LAYERS] = {0}, allNs = 0;
+    const char *names[TRACE_LAYERS] = {0};
+    LayerTrace *t;
+    int i;
+
+    pthread_mutex_lock(&traceLock);
+    for (t = traces; t; t = t->next)
+    {
+        for (i = 0; i < TRACE_LAYERS; i++)
+        {
+            calls[i] += t->calls[i];
+            cells[i] += t->cells[i];
+            totalNs[i] += t->totalNs[i];
+            selfNs[i] += t->selfNs[i];
+            if (t->names[i])
+                names[i] = t->names[i];
+        }
+    }
+    pthread_mutex_unlock(&traceLock);
+
+    for (i = 0; i < TRACE_LAYERS; i++)
+        allNs += selfNs[i];
+
+    fprintf(fp, "%-6s %-22s %12s %14s %12s %12s %7s %10s\n", "layer", "function",
+            "calls", "cells", "total_ms", "self_ms", "self_%", "ns/cell");
+    for (i = 0; i < TRACE_LAYERS; i++)
+    {
+        if (calls[i] == 0)
+            continue;
+        fprintf(fp, "%-6d %-22s %12" PRId64 " %14" PRId64 " %12.3f %12.3f %7.2f %10.2f\n",
+                i, names[i], calls[i], cells[i], totalNs[i] * 1e-6, selfNs[i] * 1e-6,
+                allNs ? 100.0 * selfNs[i] / allNs : 0.0, (double)selfNs[i] / cells[i]);
+    }
+}
+
+void printLayerTraceFolded(FILE *fp)
+{
+    LayerTrace *t;
+    int i, k;
+
+    // the same path may appear in several threads, the folded format sums them up
+    pthread_mutex_lock(&traceLock);
+    for (t = traces; t; t = t->next)
+    {
+        for (k = 0; k < TRACE_PATHS; k++)
+        {
+            TracePath *p = &t->paths[k];
+            if (p->depth == 0)
+                continue;
+            for (i = 0; i < p->depth; i++)
+            {
+                fprintf(fp, "%s%d:%s", i ? ";" : "", p->ids[i],
+                        t->names[p->ids[i]] ? t->names[p->ids[i]] : "custom");
+            }
+            fprintf(fp, " %" PRId64 "\n", p->selfNs);
+        }
+        if (t->lostPaths)
+            fprintf(stderr, "Layer trace: %" PRId64 " calls had no room for their path\n", t->lostPaths);
+    }
+    pthread_mutex_unlock(&traceLock);
+}
 
+#endif /* LAYER_TRACE */
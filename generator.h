@@ -112,9 +112,61 @@ void applySeed(LayerStack *g, int64_t seed);
  * The biomeIDs will be indexed in the form: out[x + z*areaWidth]
  * It is recommended that 'out' is allocated using allocCache() for the correct
  * buffer size.
+ * The layers of setupGeneratorMC17() and setupGeneratorMC113() run their
+ * specialised 'pipeline', the other layers go through getMap.
  */
 void genArea(Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight);
 
+/* Bits the values of a layer need: 8 for the biome ids, 16 for the climate
+ * layers that carry the special variants in the bits 0xf00, 32 for the river
+ * noise of mapRiverInit and the layers that pass it on, mapRiver included as
+ * it marks the land with -1.
+ */
+int getLayerBits(const Layer *layer);
+
+/* Name of the map function of a layer, e.g. "mapZoom", or "custom" for a
+ * function that is not one of the layers.c ones.
+ */
+const char *getLayerName(const Layer *layer);
+
+/* Generates a large area in tiles of at most GEN_TILE_CELLS cells, each with
+ * the halo its layers need, on 'threads' threads. Every thread has its own
+ * copy of the layers and a scratch buffer of one tile, the tiles go straight
+ * to their place in 'out', which only needs areaWidth by areaHeight entries.
+ * The result equals genArea() cell for cell.
+ */
+#define GEN_TILE_CELLS (64 * 1024)
+void genAreaTiled(Layer *layer, int *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads);
+
+/* Same as genAreaTiled() with a narrow output, so the result of a large area
+ * takes a quarter or half the memory. Only the output is narrow: every layer
+ * still runs on the int tile buffers, so the work and the memory traffic of
+ * the generator are those of genAreaTiled(). Returns -1 without generating
+ * anything if the values of the layer may not fit, see getLayerBits().
+ */
+int genArea8(Layer *layer, uint8_t *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads);
+int genArea16(Layer *layer, uint16_t *out, int areaX, int areaZ, int areaWidth, int areaHeight, int threads);
+
+
+#ifdef LAYER_TRACE
+#include <stdio.h>
+
+/* Layer tracing, only available when built with LAYER_TRACE. Every layer call
+ * made by the generators is recorded per layer index: calls, cells generated,
+ * total time and self time, i.e. without the parents. The records of all the
+ * threads are merged when printed.
+ */
+void resetLayerTrace(void);
+
+/* Prints the records as a table, one line per layer index. */
+void printLayerTrace(FILE *fp);
+
+/* Prints the self time in ns of every call path in the folded stack format
+ * of flame graph tools: "43:mapVoronoiZoom;42:mapRiverMix;... 12345".
+ */
+void printLayerTraceFolded(FILE *fp);
+#endif
+
 
 #endif /* GENERATOR_H_ */
 
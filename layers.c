@@ -6,6 +6,48 @@
 
 static void oceanRndInit(OceanRnd *rnd, int64_t seed);
 
+/* Row kernels of the selected SimdLevel, see setSimdLevel(). A NULL entry
+ * leaves the whole row to the scalar loop of the layer. The kernels return the
+ * first x they did not process.
+ */
+static struct
+{
+    int (*zoom)(const int *out, int *buf, int pX, int pZ, int pWidth, int newWidth, int z, int ws, int island);
+    int (*smooth)(Layer *l, int *out, int areaX, int areaZ, int areaWidth, int pWidth, int z);
+    int (*river)(int *out, int areaWidth, int pWidth, int z);
+    int (*biomeEdge)(int *out, int areaWidth, int pWidth, int z);
+    int (*hills)(Layer *l, int *out, const int *buf, int areaX, int areaZ, int areaWidth, int pWidth, int z, int is113);
+    int (*shore)(int *out, int areaWidth, int pWidth, int z);
+    void (*voronoi)(int *buf, int newWidth, const int *p0, const int *p1, const double *j0, const double *j1, int n);
+} kernels;
+
+static int simdLevel = -1;
+
+typedef void (*MapFunc)(Layer *l, int *out, int x, int z, int w, int h);
+
+/* The layers are written as inline templates that take the map functions of
+ * their parents. The exported map functions call the parents through
+ * CALL_MAP, the pipelines of the built-in stacks call them directly.
+ */
+#define LAYER_TEMPLATE(name) \
+static inline void name##With(Layer *l, int * __restrict out, \
+        int areaX, int areaZ, int areaWidth, int areaHeight, MapFunc parent, MapFunc parent2)
+
+#define GENERIC_LAYER(name) \
+void name(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight) \
+{ \
+    name##With(l, out, areaX, areaZ, areaWidth, areaHeight, callMap, callMap); \
+}
+
+static void callMap(Layer *l, int *out, int x, int z, int w, int h)
+{
+    CALL_MAP(l, out, x, z, w, h);
+}
+
+uint8_t biomeFlags[256];
+uint64_t plateauMatrix[256][4];
+uint64_t neighborMatrix[256][4];
+
 
 void initAddBiome(int id, int tempCat, int biometype, float temp, float height)
 {
@@ -23,6 +65,72 @@ void createMutation(int id)
     biomes[id+128].id = id+128;
 }
 
+static int existsInit(int id)
+{
+    return !(biomes[id].id & (~0xff));
+}
+
+static int equalOrPlateauInit(int id1, int id2)
+{
+    if (id1 == id2) return 1;
+    if (id1 == mesaPlateau_F || id1 == mesaPlateau) return id2 == mesaPlateau_F || id2 == mesaPlateau;
+    if (!existsInit(id1) || !existsInit(id2)) return 0;
+    // adjust for asymmetric equality (workaround to simulate a bug in the MC java code)
+    if (id1 >= 128 || id2 >= 128) {
+        // skip biomes that did not overload the isEqualTo() method
+        if (id2 == 130 || id2 == 133 || id2 == 134 || id2 == 149 || id2 == 151 || id2 == 155 ||
+           id2 == 156 || id2 == 157 || id2 == 158 || id2 == 163 || id2 == 164) return 0;
+    }
+    return biomes[id1].type == biomes[id2].type;
+}
+
+static int canBeNeighborsInit(int id1, int id2)
+{
+    if (equalOrPlateauInit(id1, id2)) return 1;
+    if (!existsInit(id1) || !existsInit(id2)) return 0;
+    int tempCat1 = biomes[id1].tempCat; if (tempCat1 == Lush) return 1;
+    int tempCat2 = biomes[id2].tempCat; if (tempCat2 == Lush) return 1;
+    return tempCat1 == tempCat2;
+}
+
+/* Fills biomeFlags and the pair matrices from the biomes array. */
+static void initBiomeTables()
+{
+    int i, j;
+
+    memset(plateauMatrix, 0, sizeof(plateauMatrix));
+    memset(neighborMatrix, 0, sizeof(neighborMatrix));
+
+    for (i = 0; i < 256; i++)
+    {
+        int flags = 0;
+
+        if (existsInit(i))
+            flags |= BIOME_EXISTS;
+        if (i == ocean || i == frozenOcean || i == warmOcean || i == lukewarmOcean || i == coldOcean)
+            flags |= BIOME_SHALLOW_OCEAN | BIOME_OCEANIC;
+        if (i == deepOcean || i == warmDeepOcean || i == lukewarmDeepOcean || i == coldDeepOcean || i == frozenDeepOcean)
+            flags |= BIOME_OCEANIC;
+        if (existsInit(i) && biomes[i].temp < 0.1)
+            flags |= BIOME_SNOWY;
+        if (biomes[i].type == Jungle)
+            flags |= BIOME_JUNGLE;
+        if (biomes[i].type == Mesa)
+            flags |= BIOME_MESA;
+        if (existsInit(i) && (biomes[i].type == Jungle || i == forest || i == taiga || (flags & BIOME_OCEANIC)))
+            flags |= BIOME_SHORE_JFTO;
+        biomeFlags[i] = flags;
+
+        for (j = 0; j < 256; j++)
+        {
+            if (equalOrPlateauInit(i, j))
+                plateauMatrix[i][j >> 6] |= 1ULL << (j & 63);
+            if (canBeNeighborsInit(i, j))
+                neighborMatrix[i][j >> 6] |= 1ULL << (j & 63);
+        }
+    }
+}
+
 /* initBiomes() has to be called before any of the generators can be used */
 void initBiomes()
 {
@@ -108,6 +216,11 @@ void initBiomes()
     createMutation(mesa);
     createMutation(mesaPlateau_F);
     createMutation(mesaPlateau);
+
+    initBiomeTables();
+
+    if (simdLevel < 0)
+        setSimdLevel(detectSimdLevel());
 }
 
 
@@ -143,7 +256,7 @@ void mapSkip(Layer *l, int * __restrict out, int x, int z, int w, int h)
         printf("mapSkip() requires a non-null parent layer.\n");
         exit(1);
     }
-    l->p->getMap(l->p, out, x, z, w, h);
+    CALL_MAP(l->p, out, x, z, w, h);
 }
 
 
@@ -169,7 +282,7 @@ void mapIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWid
             cs *= cs * 6364136223846793005LL + 1442695040888963407LL;
             cs += chunkZ;
 
-            out[x + z*areaWidth] = (cs >> 24) % 10 == 0;
+            out[x + z*areaWidth] = mcFloorMod(cs, 10) == 0;
         }
     }
 
@@ -179,134 +292,125 @@ void mapIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWid
     }
 }
 
-#if defined USE_SIMD && defined __AVX2__
+#ifdef SIMD_X86
 
-void mapZoom(Layer *l, int* __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+/* The zoom kernels expand parent cells x, x+1, ... of row z into the 2x2
+ * blocks at buf[(z<<1)*newWidth + (x<<1)]. The draws per cell are the same as
+ * in the scalar loop: bottom-left, top-right, then bottom-right. They return
+ * the first parent x that was not processed.
+ */
+TARGET_SSE42 static int mapZoomRowSSE42(const int *out, int *buf, int pX, int pZ,
+        int pWidth, int newWidth, int z, int ws, int island)
 {
-    int pWidth = (areaWidth>>1)+2, pHeight = (areaHeight>>1)+1;
-    
-    l->p->getMap(l->p, out, areaX>>1, areaZ>>1, pWidth, pHeight+1);
-    
-    __m256i (*selectRand)(__m256i* cs, int ws, __m256i a1, __m256i a2, __m256i a3, __m256i a4) = (l->p->getMap == mapIsland) ? select8Random4 : select8ModeOrRandom;
-    int newWidth = (areaWidth+10)&0xFFFFFFFE;//modified to ignore ends
-    int x, z;
-    __m256i cs, a, b, a1, b1, toBuf1, toBuf2, aSuf;
-    __m256i mask1 = _mm256_setr_epi32(0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0), mask2 = _mm256_setr_epi32(0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF);
-    __m256i shuffle = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
-    int pX = areaX&0xFFFFFFFE;
-    __m256i xs = _mm256_set_epi32(pX+14, pX+12, pX+10, pX+8, pX+6, pX+4, pX+2, pX), zs;
-    __m256i v2 = _mm256_set1_epi32(2), v16 = _mm256_set1_epi32(16);
-    int* buf = malloc((newWidth+1)*((areaHeight+2)|1)*sizeof(*buf));
-    int* idx = buf;
-    int* outIdx = out;    
-    //z first!
-    for (x = 0; x < pWidth-1; x += 8)
-    {
-        a = _mm256_loadu_si256((__m256i*)(outIdx));//0, 0
-        b = _mm256_loadu_si256((__m256i*)(outIdx+1));//1, 0
-        zs = _mm256_set1_epi32(areaZ&0xFFFFFFFE);
-        for (z = 0; z < pHeight; z++)
-        {
-            cs = set8ChunkSeeds(l->worldSeed, xs, zs);
-            outIdx += pWidth;
-            a1 = _mm256_loadu_si256((__m256i*)(outIdx));//0, 1
-            b1 = _mm256_loadu_si256((__m256i*)(outIdx+1));//1, 1
-            toBuf1 = _mm256_permutevar8x32_epi32(select8Random2(&cs, l->worldSeed, a, a1), shuffle);
-            toBuf2 = _mm256_permutevar8x32_epi32(select8Random2(&cs, l->worldSeed, a, b), shuffle);
-            aSuf = _mm256_permutevar8x32_epi32(a, shuffle);
-            _mm256_maskstore_epi32(idx, mask1, aSuf);
-            _mm256_maskstore_epi32(idx+1, mask1, toBuf2);
-            _mm256_maskstore_epi32(idx+7, mask2, aSuf);
-            _mm256_maskstore_epi32(idx+8, mask2, toBuf2);
-            idx += newWidth;
-            toBuf2 = _mm256_permutevar8x32_epi32(selectRand(&cs, l->worldSeed, a, b, a1, b1), shuffle);
-            _mm256_maskstore_epi32(idx, mask1, toBuf1);
-            _mm256_maskstore_epi32(idx+1, mask1, toBuf2);
-            _mm256_maskstore_epi32(idx+7, mask2, toBuf1);
-            _mm256_maskstore_epi32(idx+8, mask2, toBuf2);
-            idx += newWidth;
-            a = a1;
-            b = b1;
-            zs = _mm256_add_epi32(zs, v2);
-        }
-        outIdx += 8-pHeight*pWidth;        
-        idx += 16-pHeight*2*newWidth;    
-        xs = _mm256_add_epi32(xs, v16);
+    const __m128i lane = _mm_setr_epi32(0, 2, 4, 6);
+    const __m128i zs = _mm_set1_epi32((z + pZ) << 1);
+    int x;
+
+    for (x = 0; x + 4 < pWidth; x += 4)
+    {
+        const int *p = out + x + z*pWidth;
+        __m128i a  = _mm_loadu_si128((const __m128i*)(p));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i b  = _mm_loadu_si128((const __m128i*)(p + pWidth));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(p + pWidth + 1));
+        __m128i cs = set4ChunkSeeds(ws, _mm_add_epi32(_mm_set1_epi32((x + pX) << 1), lane), zs);
+
+        __m128i bl = select4Random2(&cs, ws, a, b);
+        __m128i tr = select4Random2(&cs, ws, a, a1);
+        __m128i br = island ? select4Random4(&cs, ws, a, a1, b, b1) : select4ModeOrRandom(&cs, ws, a, a1, b, b1);
+
+        int *dst = buf + (z << 1)*newWidth + (x << 1);
+        _mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi32(a, tr));
+        _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(a, tr));
+        dst += newWidth;
+        _mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi32(bl, br));
+        _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(bl, br));
     }
 
-    for (z = 0; z < areaHeight; z++)
+    return x;
+}
+
+TARGET_AVX2 static int mapZoomRowAVX2(const int *out, int *buf, int pX, int pZ,
+        int pWidth, int newWidth, int z, int ws, int island)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m256i zs = _mm256_set1_epi32((z + pZ) << 1);
+    __m256i lo, hi;
+    int x;
+
+    for (x = 0; x + 8 < pWidth; x += 8)
     {
-        memcpy(&out[z*areaWidth], &buf[(z + (areaZ & 1))*newWidth + (areaX & 1)], areaWidth*sizeof(int));
+        const int *p = out + x + z*pWidth;
+        __m256i a  = _mm256_loadu_si256((const __m256i*)(p));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i b  = _mm256_loadu_si256((const __m256i*)(p + pWidth));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 1));
+        __m256i cs = set8ChunkSeeds(ws, _mm256_add_epi32(_mm256_set1_epi32((x + pX) << 1), lane), zs);
+
+        __m256i bl = select8Random2(&cs, ws, a, b);
+        __m256i tr = select8Random2(&cs, ws, a, a1);
+        __m256i br = island ? select8Random4(&cs, ws, a, a1, b, b1) : select8ModeOrRandom(&cs, ws, a, a1, b, b1);
+
+        int *dst = buf + (z << 1)*newWidth + (x << 1);
+        lo = _mm256_unpacklo_epi32(a, tr);
+        hi = _mm256_unpackhi_epi32(a, tr);
+        _mm256_storeu_si256((__m256i*)(dst), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+        dst += newWidth;
+        lo = _mm256_unpacklo_epi32(bl, br);
+        hi = _mm256_unpackhi_epi32(bl, br);
+        _mm256_storeu_si256((__m256i*)(dst), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
     }
 
-    free(buf);
+    return x;
 }
 
-#elif defined USE_SIMD && defined __SSE4_2__
+/* Returns a mask of the first n lanes, clamped to [0, 16]. */
+static inline unsigned tailMask16(int n)
+{
+    return n >= 16 ? 0xffff : n <= 0 ? 0 : (1u << n) - 1;
+}
 
-void mapZoom(Layer *l, int* __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+TARGET_AVX512 static int mapZoomRowAVX512(const int *out, int *buf, int pX, int pZ,
+        int pWidth, int newWidth, int z, int ws, int island)
 {
-    int pWidth = (areaWidth>>1)+2, pHeight = (areaHeight>>1)+1;
-    
-    l->p->getMap(l->p, out, areaX>>1, areaZ>>1, pWidth, pHeight+1);
-    
-    __m128i (*selectRand)(__m128i* cs, int ws, __m128i a1, __m128i a2, __m128i a3, __m128i a4) = (l->p->getMap == mapIsland) ? select4Random4 : select4ModeOrRandom;
-    int newWidth = areaWidth+6&0xFFFFFFFE;//modified to ignore ends
-    int x, z;
-    __m128i cs, a, b, a1, b1, toBuf1, toBuf2, aSuf;
-    __m128i mask1 = _mm_setr_epi32(0xFFFFFFFF, 0x0, 0xFFFFFFFF, 0x0), mask2 = _mm_setr_epi32(0x0, 0xFFFFFFFF, 0x0, 0xFFFFFFFF);
-    int pX = areaX&0xFFFFFFFE;
-    __m128i xs = _mm_set_epi32(pX+6, pX+4, pX+2, pX), zs;
-    __m128i v2 = _mm_set1_epi32(2), v8 = _mm_set1_epi32(8);
-    int* buf = malloc((newWidth+1)*(areaHeight+2|1)*sizeof(*buf));
-    int* idx = buf;
-    int* outIdx = out;
-    //z first!
-    for (x = 0; x < pWidth-1; x += 4)
-    {
-        a = _mm_loadu_si128((__m128i_u*)(outIdx));//0, 0
-        b = _mm_loadu_si128((__m128i_u*)(outIdx+1));//1, 0
-        zs = _mm_set1_epi32(areaZ&0xFFFFFFFE);
-        for (z = 0; z < pHeight; z++)
-        {
-            cs = set4ChunkSeeds(l->worldSeed, xs, zs);
-            outIdx += pWidth;
-            a1 = _mm_loadu_si128((__m128i_u*)(outIdx));//0, 1
-            b1 = _mm_loadu_si128((__m128i_u*)(outIdx+1));//1, 1
-            toBuf1 = _mm_shuffle_epi32(select4Random2(&cs, l->worldSeed, a, a1), 0xD8);//11011000->3120->1324
-            toBuf2 = _mm_shuffle_epi32(select4Random2(&cs, l->worldSeed, a, b), 0xD8);
-            aSuf = _mm_shuffle_epi32(a, 0xD8);
-            _mm_maskmoveu_si128(aSuf, mask1, (char*)(idx));
-            _mm_maskmoveu_si128(toBuf2, mask1, (char*)(idx+1));
-            _mm_maskmoveu_si128(aSuf, mask2, (char*)(idx+3));
-            _mm_maskmoveu_si128(toBuf2, mask2, (char*)(idx+4));
-            idx += newWidth;
-            toBuf2 = _mm_shuffle_epi32(selectRand(&cs, l->worldSeed, a, b, a1, b1), 0xD8);
-            _mm_maskmoveu_si128(toBuf1, mask1, (char*)(idx));
-            _mm_maskmoveu_si128(toBuf2, mask1, (char*)(idx+1));
-            _mm_maskmoveu_si128(toBuf1, mask2, (char*)(idx+3));
-            _mm_maskmoveu_si128(toBuf2, mask2, (char*)(idx+4));
-            idx += newWidth;            
-            a = a1;
-            b = b1;
-            zs = _mm_add_epi32(zs, v2);
-        }
-        outIdx += 4-pHeight*pWidth;
-        idx += 8-pHeight*2*newWidth;
-        xs = _mm_add_epi32(xs, v8);
-    }
+    const __m512i lane = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i ilo = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i ihi = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    const __m512i zs = _mm512_set1_epi32((z + pZ) << 1);
+    int x;
 
-    for (z = 0; z < areaHeight; z++)
+    for (x = 0; x + 1 < pWidth; x += 16)
     {
-        memcpy(&out[z*areaWidth], &buf[(z + (areaZ & 1))*newWidth + (areaX & 1)], areaWidth*sizeof(int));
+        const int n = pWidth - 1 - x;
+        const __mmask16 m = tailMask16(n);
+        const __mmask16 mlo = tailMask16(2*n), mhi = tailMask16(2*n - 16);
+        const int *p = out + x + z*pWidth;
+        __m512i a  = _mm512_maskz_loadu_epi32(m, p);
+        __m512i a1 = _mm512_maskz_loadu_epi32(m, p + 1);
+        __m512i b  = _mm512_maskz_loadu_epi32(m, p + pWidth);
+        __m512i b1 = _mm512_maskz_loadu_epi32(m, p + pWidth + 1);
+        __m512i cs = set16ChunkSeeds(ws, _mm512_add_epi32(_mm512_set1_epi32((x + pX) << 1), lane), zs);
+
+        __m512i bl = select16Random2(&cs, ws, a, b);
+        __m512i tr = select16Random2(&cs, ws, a, a1);
+        __m512i br = island ? select16Random4(&cs, ws, a, a1, b, b1) : select16ModeOrRandom(&cs, ws, a, a1, b, b1);
+
+        int *dst = buf + (z << 1)*newWidth + (x << 1);
+        _mm512_mask_storeu_epi32(dst, mlo, _mm512_permutex2var_epi32(a, ilo, tr));
+        _mm512_mask_storeu_epi32(dst + 16, mhi, _mm512_permutex2var_epi32(a, ihi, tr));
+        dst += newWidth;
+        _mm512_mask_storeu_epi32(dst, mlo, _mm512_permutex2var_epi32(bl, ilo, br));
+        _mm512_mask_storeu_epi32(dst + 16, mhi, _mm512_permutex2var_epi32(bl, ihi, br));
     }
 
-    free(buf);
+    return pWidth - 1;
 }
 
-#else
+#endif
 
-void mapZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapZoom)
 {
     int pX = areaX >> 1;
     int pZ = areaZ >> 1;
@@ -314,7 +418,7 @@ void mapZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth
     int pHeight = (areaHeight >> 1) + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     int newWidth = (pWidth-1) << 1;
     int newHeight = (pHeight-1) << 1;
@@ -323,14 +427,19 @@ void mapZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth
 
     const int ws = (int)l->worldSeed;
     const int ss = ws * (ws * 1284865837 + 4150755663);
+    const int island = l->p->getMap == mapIsland;
 
     for (z = 0; z < pHeight - 1; z++)
     {
-        idx = (z << 1) * newWidth;
-        a = out[(z+0)*pWidth];
-        b = out[(z+1)*pWidth];
+        x = 0;
+        if (kernels.zoom)
+            x = kernels.zoom(out, buf, pX, pZ, pWidth, newWidth, z, ws, island);
 
-        for (x = 0; x < pWidth - 1; x++)
+        idx = (z << 1) * newWidth + (x << 1);
+        a = out[x + (z+0)*pWidth];
+        b = out[x + (z+1)*pWidth];
+
+        for (; x < pWidth - 1; x++)
         {
             int a1 = out[x+1 + (z+0)*pWidth];
             int b1 = out[x+1 + (z+1)*pWidth];
@@ -356,7 +465,7 @@ void mapZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth
             buf[idx] = (cs >> 24) & 1 ? a1 : a;
 
 
-            if (l->p->getMap == mapIsland)
+            if (island)
             {
                 //selectRandom4
                 cs *= cs * 1284865837 + 4150755663;
@@ -399,9 +508,10 @@ void mapZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth
 
     free(buf);
 }
-#endif
 
-void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+GENERIC_LAYER(mapZoom)
+
+LAYER_TEMPLATE(mapAddIsland)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -409,7 +519,7 @@ void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     const int64_t ws = l->worldSeed;
     const int64_t ss = ws * (ws * 6364136223846793005LL + 1442695040888963407LL);
@@ -458,7 +568,7 @@ void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int area
                     {
                     case 1: v = v02; break;
                     case 2: if ((cs & (1LL << 24)) == 0) v = v02; break;
-                    default: if (((cs >> 24) % 3) == 0) v = v02;
+                    default: if (mcFloorMod(cs, 3) == 0) v = v02;
                     }
                     cs *= cs * 6364136223846793005LL + 1442695040888963407LL;
                     cs += ws;
@@ -469,14 +579,14 @@ void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int area
                     {
                     case 1: v = v22; break;
                     case 2: if ((cs & (1LL << 24)) == 0) v = v22; break;
-                    case 3: if (((cs >> 24) % 3) == 0) v = v22; break;
+                    case 3: if (mcFloorMod(cs, 3) == 0) v = v22; break;
                     default: if ((cs & (3LL << 24)) == 0) v = v22;
                     }
                     cs *= cs * 6364136223846793005LL + 1442695040888963407LL;
                     cs += ws;
                 }
 
-                if ((cs >> 24) % 3 == 0)
+                if (mcFloorMod(cs, 3) == 0)
                     out[x + z*areaWidth] = v;
                 else if (v == 4)
                     out[x + z*areaWidth] = 4;
@@ -500,7 +610,7 @@ void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int area
                 cs *= cs * 6364136223846793005LL + 1442695040888963407LL;
                 cs += chunkZ;
 
-                if ((cs >> 24) % 5 == 0)
+                if (mcFloorMod(cs, 5) == 0)
                     out[x + z*areaWidth] = (v11 == 4) ? 4 : 0;
                 else
                     out[x + z*areaWidth] = v11;
@@ -513,8 +623,10 @@ void mapAddIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     }
 }
 
+GENERIC_LAYER(mapAddIsland)
+
 
-void mapRemoveTooMuchOcean(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapRemoveTooMuchOcean)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -522,7 +634,7 @@ void mapRemoveTooMuchOcean(Layer *l, int * __restrict out, int areaX, int areaZ,
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
@@ -540,7 +652,7 @@ void mapRemoveTooMuchOcean(Layer *l, int * __restrict out, int areaX, int areaZ,
             {
                 setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
 
-                if (mcNextInt(l, 2) == 0)
+                if (mcNextInt2(l) == 0)
                 {
                     out[x + z*areaWidth] = 1;
                 }
@@ -549,8 +661,10 @@ void mapRemoveTooMuchOcean(Layer *l, int * __restrict out, int areaX, int areaZ,
     }
 }
 
+GENERIC_LAYER(mapRemoveTooMuchOcean)
 
-void mapAddSnow(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+
+LAYER_TEMPLATE(mapAddSnow)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -558,7 +672,7 @@ void mapAddSnow(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
     
     for (z = 0; z < areaHeight; z++)
     {
@@ -573,7 +687,7 @@ void mapAddSnow(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
             else
             {
                 setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
-                int r = mcNextInt(l, 6);
+                int r = mcNextInt6(l);
                 int v;
 
                 if (r == 0)      v = 4;
@@ -586,10 +700,12 @@ void mapAddSnow(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
     }
 }
 
+GENERIC_LAYER(mapAddSnow)
+
 
 
 
-void mapCoolWarm(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapCoolWarm)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -597,7 +713,7 @@ void mapCoolWarm(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
@@ -623,8 +739,10 @@ void mapCoolWarm(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
     }
 }
 
+GENERIC_LAYER(mapCoolWarm)
 
-void mapHeatIce(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+
+LAYER_TEMPLATE(mapHeatIce)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -632,7 +750,7 @@ void mapHeatIce(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
@@ -658,10 +776,12 @@ void mapHeatIce(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
     }
 }
 
+GENERIC_LAYER(mapHeatIce)
+
 
-void mapSpecial(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapSpecial)
 {
-    l->p->getMap(l->p, out, areaX, areaZ, areaWidth, areaHeight);
+    parent(l->p, out, areaX, areaZ, areaWidth, areaHeight);
 
     int x, z;
     for (z = 0; z < areaHeight; z++)
@@ -673,9 +793,9 @@ void mapSpecial(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
 
             setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
 
-            if (mcNextInt(l, 13) == 0)
+            if (mcNextInt13(l) == 0)
             {
-                v |= (1 + mcNextInt(l, 15)) << 8 & 0xf00;
+                v |= (1 + mcNextInt15(l)) << 8 & 0xf00;
                 // 1 to 1 mapping so 'out' can be overwritten immediately
                 out[x + z*areaWidth] = v;
             }
@@ -683,8 +803,10 @@ void mapSpecial(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWi
     }
 }
 
+GENERIC_LAYER(mapSpecial)
 
-void mapAddMushroomIsland(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+
+LAYER_TEMPLATE(mapAddMushroomIsland)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -692,7 +814,7 @@ void mapAddMushroomIsland(Layer *l, int * __restrict out, int areaX, int areaZ,
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
@@ -704,7 +826,7 @@ void mapAddMushroomIsland(Layer *l, int * __restrict out, int areaX, int areaZ,
             if (v11 == 0 && !out[x+0 + (z+0)*pWidth] && !out[x+2 + (z+0)*pWidth] && !out[x+0 + (z+2)*pWidth] && !out[x+2 + (z+2)*pWidth])
             {
                 setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
-                if (mcNextInt(l, 100) == 0) {
+                if (mcNextInt100(l) == 0) {
                     out[x + z*areaWidth] = mushroomIsland;
                     continue;
                 }
@@ -715,8 +837,10 @@ void mapAddMushroomIsland(Layer *l, int * __restrict out, int areaX, int areaZ,
     }
 }
 
+GENERIC_LAYER(mapAddMushroomIsland)
+
 
-void mapDeepOcean(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapDeepOcean)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -724,7 +848,7 @@ void mapDeepOcean(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
@@ -763,15 +887,17 @@ void mapDeepOcean(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     }
 }
 
+GENERIC_LAYER(mapDeepOcean)
+
 
 const int warmBiomes[] = {desert, desert, desert, savanna, savanna, plains};
 const int lushBiomes[] = {forest, roofedForest, extremeHills, plains, birchForest, swampland};
 const int coldBiomes[] = {forest, extremeHills, taiga, plains};
 const int snowBiomes[] = {icePlains, icePlains, icePlains, coldTaiga};
 
-void mapBiome(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapBiome)
 {
-    l->p->getMap(l->p, out, areaX, areaZ, areaWidth, areaHeight);
+    parent(l->p, out, areaX, areaZ, areaWidth, areaHeight);
 
     int x, z;
     for (z = 0; z < areaHeight; z++)
@@ -793,19 +919,19 @@ void mapBiome(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidt
 
             switch(id){
             case Warm:
-                if (hasHighBit) out[idx] = (mcNextInt(l, 3) == 0) ? mesaPlateau : mesaPlateau_F;
-                else out[idx] = warmBiomes[mcNextInt(l, 6)];
+                if (hasHighBit) out[idx] = (mcNextInt3(l) == 0) ? mesaPlateau : mesaPlateau_F;
+                else out[idx] = warmBiomes[mcNextInt6(l)];
                 break;
             case Lush:
                 if (hasHighBit) out[idx] = jungle;
-                else out[idx] = lushBiomes[mcNextInt(l, 6)];
+                else out[idx] = lushBiomes[mcNextInt6(l)];
                 break;
             case Cold:
                 if (hasHighBit) out[idx] = megaTaiga;
-                else out[idx] = coldBiomes[mcNextInt(l, 4)];
+                else out[idx] = coldBiomes[mcNextInt4(l)];
                 break;
             case Freezing:
-                out[idx] = snowBiomes[mcNextInt(l, 4)];
+                out[idx] = snowBiomes[mcNextInt4(l)];
                 break;
             default:
                 out[idx] = mushroomIsland;
@@ -814,10 +940,12 @@ void mapBiome(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidt
     }
 }
 
+GENERIC_LAYER(mapBiome)
+
 
-void mapRiverInit(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapRiverInit)
 {
-    l->p->getMap(l->p, out, areaX, areaZ, areaWidth, areaHeight);
+    parent(l->p, out, areaX, areaZ, areaWidth, areaHeight);
 
     int x, z;
     for (z = 0; z < areaHeight; z++)
@@ -827,7 +955,7 @@ void mapRiverInit(Layer *l, int * __restrict out, int areaX, int areaZ, int area
             if (out[x + z*areaWidth] > 0)
             {
                 setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
-                out[x + z*areaWidth] = mcNextInt(l, 299999)+2;
+                out[x + z*areaWidth] = mcNextInt299999(l)+2;
             }
             else
             {
@@ -837,6 +965,8 @@ void mapRiverInit(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     }
 }
 
+GENERIC_LAYER(mapRiverInit)
+
 
 // replaceEdgeIfNecessary() always returns 0 in the only place it is used in
 // Minecraft, making it redundant.
@@ -858,7 +988,7 @@ static inline int replaceEdge(int *out, int idx, int v10, int v21, int v01, int
 {
     if (id != baseID) return 0;
 
-    if (equalOrPlateau(v10, baseID) && equalOrPlateau(v21, baseID) && equalOrPlateau(v01, baseID) && equalOrPlateau(v12, baseID))
+    if (equalOrPlateau(v10, baseID) & equalOrPlateau(v21, baseID) & equalOrPlateau(v01, baseID) & equalOrPlateau(v12, baseID))
         out[idx] = id;
     else
         out[idx] = edgeID;
@@ -866,347 +996,216 @@ static inline int replaceEdge(int *out, int idx, int v10, int v21, int v01, int
     return 1;
 }
 
-void mapBiomeEdge(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+static inline void biomeEdgeCell(int *out, int idx, int v11, int v10, int v21, int v01, int v12)
 {
-    int pX = areaX - 1;
-    int pZ = areaZ - 1;
-    int pWidth = areaWidth + 2;
-    int pHeight = areaHeight + 2;
-    int x, z;
-
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
-
-    for (z = 0; z < areaHeight; z++)
+    if (/*!replaceEdgeIfNecessary(out, idx, v10, v21, v01, v12, v11, extremeHills, extremeHillsEdge) &&*/
+       !replaceEdge(out, idx, v10, v21, v01, v12, v11, mesaPlateau_F, mesa) &&
+       !replaceEdge(out, idx, v10, v21, v01, v12, v11, mesaPlateau, mesa) &&
+       !replaceEdge(out, idx, v10, v21, v01, v12, v11, megaTaiga, taiga))
     {
-        for (x = 0; x < areaWidth; x++)
+        if (v11 == desert)
         {
-            int v11 = out[x+1 + (z+1)*pWidth];
-
-            int v10 = out[x+1 + (z+0)*pWidth];
-            int v21 = out[x+2 + (z+1)*pWidth];
-            int v01 = out[x+0 + (z+1)*pWidth];
-            int v12 = out[x+1 + (z+2)*pWidth];
-
-            if (/*!replaceEdgeIfNecessary(out, x + z*areaWidth, v10, v21, v01, v12, v11, extremeHills, extremeHillsEdge) &&*/
-               !replaceEdge(out, x + z*areaWidth, v10, v21, v01, v12, v11, mesaPlateau_F, mesa) &&
-               !replaceEdge(out, x + z*areaWidth, v10, v21, v01, v12, v11, mesaPlateau, mesa) &&
-               !replaceEdge(out, x + z*areaWidth, v10, v21, v01, v12, v11, megaTaiga, taiga))
+            if (v10 != icePlains && v21 != icePlains && v01 != icePlains && v12 != icePlains)
             {
-                if (v11 == desert)
-                {
-                    if (v10 != icePlains && v21 != icePlains && v01 != icePlains && v12 != icePlains)
-                    {
-                        out[x + z*areaWidth] = v11;
-                    }
-                    else
-                    {
-                        out[x + z*areaWidth] = extremeHillsPlus;
-                    }
-                }
-                else if (v11 == swampland)
-                {
-                    if (v10 != desert && v21 != desert && v01 != desert && v12 != desert &&
-                       v10 != coldTaiga && v21 != coldTaiga && v01 != coldTaiga && v12 != coldTaiga &&
-                       v10 != icePlains && v21 != icePlains && v01 != icePlains && v12 != icePlains)
-                    {
-                        if (v10 != jungle && v12 != jungle && v21 != jungle && v01 != jungle)
-                            out[x + z*areaWidth] = v11;
-                        else
-                            out[x + z*areaWidth] = jungleEdge;
-                    }
-                    else
-                    {
-                        out[x + z*areaWidth] = plains;
-                    }
-                }
+                out[idx] = v11;
+            }
+            else
+            {
+                out[idx] = extremeHillsPlus;
+            }
+        }
+        else if (v11 == swampland)
+        {
+            if (v10 != desert && v21 != desert && v01 != desert && v12 != desert &&
+               v10 != coldTaiga && v21 != coldTaiga && v01 != coldTaiga && v12 != coldTaiga &&
+               v10 != icePlains && v21 != icePlains && v01 != icePlains && v12 != icePlains)
+            {
+                if (v10 != jungle && v12 != jungle && v21 != jungle && v01 != jungle)
+                    out[idx] = v11;
                 else
-                {
-                    out[x + z*areaWidth] = v11;
-                }
+                    out[idx] = jungleEdge;
+            }
+            else
+            {
+                out[idx] = plains;
             }
         }
+        else
+        {
+            out[idx] = v11;
+        }
     }
 }
 
+#ifdef SIMD_X86
 
-void mapHills(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+TARGET_SSE42 static inline __m128i same4Cross(__m128i v11, __m128i v10, __m128i v21, __m128i v01, __m128i v12)
 {
-    int pX = areaX - 1;
-    int pZ = areaZ - 1;
-    int pWidth = areaWidth + 2;
-    int pHeight = areaHeight + 2;
-    int x, z;
-    int *buf = NULL;
+    return _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi32(v11, v10), _mm_cmpeq_epi32(v11, v21)),
+            _mm_and_si128(_mm_cmpeq_epi32(v11, v01), _mm_cmpeq_epi32(v11, v12)));
+}
 
-    if (l->p2 == NULL)
-    {
-        printf("mapHills() requires two parents! Use setupMultiLayer()\n");
-        exit(1);
-    }
+TARGET_SSE42 static inline int lanes4(__m128i mask)
+{
+    return _mm_movemask_ps(_mm_castsi128_ps(mask));
+}
 
-    buf = (int *) malloc(pWidth*pHeight*sizeof(int));
+TARGET_AVX2 static inline __m256i same8Cross(__m256i v11, __m256i v10, __m256i v21, __m256i v01, __m256i v12)
+{
+    return _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v10), _mm256_cmpeq_epi32(v11, v21)),
+            _mm256_and_si256(_mm256_cmpeq_epi32(v11, v01), _mm256_cmpeq_epi32(v11, v12)));
+}
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
-    memcpy(buf, out, pWidth*pHeight*sizeof(int));
+TARGET_AVX2 static inline int lanes8(__m256i mask)
+{
+    return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+}
 
-    l->p2->getMap(l->p2, out, pX, pZ, pWidth, pHeight);
+TARGET_AVX512 static inline __mmask16 same16Cross(__m512i v11, __m512i v10, __m512i v21, __m512i v01, __m512i v12)
+{
+    return _mm512_cmpeq_epi32_mask(v11, v10) & _mm512_cmpeq_epi32_mask(v11, v21) &
+           _mm512_cmpeq_epi32_mask(v11, v01) & _mm512_cmpeq_epi32_mask(v11, v12);
+}
 
-    for (z = 0; z < areaHeight; z++)
+/* Only the centres mesaPlateau_F, mesaPlateau, megaTaiga, desert and swampland
+ * can change, and none of them do when all four neighbours are the same.
+ * The remaining lanes fall back to biomeEdgeCell().
+ */
+TARGET_SSE42 static int mapBiomeEdgeRowSSE42(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x, k;
+
+    for (x = 0; x + 4 <= areaWidth; x += 4)
     {
-        for (x = 0; x < areaWidth; x++)
+        const int *p = out + x + z*pWidth;
+        __m128i v10 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i v01 = _mm_loadu_si128((const __m128i*)(p + pWidth));
+        __m128i v11 = _mm_loadu_si128((const __m128i*)(p + pWidth + 1));
+        __m128i v21 = _mm_loadu_si128((const __m128i*)(p + pWidth + 2));
+        __m128i v12 = _mm_loadu_si128((const __m128i*)(p + 2*pWidth + 1));
+
+        __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(v11, _mm_set1_epi32(mesaPlateau_F)),
+                             _mm_cmpeq_epi32(v11, _mm_set1_epi32(mesaPlateau))),
+                _mm_or_si128(_mm_cmpeq_epi32(v11, _mm_set1_epi32(megaTaiga)),
+                _mm_or_si128(_mm_cmpeq_epi32(v11, _mm_set1_epi32(desert)),
+                             _mm_cmpeq_epi32(v11, _mm_set1_epi32(swampland)))));
+        int slow = lanes4(_mm_andnot_si128(same4Cross(v11, v10, v21, v01, v12), special));
+
+        _mm_storeu_si128((__m128i*)(out + x + z*areaWidth), v11);
+
+        if (slow)
         {
-            setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
-            int a11 = buf[x+1 + (z+1)*pWidth]; // biome branch
-            int b11 = out[x+1 + (z+1)*pWidth]; // river branch
-            int idx = x + z*areaWidth;
-
-            int var12 = (b11 - 2) % 29 == 0;
-
-            if (a11 != 0 && b11 >= 2 && (b11 - 2) % 29 == 1 && a11 < 128)
-            {
-                out[idx] = (biomeExists(a11 + 128)) ? a11 + 128 : a11;
-            }
-            else if (mcNextInt(l, 3) != 0 && !var12)
+            int a11[4], a10[4], a21[4], a01[4], a12[4];
+            _mm_storeu_si128((__m128i*)a11, v11);
+            _mm_storeu_si128((__m128i*)a10, v10);
+            _mm_storeu_si128((__m128i*)a21, v21);
+            _mm_storeu_si128((__m128i*)a01, v01);
+            _mm_storeu_si128((__m128i*)a12, v12);
+
+            for (; slow; slow &= slow - 1)
             {
-                out[idx] = a11;
-            }
-            else
-            {
-                int hillID = a11;
-
-                switch(a11){
-                case desert:
-                    hillID = desertHills; break;
-                case forest:
-                    hillID = forestHills; break;
-                case birchForest:
-                    hillID = birchForestHills; break;
-                case roofedForest:
-                    hillID = plains; break;
-                case taiga:
-                    hillID = taigaHills; break;
-                case megaTaiga:
-                    hillID = megaTaigaHills; break;
-                case coldTaiga:
-                    hillID = coldTaigaHills; break;
-                case plains:
-                    hillID = (mcNextInt(l, 3) == 0) ? forestHills : forest; break;
-                case icePlains:
-                    hillID = iceMountains; break;
-                case jungle:
-                    hillID = jungleHills; break;
-                case ocean:
-                    hillID = deepOcean; break;
-                case extremeHills:
-                    hillID = extremeHillsPlus; break;
-                case savanna:
-                    hillID = savannaPlateau; break;
-                default:
-                    if (equalOrPlateau(a11, mesaPlateau_F))
-                        hillID = mesa;
-                    else if (a11 == deepOcean && mcNextInt(l, 3) == 0)
-                        hillID = (mcNextInt(l, 2) == 0) ? plains : forest;
-                    break;
-                }
-
-                if (var12 && hillID != a11)
-                {
-                    if (biomeExists(hillID + 128))
-                        hillID += 128;
-                    else
-                        hillID = a11;
-                }
-
-                if (hillID == a11)
-                {
-                    out[idx] = a11;
-                }
-                else
-                {
-                    int a10 = buf[x+1 + (z+0)*pWidth];
-                    int a21 = buf[x+2 + (z+1)*pWidth];
-                    int a01 = buf[x+0 + (z+1)*pWidth];
-                    int a12 = buf[x+1 + (z+2)*pWidth];
-                    int equals = 0;
-
-                    if (equalOrPlateau(a10, a11)) equals++;
-                    if (equalOrPlateau(a21, a11)) equals++;
-                    if (equalOrPlateau(a01, a11)) equals++;
-                    if (equalOrPlateau(a12, a11)) equals++;
-
-                    if (equals >= 3)
-                        out[idx] = hillID;
-                    else
-                        out[idx] = a11;
-                }
+                k = __builtin_ctz(slow);
+                biomeEdgeCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
             }
         }
     }
 
-    free(buf);
+    return x;
 }
 
-
-void mapHills113(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+TARGET_AVX2 static int mapBiomeEdgeRowAVX2(int * __restrict out, int areaWidth, int pWidth, int z)
 {
-    int pX = areaX - 1;
-    int pZ = areaZ - 1;
-    int pWidth = areaWidth + 2;
-    int pHeight = areaHeight + 2;
-    int x, z;
-    int *buf = NULL;
-
-    if (l->p2 == NULL)
-    {
-        printf("mapHills() requires two parents! Use setupMultiLayer()\n");
-        exit(1);
-    }
-
-    buf = (int *) malloc(pWidth*pHeight*sizeof(int));
-
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
-    memcpy(buf, out, pWidth*pHeight*sizeof(int));
-
-    l->p2->getMap(l->p2, out, pX, pZ, pWidth, pHeight);
+    int x, k;
 
-    for (z = 0; z < areaHeight; z++)
+    for (x = 0; x + 8 <= areaWidth; x += 8)
     {
-        for (x = 0; x < areaWidth; x++)
+        const int *p = out + x + z*pWidth;
+        __m256i v10 = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i v01 = _mm256_loadu_si256((const __m256i*)(p + pWidth));
+        __m256i v11 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 1));
+        __m256i v21 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 2));
+        __m256i v12 = _mm256_loadu_si256((const __m256i*)(p + 2*pWidth + 1));
+
+        __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi32(v11, _mm256_set1_epi32(mesaPlateau_F)),
+                                _mm256_cmpeq_epi32(v11, _mm256_set1_epi32(mesaPlateau))),
+                _mm256_or_si256(_mm256_cmpeq_epi32(v11, _mm256_set1_epi32(megaTaiga)),
+                _mm256_or_si256(_mm256_cmpeq_epi32(v11, _mm256_set1_epi32(desert)),
+                                _mm256_cmpeq_epi32(v11, _mm256_set1_epi32(swampland)))));
+        int slow = lanes8(_mm256_andnot_si256(same8Cross(v11, v10, v21, v01, v12), special));
+
+        _mm256_storeu_si256((__m256i*)(out + x + z*areaWidth), v11);
+
+        if (slow)
         {
-            setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
-            int a11 = buf[x+1 + (z+1)*pWidth]; // biome branch
-            int b11 = out[x+1 + (z+1)*pWidth]; // river branch
-            int idx = x + z*areaWidth;
-
-            int bn = (b11 - 2) % 29;
-
-            if (!(isOceanic(a11) || b11 < 2 || bn != 1 || a11 >= 128))
-            {
-                out[idx] = (biomeExists(a11 + 128)) ? a11 + 128 : a11;
-            }
-            else if (mcNextInt(l, 3) == 0 || bn == 0)
-            {
-                int hillID = a11;
-
-                switch(a11){
-                case desert:
-                    hillID = desertHills; break;
-                case forest:
-                    hillID = forestHills; break;
-                case birchForest:
-                    hillID = birchForestHills; break;
-                case roofedForest:
-                    hillID = plains; break;
-                case taiga:
-                    hillID = taigaHills; break;
-                case megaTaiga:
-                    hillID = megaTaigaHills; break;
-                case coldTaiga:
-                    hillID = coldTaigaHills; break;
-                case plains:
-                    hillID = (mcNextInt(l, 3) == 0) ? forestHills : forest; break;
-                case icePlains:
-                    hillID = iceMountains; break;
-                case jungle:
-                    hillID = jungleHills; break;
-                case ocean:
-                    hillID = deepOcean; break;
-                case extremeHills:
-                    hillID = extremeHillsPlus; break;
-                case savanna:
-                    hillID = savannaPlateau; break;
-                default:
-                    if (equalOrPlateau(a11, mesaPlateau_F))
-                        hillID = mesa;
-                    else if ((a11 == deepOcean || a11 == lukewarmDeepOcean ||
-                             a11 == coldDeepOcean || a11 == frozenDeepOcean) &&
-                             mcNextInt(l, 3) == 0)
-                        hillID = (mcNextInt(l, 2) == 0) ? plains : forest;
-                    break;
-                }
-
-                if (bn == 0 && hillID != a11)
-                {
-                    if (biomeExists(hillID + 128))
-                        hillID += 128;
-                    else
-                        hillID = a11;
-                }
-
-                if (hillID != a11)
-                {
-                    int a10 = buf[x+1 + (z+0)*pWidth];
-                    int a21 = buf[x+2 + (z+1)*pWidth];
-                    int a01 = buf[x+0 + (z+1)*pWidth];
-                    int a12 = buf[x+1 + (z+2)*pWidth];
-                    int equals = 0;
-
-                    if (equalOrPlateau(a10, a11)) equals++;
-                    if (equalOrPlateau(a21, a11)) equals++;
-                    if (equalOrPlateau(a01, a11)) equals++;
-                    if (equalOrPlateau(a12, a11)) equals++;
-
-                    if (equals >= 3)
-                        out[idx] = hillID;
-                    else
-                        out[idx] = a11;
-                }
-                else
-                {
-                    out[idx] = a11;
-                }
-            }
-            else
+            int a11[8], a10[8], a21[8], a01[8], a12[8];
+            _mm256_storeu_si256((__m256i*)a11, v11);
+            _mm256_storeu_si256((__m256i*)a10, v10);
+            _mm256_storeu_si256((__m256i*)a21, v21);
+            _mm256_storeu_si256((__m256i*)a01, v01);
+            _mm256_storeu_si256((__m256i*)a12, v12);
+
+            for (; slow; slow &= slow - 1)
             {
-                out[idx] = a11;
+                k = __builtin_ctz(slow);
+                biomeEdgeCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
             }
         }
     }
 
-    free(buf);
-}
-
-
-
-static inline int reduceID(int id)
-{
-    return id >= 2 ? 2 + (id & 1) : id;
+    return x;
 }
 
-void mapRiver(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+TARGET_AVX512 static int mapBiomeEdgeRowAVX512(int * __restrict out, int areaWidth, int pWidth, int z)
 {
-    int pX = areaX - 1;
-    int pZ = areaZ - 1;
-    int pWidth = areaWidth + 2;
-    int pHeight = areaHeight + 2;
-    int x, z;
+    int x, k;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
-
-    for (z = 0; z < areaHeight; z++)
+    for (x = 0; x < areaWidth; x += 16)
     {
-        for (x = 0; x < areaWidth; x++)
+        const __mmask16 m = tailMask16(areaWidth - x);
+        const int *p = out + x + z*pWidth;
+        __m512i v10 = _mm512_maskz_loadu_epi32(m, p + 1);
+        __m512i v01 = _mm512_maskz_loadu_epi32(m, p + pWidth);
+        __m512i v11 = _mm512_maskz_loadu_epi32(m, p + pWidth + 1);
+        __m512i v21 = _mm512_maskz_loadu_epi32(m, p + pWidth + 2);
+        __m512i v12 = _mm512_maskz_loadu_epi32(m, p + 2*pWidth + 1);
+
+        __mmask16 special =
+                _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(mesaPlateau_F)) |
+                _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(mesaPlateau)) |
+                _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(megaTaiga)) |
+                _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(desert)) |
+                _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(swampland));
+        unsigned slow = special & ~same16Cross(v11, v10, v21, v01, v12) & m;
+
+        _mm512_mask_storeu_epi32(out + x + z*areaWidth, m, v11);
+
+        if (slow)
         {
-            int v01 = reduceID(out[x+0 + (z+1)*pWidth]);
-            int v21 = reduceID(out[x+2 + (z+1)*pWidth]);
-            int v10 = reduceID(out[x+1 + (z+0)*pWidth]);
-            int v12 = reduceID(out[x+1 + (z+2)*pWidth]);
-            int v11 = reduceID(out[x+1 + (z+1)*pWidth]);
-
-            if (v11 == v01 && v11 == v10 && v11 == v21 && v11 == v12)
-            {
-                out[x + z * areaWidth] = -1;
-            }
-            else
+            int a11[16], a10[16], a21[16], a01[16], a12[16];
+            _mm512_storeu_si512(a11, v11);
+            _mm512_storeu_si512(a10, v10);
+            _mm512_storeu_si512(a21, v21);
+            _mm512_storeu_si512(a01, v01);
+            _mm512_storeu_si512(a12, v12);
+
+            for (; slow; slow &= slow - 1)
             {
-                out[x + z * areaWidth] = river;
+                k = __builtin_ctz(slow);
+                biomeEdgeCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
             }
         }
     }
+
+    return areaWidth;
 }
 
+#endif
 
-void mapSmooth(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapBiomeEdge)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -1214,26 +1213,720 @@ void mapSmooth(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWid
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
-        for (x = 0; x < areaWidth; x++)
+        x = 0;
+        if (kernels.biomeEdge)
+            x = kernels.biomeEdge(out, areaWidth, pWidth, z);
+        for (; x < areaWidth; x++)
         {
             int v11 = out[x+1 + (z+1)*pWidth];
+
             int v10 = out[x+1 + (z+0)*pWidth];
             int v21 = out[x+2 + (z+1)*pWidth];
             int v01 = out[x+0 + (z+1)*pWidth];
             int v12 = out[x+1 + (z+2)*pWidth];
 
-            if (v01 == v21 && v10 == v12)
-            {
-                setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
+            biomeEdgeCell(out, x + z*areaWidth, v11, v10, v21, v01, v12);
+        }
+    }
+}
 
-                if (mcNextInt(l, 2) == 0)
-                    v11 = v01;
-                else
-                    v11 = v10;
+GENERIC_LAYER(mapBiomeEdge)
+
+
+/* Hill variants that a biome can turn into. Plains and the deep oceans depend
+ * on the RNG (marked -1), the mesa entries are the ids for which
+ * equalOrPlateau(id, mesaPlateau_F) holds. Biomes with a zero entry never
+ * change in the hills layer unless a river mutation applies.
+ */
+static const int hillsTable[256] =
+{
+    [desert]            = desertHills,
+    [forest]            = forestHills,
+    [birchForest]       = birchForestHills,
+    [roofedForest]      = plains,
+    [taiga]             = taigaHills,
+    [megaTaiga]         = megaTaigaHills,
+    [coldTaiga]         = coldTaigaHills,
+    [plains]            = -1,
+    [icePlains]         = iceMountains,
+    [jungle]            = jungleHills,
+    [ocean]             = deepOcean,
+    [extremeHills]      = extremeHillsPlus,
+    [savanna]           = savannaPlateau,
+    [mesaPlateau_F]     = mesa,
+    [mesaPlateau]       = mesa,
+    [mesa+128]          = mesa,
+    [mesaPlateau_F+128] = mesa,
+    [mesaPlateau+128]   = mesa,
+    [deepOcean]         = -1,
+    [lukewarmDeepOcean] = -1,
+    [coldDeepOcean]     = -1,
+    [frozenDeepOcean]   = -1,
+};
+
+static inline int hillsCanChange(int id)
+{
+    return (id & (~0xff)) || hillsTable[id] != 0;
+}
+
+static inline int hillsCell(Layer *l, const int *buf, int pWidth, int x, int z, int areaX, int areaZ, int a11, int b11)
+{
+    int var12 = (b11 - 2) % 29 == 0;
+
+    if (a11 != 0 && b11 >= 2 && (b11 - 2) % 29 == 1 && a11 < 128)
+    {
+        return (biomeExists(a11 + 128)) ? a11 + 128 : a11;
+    }
+
+    // the outcome no longer depends on the RNG
+    if (!hillsCanChange(a11))
+        return a11;
+
+    setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
+
+    if (mcNextInt3(l) != 0 && !var12)
+    {
+        return a11;
+    }
+    else
+    {
+        int hillID = a11;
+
+        switch(a11){
+        case desert:
+            hillID = desertHills; break;
+        case forest:
+            hillID = forestHills; break;
+        case birchForest:
+            hillID = birchForestHills; break;
+        case roofedForest:
+            hillID = plains; break;
+        case taiga:
+            hillID = taigaHills; break;
+        case megaTaiga:
+            hillID = megaTaigaHills; break;
+        case coldTaiga:
+            hillID = coldTaigaHills; break;
+        case plains:
+            hillID = (mcNextInt3(l) == 0) ? forestHills : forest; break;
+        case icePlains:
+            hillID = iceMountains; break;
+        case jungle:
+            hillID = jungleHills; break;
+        case ocean:
+            hillID = deepOcean; break;
+        case extremeHills:
+            hillID = extremeHillsPlus; break;
+        case savanna:
+            hillID = savannaPlateau; break;
+        default:
+            if (equalOrPlateau(a11, mesaPlateau_F))
+                hillID = mesa;
+            else if (a11 == deepOcean && mcNextInt3(l) == 0)
+                hillID = (mcNextInt2(l) == 0) ? plains : forest;
+            break;
+        }
+
+        if (var12 && hillID != a11)
+        {
+            if (biomeExists(hillID + 128))
+                hillID += 128;
+            else
+                hillID = a11;
+        }
+
+        if (hillID == a11)
+        {
+            return a11;
+        }
+        else
+        {
+            int a10 = buf[x+1 + (z+0)*pWidth];
+            int a21 = buf[x+2 + (z+1)*pWidth];
+            int a01 = buf[x+0 + (z+1)*pWidth];
+            int a12 = buf[x+1 + (z+2)*pWidth];
+            int equals = equalOrPlateau(a10, a11) + equalOrPlateau(a21, a11) +
+                         equalOrPlateau(a01, a11) + equalOrPlateau(a12, a11);
+
+            if (equals >= 3)
+                return hillID;
+            else
+                return a11;
+        }
+    }
+}
+
+static inline int hills113Cell(Layer *l, const int *buf, int pWidth, int x, int z, int areaX, int areaZ, int a11, int b11)
+{
+    int bn = (b11 - 2) % 29;
+
+    if (!(isOceanic(a11) || b11 < 2 || bn != 1 || a11 >= 128))
+    {
+        return (biomeExists(a11 + 128)) ? a11 + 128 : a11;
+    }
+
+    // the outcome no longer depends on the RNG
+    if (!hillsCanChange(a11))
+        return a11;
+
+    setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
+
+    if (mcNextInt3(l) == 0 || bn == 0)
+    {
+        int hillID = a11;
+
+        switch(a11){
+        case desert:
+            hillID = desertHills; break;
+        case forest:
+            hillID = forestHills; break;
+        case birchForest:
+            hillID = birchForestHills; break;
+        case roofedForest:
+            hillID = plains; break;
+        case taiga:
+            hillID = taigaHills; break;
+        case megaTaiga:
+            hillID = megaTaigaHills; break;
+        case coldTaiga:
+            hillID = coldTaigaHills; break;
+        case plains:
+            hillID = (mcNextInt3(l) == 0) ? forestHills : forest; break;
+        case icePlains:
+            hillID = iceMountains; break;
+        case jungle:
+            hillID = jungleHills; break;
+        case ocean:
+            hillID = deepOcean; break;
+        case extremeHills:
+            hillID = extremeHillsPlus; break;
+        case savanna:
+            hillID = savannaPlateau; break;
+        default:
+            if (equalOrPlateau(a11, mesaPlateau_F))
+                hillID = mesa;
+            else if ((a11 == deepOcean || a11 == lukewarmDeepOcean ||
+                     a11 == coldDeepOcean || a11 == frozenDeepOcean) &&
+                     mcNextInt3(l) == 0)
+                hillID = (mcNextInt2(l) == 0) ? plains : forest;
+            break;
+        }
+
+        if (bn == 0 && hillID != a11)
+        {
+            if (biomeExists(hillID + 128))
+                hillID += 128;
+            else
+                hillID = a11;
+        }
+
+        if (hillID != a11)
+        {
+            int a10 = buf[x+1 + (z+0)*pWidth];
+            int a21 = buf[x+2 + (z+1)*pWidth];
+            int a01 = buf[x+0 + (z+1)*pWidth];
+            int a12 = buf[x+1 + (z+2)*pWidth];
+            int equals = equalOrPlateau(a10, a11) + equalOrPlateau(a21, a11) +
+                         equalOrPlateau(a01, a11) + equalOrPlateau(a12, a11);
+
+            if (equals >= 3)
+                return hillID;
+            else
+                return a11;
+        }
+        else
+        {
+            return a11;
+        }
+    }
+    else
+    {
+        return a11;
+    }
+}
+
+#ifdef SIMD_X86
+
+/* (n - 2) % 29 for n >= 2, using a multiply-high by ceil(2^36 / 29) which is
+ * exact for all 32-bit unsigned values.
+ */
+TARGET_AVX2 static inline __m256i riverMod8(__m256i n)
+{
+    const __m256i magic = _mm256_set1_epi32((int)0x8D3DCB09);
+    n = _mm256_sub_epi32(n, _mm256_set1_epi32(2));
+    __m256i qe = _mm256_srli_epi64(_mm256_mul_epu32(n, magic), 36);
+    __m256i qo = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(n, 32), magic), 36);
+    __m256i q = _mm256_blend_epi32(qe, _mm256_slli_epi64(qo, 32), 0xAA);
+    return _mm256_sub_epi32(n, _mm256_mullo_epi32(q, _mm256_set1_epi32(29)));
+}
+
+TARGET_AVX512 static inline __m512i riverMod16(__m512i n)
+{
+    const __m512i magic = _mm512_set1_epi32((int)0x8D3DCB09);
+    n = _mm512_sub_epi32(n, _mm512_set1_epi32(2));
+    __m512i qe = _mm512_srli_epi64(_mm512_mul_epu32(n, magic), 36);
+    __m512i qo = _mm512_srli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(n, 32), magic), 36);
+    __m512i q = _mm512_mask_blend_epi32(0xAAAA, qe, _mm512_slli_epi64(qo, 32));
+    return _mm512_sub_epi32(n, _mm512_mullo_epi32(q, _mm512_set1_epi32(29)));
+}
+
+/* A hills cell keeps its biome without touching the RNG unless it has a hill
+ * variant in hillsTable or sits on a river mutation ((b11-2) % 29 == 1). Only
+ * those lanes are evaluated by the scalar cell function.
+ */
+TARGET_AVX2 static int mapHillsRowAVX2(Layer *l, int * __restrict out, const int *buf, int areaX, int areaZ,
+        int areaWidth, int pWidth, int z, int is113)
+{
+    int x, k;
+
+    for (x = 0; x + 8 <= areaWidth; x += 8)
+    {
+        __m256i a11 = _mm256_loadu_si256((const __m256i*)(buf + x+1 + (z+1)*pWidth));
+        __m256i b11 = _mm256_loadu_si256((const __m256i*)(out + x+1 + (z+1)*pWidth));
+
+        __m256i outside = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(256), a11),
+                _mm256_set1_epi32(-1));
+        outside = _mm256_or_si256(outside, _mm256_cmpgt_epi32(_mm256_setzero_si256(), a11));
+        __m256i hill = _mm256_i32gather_epi32(hillsTable, _mm256_and_si256(a11, _mm256_set1_epi32(0xff)), 4);
+        __m256i change = _mm256_or_si256(outside,
+                _mm256_andnot_si256(_mm256_cmpeq_epi32(hill, _mm256_setzero_si256()), _mm256_set1_epi32(-1)));
+        __m256i mutate = _mm256_and_si256(_mm256_cmpgt_epi32(b11, _mm256_set1_epi32(1)),
+                _mm256_cmpeq_epi32(riverMod8(b11), _mm256_set1_epi32(1)));
+        int slow = lanes8(_mm256_or_si256(change, mutate));
+
+        _mm256_storeu_si256((__m256i*)(out + x + z*areaWidth), a11);
+
+        if (slow)
+        {
+            int a[8], b[8];
+            _mm256_storeu_si256((__m256i*)a, a11);
+            _mm256_storeu_si256((__m256i*)b, b11);
+
+            for (; slow; slow &= slow - 1)
+            {
+                k = __builtin_ctz(slow);
+                out[x + k + z*areaWidth] = is113 ?
+                        hills113Cell(l, buf, pWidth, x + k, z, areaX, areaZ, a[k], b[k]) :
+                        hillsCell(l, buf, pWidth, x + k, z, areaX, areaZ, a[k], b[k]);
+            }
+        }
+    }
+
+    return x;
+}
+
+TARGET_AVX512 static int mapHillsRowAVX512(Layer *l, int * __restrict out, const int *buf, int areaX, int areaZ,
+        int areaWidth, int pWidth, int z, int is113)
+{
+    int x, k;
+
+    for (x = 0; x < areaWidth; x += 16)
+    {
+        const __mmask16 m = tailMask16(areaWidth - x);
+        __m512i a11 = _mm512_maskz_loadu_epi32(m, buf + x+1 + (z+1)*pWidth);
+        __m512i b11 = _mm512_maskz_loadu_epi32(m, out + x+1 + (z+1)*pWidth);
+
+        __mmask16 outside = _mm512_cmpge_epu32_mask(a11, _mm512_set1_epi32(256));
+        __m512i hill = _mm512_i32gather_epi32(_mm512_and_si512(a11, _mm512_set1_epi32(0xff)), hillsTable, 4);
+        __mmask16 change = outside | _mm512_test_epi32_mask(hill, hill);
+        __mmask16 mutate = _mm512_cmpgt_epi32_mask(b11, _mm512_set1_epi32(1)) &
+                _mm512_cmpeq_epi32_mask(riverMod16(b11), _mm512_set1_epi32(1));
+        unsigned slow = (change | mutate) & m;
+
+        _mm512_mask_storeu_epi32(out + x + z*areaWidth, m, a11);
+
+        if (slow)
+        {
+            int a[16], b[16];
+            _mm512_storeu_si512(a, a11);
+            _mm512_storeu_si512(b, b11);
+
+            for (; slow; slow &= slow - 1)
+            {
+                k = __builtin_ctz(slow);
+                out[x + k + z*areaWidth] = is113 ?
+                        hills113Cell(l, buf, pWidth, x + k, z, areaX, areaZ, a[k], b[k]) :
+                        hillsCell(l, buf, pWidth, x + k, z, areaX, areaZ, a[k], b[k]);
+            }
+        }
+    }
+
+    return areaWidth;
+}
+
+#endif
+
+LAYER_TEMPLATE(mapHills)
+{
+    int pX = areaX - 1;
+    int pZ = areaZ - 1;
+    int pWidth = areaWidth + 2;
+    int pHeight = areaHeight + 2;
+    int x, z;
+    int *buf = NULL;
+
+    if (l->p2 == NULL)
+    {
+        printf("mapHills() requires two parents! Use setupMultiLayer()\n");
+        exit(1);
+    }
+
+    buf = (int *) malloc(pWidth*pHeight*sizeof(int));
+
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
+    memcpy(buf, out, pWidth*pHeight*sizeof(int));
+
+    parent2(l->p2, out, pX, pZ, pWidth, pHeight);
+
+    for (z = 0; z < areaHeight; z++)
+    {
+        x = 0;
+        if (kernels.hills)
+            x = kernels.hills(l, out, buf, areaX, areaZ, areaWidth, pWidth, z, 0);
+        for (; x < areaWidth; x++)
+        {
+            int a11 = buf[x+1 + (z+1)*pWidth]; // biome branch
+            int b11 = out[x+1 + (z+1)*pWidth]; // river branch
+
+            out[x + z*areaWidth] = hillsCell(l, buf, pWidth, x, z, areaX, areaZ, a11, b11);
+        }
+    }
+
+    free(buf);
+}
+
+GENERIC_LAYER(mapHills)
+
+
+LAYER_TEMPLATE(mapHills113)
+{
+    int pX = areaX - 1;
+    int pZ = areaZ - 1;
+    int pWidth = areaWidth + 2;
+    int pHeight = areaHeight + 2;
+    int x, z;
+    int *buf = NULL;
+
+    if (l->p2 == NULL)
+    {
+        printf("mapHills() requires two parents! Use setupMultiLayer()\n");
+        exit(1);
+    }
+
+    buf = (int *) malloc(pWidth*pHeight*sizeof(int));
+
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
+    memcpy(buf, out, pWidth*pHeight*sizeof(int));
+
+    parent2(l->p2, out, pX, pZ, pWidth, pHeight);
+
+    for (z = 0; z < areaHeight; z++)
+    {
+        x = 0;
+        if (kernels.hills)
+            x = kernels.hills(l, out, buf, areaX, areaZ, areaWidth, pWidth, z, 1);
+        for (; x < areaWidth; x++)
+        {
+            int a11 = buf[x+1 + (z+1)*pWidth]; // biome branch
+            int b11 = out[x+1 + (z+1)*pWidth]; // river branch
+
+            out[x + z*areaWidth] = hills113Cell(l, buf, pWidth, x, z, areaX, areaZ, a11, b11);
+        }
+    }
+
+    free(buf);
+}
+
+GENERIC_LAYER(mapHills113)
+
+
+
+static inline int reduceID(int id)
+{
+    return id >= 2 ? 2 + (id & 1) : id;
+}
+
+#ifdef SIMD_X86
+
+TARGET_SSE42 static inline __m128i reduce4ID(__m128i v)
+{
+    __m128i odd = _mm_add_epi32(_mm_set1_epi32(2), _mm_and_si128(v, _mm_set1_epi32(1)));
+    return _mm_blendv_epi8(v, odd, _mm_cmpgt_epi32(v, _mm_set1_epi32(1)));
+}
+
+TARGET_AVX2 static inline __m256i reduce8ID(__m256i v)
+{
+    __m256i odd = _mm256_add_epi32(_mm256_set1_epi32(2), _mm256_and_si256(v, _mm256_set1_epi32(1)));
+    return _mm256_blendv_epi8(v, odd, _mm256_cmpgt_epi32(v, _mm256_set1_epi32(1)));
+}
+
+TARGET_AVX512 static inline __m512i reduce16ID(__m512i v)
+{
+    __m512i odd = _mm512_add_epi32(_mm512_set1_epi32(2), _mm512_and_si512(v, _mm512_set1_epi32(1)));
+    return _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(v, _mm512_set1_epi32(1)), v, odd);
+}
+
+TARGET_SSE42 static int mapRiverRowSSE42(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x;
+
+    for (x = 0; x + 4 <= areaWidth; x += 4)
+    {
+        const int *p = out + x + z*pWidth;
+        __m128i v10 = reduce4ID(_mm_loadu_si128((const __m128i*)(p + 1)));
+        __m128i v01 = reduce4ID(_mm_loadu_si128((const __m128i*)(p + pWidth)));
+        __m128i v11 = reduce4ID(_mm_loadu_si128((const __m128i*)(p + pWidth + 1)));
+        __m128i v21 = reduce4ID(_mm_loadu_si128((const __m128i*)(p + pWidth + 2)));
+        __m128i v12 = reduce4ID(_mm_loadu_si128((const __m128i*)(p + 2*pWidth + 1)));
+
+        __m128i same = same4Cross(v11, v10, v21, v01, v12);
+
+        _mm_storeu_si128((__m128i*)(out + x + z*areaWidth),
+                _mm_blendv_epi8(_mm_set1_epi32(river), _mm_set1_epi32(-1), same));
+    }
+
+    return x;
+}
+
+TARGET_AVX2 static int mapRiverRowAVX2(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x;
+
+    for (x = 0; x + 8 <= areaWidth; x += 8)
+    {
+        const int *p = out + x + z*pWidth;
+        __m256i v10 = reduce8ID(_mm256_loadu_si256((const __m256i*)(p + 1)));
+        __m256i v01 = reduce8ID(_mm256_loadu_si256((const __m256i*)(p + pWidth)));
+        __m256i v11 = reduce8ID(_mm256_loadu_si256((const __m256i*)(p + pWidth + 1)));
+        __m256i v21 = reduce8ID(_mm256_loadu_si256((const __m256i*)(p + pWidth + 2)));
+        __m256i v12 = reduce8ID(_mm256_loadu_si256((const __m256i*)(p + 2*pWidth + 1)));
+
+        __m256i same = same8Cross(v11, v10, v21, v01, v12);
+
+        _mm256_storeu_si256((__m256i*)(out + x + z*areaWidth),
+                _mm256_blendv_epi8(_mm256_set1_epi32(river), _mm256_set1_epi32(-1), same));
+    }
+
+    return x;
+}
+
+TARGET_AVX512 static int mapRiverRowAVX512(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x;
+
+    for (x = 0; x < areaWidth; x += 16)
+    {
+        const __mmask16 m = tailMask16(areaWidth - x);
+        const int *p = out + x + z*pWidth;
+        __m512i v10 = reduce16ID(_mm512_maskz_loadu_epi32(m, p + 1));
+        __m512i v01 = reduce16ID(_mm512_maskz_loadu_epi32(m, p + pWidth));
+        __m512i v11 = reduce16ID(_mm512_maskz_loadu_epi32(m, p + pWidth + 1));
+        __m512i v21 = reduce16ID(_mm512_maskz_loadu_epi32(m, p + pWidth + 2));
+        __m512i v12 = reduce16ID(_mm512_maskz_loadu_epi32(m, p + 2*pWidth + 1));
+
+        __mmask16 same = same16Cross(v11, v10, v21, v01, v12);
+
+        _mm512_mask_storeu_epi32(out + x + z*areaWidth, m,
+                _mm512_mask_blend_epi32(same, _mm512_set1_epi32(river), _mm512_set1_epi32(-1)));
+    }
+
+    return areaWidth;
+}
+
+#endif
+
+LAYER_TEMPLATE(mapRiver)
+{
+    int pX = areaX - 1;
+    int pZ = areaZ - 1;
+    int pWidth = areaWidth + 2;
+    int pHeight = areaHeight + 2;
+    int x, z;
+
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
+
+    for (z = 0; z < areaHeight; z++)
+    {
+        x = 0;
+        if (kernels.river)
+            x = kernels.river(out, areaWidth, pWidth, z);
+        for (; x < areaWidth; x++)
+        {
+            int v01 = reduceID(out[x+0 + (z+1)*pWidth]);
+            int v21 = reduceID(out[x+2 + (z+1)*pWidth]);
+            int v10 = reduceID(out[x+1 + (z+0)*pWidth]);
+            int v12 = reduceID(out[x+1 + (z+2)*pWidth]);
+            int v11 = reduceID(out[x+1 + (z+1)*pWidth]);
+
+            if (v11 == v01 && v11 == v10 && v11 == v21 && v11 == v12)
+            {
+                out[x + z * areaWidth] = -1;
+            }
+            else
+            {
+                out[x + z * areaWidth] = river;
+            }
+        }
+    }
+}
+
+GENERIC_LAYER(mapRiver)
+
+
+#ifdef SIMD_X86
+
+/* Smooths a run of cells of row 'z'. Returns the number of cells processed,
+ * the remainder of the row is left to the scalar loop. Only bit 24 of the
+ * chunk seed is needed, so 32-bit seeds suffice.
+ */
+TARGET_SSE42 static int mapSmoothRowSSE42(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int pWidth, int z)
+{
+    const int ws = (int)l->worldSeed;
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i zs = _mm_set1_epi32(areaZ + z);
+    int x;
+
+    for (x = 0; x + 4 <= areaWidth; x += 4)
+    {
+        const int *p = out + x + z*pWidth;
+        __m128i v10 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i v01 = _mm_loadu_si128((const __m128i*)(p + pWidth));
+        __m128i v11 = _mm_loadu_si128((const __m128i*)(p + pWidth + 1));
+        __m128i v21 = _mm_loadu_si128((const __m128i*)(p + pWidth + 2));
+        __m128i v12 = _mm_loadu_si128((const __m128i*)(p + 2*pWidth + 1));
+
+        __m128i eqX = _mm_cmpeq_epi32(v01, v21);
+        __m128i eqZ = _mm_cmpeq_epi32(v10, v12);
+        __m128i both = _mm_and_si128(eqX, eqZ);
+        __m128i ret = _mm_blendv_epi8(v11, v01, eqX);
+        ret = _mm_blendv_epi8(ret, v10, eqZ);
+
+        if (!_mm_testz_si128(both, both))
+        {
+            __m128i xs = _mm_add_epi32(_mm_set1_epi32(areaX + x), lane);
+            __m128i cs = set4ChunkSeeds(ws, xs, zs);
+            __m128i r0 = _mm_cmpeq_epi32(_mm_setzero_si128(),
+                    _mm_and_si128(_mm_srli_epi32(cs, 24), _mm_set1_epi32(1)));
+            ret = _mm_blendv_epi8(ret, _mm_blendv_epi8(v10, v01, r0), both);
+        }
+
+        _mm_storeu_si128((__m128i*)(out + x + z*areaWidth), ret);
+    }
+
+    return x;
+}
+
+TARGET_AVX2 static int mapSmoothRowAVX2(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int pWidth, int z)
+{
+    const int ws = (int)l->worldSeed;
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i zs = _mm256_set1_epi32(areaZ + z);
+    int x;
+
+    for (x = 0; x + 8 <= areaWidth; x += 8)
+    {
+        const int *p = out + x + z*pWidth;
+        __m256i v10 = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i v01 = _mm256_loadu_si256((const __m256i*)(p + pWidth));
+        __m256i v11 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 1));
+        __m256i v21 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 2));
+        __m256i v12 = _mm256_loadu_si256((const __m256i*)(p + 2*pWidth + 1));
+
+        __m256i eqX = _mm256_cmpeq_epi32(v01, v21);
+        __m256i eqZ = _mm256_cmpeq_epi32(v10, v12);
+        __m256i both = _mm256_and_si256(eqX, eqZ);
+        __m256i ret = _mm256_blendv_epi8(v11, v01, eqX);
+        ret = _mm256_blendv_epi8(ret, v10, eqZ);
+
+        if (!_mm256_testz_si256(both, both))
+        {
+            __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(areaX + x), lane);
+            __m256i cs = set8ChunkSeeds(ws, xs, zs);
+            __m256i r0 = _mm256_cmpeq_epi32(_mm256_setzero_si256(),
+                    _mm256_and_si256(_mm256_srli_epi32(cs, 24), _mm256_set1_epi32(1)));
+            ret = _mm256_blendv_epi8(ret, _mm256_blendv_epi8(v10, v01, r0), both);
+        }
+
+        _mm256_storeu_si256((__m256i*)(out + x + z*areaWidth), ret);
+    }
+
+    return x;
+}
+
+TARGET_AVX512 static int mapSmoothRowAVX512(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int pWidth, int z)
+{
+    const int ws = (int)l->worldSeed;
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i zs = _mm512_set1_epi32(areaZ + z);
+    int x;
+
+    for (x = 0; x < areaWidth; x += 16)
+    {
+        const __mmask16 m = tailMask16(areaWidth - x);
+        const int *p = out + x + z*pWidth;
+        __m512i v10 = _mm512_maskz_loadu_epi32(m, p + 1);
+        __m512i v01 = _mm512_maskz_loadu_epi32(m, p + pWidth);
+        __m512i v11 = _mm512_maskz_loadu_epi32(m, p + pWidth + 1);
+        __m512i v21 = _mm512_maskz_loadu_epi32(m, p + pWidth + 2);
+        __m512i v12 = _mm512_maskz_loadu_epi32(m, p + 2*pWidth + 1);
+
+        __mmask16 eqX = _mm512_cmpeq_epi32_mask(v01, v21);
+        __mmask16 eqZ = _mm512_cmpeq_epi32_mask(v10, v12);
+        __mmask16 both = eqX & eqZ & m;
+        __m512i ret = _mm512_mask_blend_epi32(eqX, v11, v01);
+        ret = _mm512_mask_blend_epi32(eqZ, ret, v10);
+
+        if (both)
+        {
+            __m512i xs = _mm512_add_epi32(_mm512_set1_epi32(areaX + x), lane);
+            __m512i cs = set16ChunkSeeds(ws, xs, zs);
+            __mmask16 r1 = _mm512_test_epi32_mask(cs, _mm512_set1_epi32(1 << 24));
+            ret = _mm512_mask_blend_epi32(both, ret, _mm512_mask_blend_epi32(r1, v01, v10));
+        }
+
+        _mm512_mask_storeu_epi32(out + x + z*areaWidth, m, ret);
+    }
+
+    return areaWidth;
+}
+
+#endif
+
+LAYER_TEMPLATE(mapSmooth)
+{
+    int pX = areaX - 1;
+    int pZ = areaZ - 1;
+    int pWidth = areaWidth + 2;
+    int pHeight = areaHeight + 2;
+    int x, z;
+
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
+
+    for (z = 0; z < areaHeight; z++)
+    {
+        x = 0;
+        if (kernels.smooth)
+            x = kernels.smooth(l, out, areaX, areaZ, areaWidth, pWidth, z);
+        for (; x < areaWidth; x++)
+        {
+            int v11 = out[x+1 + (z+1)*pWidth];
+            int v10 = out[x+1 + (z+0)*pWidth];
+            int v21 = out[x+2 + (z+1)*pWidth];
+            int v01 = out[x+0 + (z+1)*pWidth];
+            int v12 = out[x+1 + (z+2)*pWidth];
+
+            if (v01 == v21 && v10 == v12)
+            {
+                setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
+
+                if (mcNextInt2(l) == 0)
+                    v11 = v01;
+                else
+                    v11 = v10;
             }
             else
             {
@@ -1246,8 +1939,10 @@ void mapSmooth(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWid
     }
 }
 
+GENERIC_LAYER(mapSmooth)
 
-void mapRareBiome(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+
+LAYER_TEMPLATE(mapRareBiome)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -1255,28 +1950,29 @@ void mapRareBiome(Layer *l, int * __restrict out, int areaX, int areaZ, int area
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
         for (x = 0; x < areaWidth; x++)
         {
-            setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
             int v11 = out[x+1 + (z+1)*pWidth];
 
-            if (mcNextInt(l, 57) == 0 && v11 == plains)
-            {
-                // Sunflower Plains
-                out[x + z*areaWidth] = plains + 128;
-            }
-            else
+            // the chunk seed is reset for every cell, so only plains need it
+            if (v11 == plains)
             {
-                out[x + z*areaWidth] = v11;
+                setChunkSeed(l, (int64_t)(x + areaX), (int64_t)(z + areaZ));
+                if (mcNextInt57(l) == 0)
+                    v11 = plains + 128; // Sunflower Plains
             }
+
+            out[x + z*areaWidth] = v11;
         }
     }
 }
 
+GENERIC_LAYER(mapRareBiome)
+
 
 inline static int replaceOcean(int *out, int idx, int v10, int v21, int v01, int v12, int id, int replaceID)
 {
@@ -1290,12 +1986,210 @@ inline static int replaceOcean(int *out, int idx, int v10, int v21, int v01, int
     return 1;
 }
 
-inline static int isBiomeJFTO(int id)
+static inline void shoreCell(int *out, int idx, int v11, int v10, int v21, int v01, int v12)
+{
+    int biome = biomeExists(v11) ? v11 : 0;
+
+    if (v11 == mushroomIsland)
+    {
+        if (v10 != ocean && v21 != ocean && v01 != ocean && v12 != ocean)
+            out[idx] = v11;
+        else
+            out[idx] = mushroomIslandShore;
+    }
+    else if (/*biome < 128 &&*/ biomeFlags[biome & 0xff] & BIOME_JUNGLE)
+    {
+        if (biomeFlags[v10 & 0xff] & biomeFlags[v21 & 0xff] & biomeFlags[v01 & 0xff] & biomeFlags[v12 & 0xff] & BIOME_SHORE_JFTO)
+        {
+            if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
+                out[idx] = v11;
+            else
+                out[idx] = beach;
+        }
+        else
+        {
+            out[idx] = jungleEdge;
+        }
+    }
+    else if (v11 != extremeHills && v11 != extremeHillsPlus && v11 != extremeHillsEdge)
+    {
+        if (isBiomeSnowy(biome))
+        {
+            replaceOcean(out, idx, v10, v21, v01, v12, v11, coldBeach);
+        }
+        else if (v11 != mesa && v11 != mesaPlateau_F)
+        {
+            if (v11 != ocean && v11 != deepOcean && v11 != river && v11 != swampland)
+            {
+                if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
+                    out[idx] = v11;
+                else
+                    out[idx] = beach;
+            }
+            else
+            {
+                out[idx] = v11;
+            }
+        }
+        else
+        {
+            if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
+            {
+                if (biomeFlags[v10 & 0xff] & biomeFlags[v21 & 0xff] & biomeFlags[v01 & 0xff] & biomeFlags[v12 & 0xff] & BIOME_MESA)
+                    out[idx] = v11;
+                else
+                    out[idx] = desert;
+            }
+            else
+            {
+                out[idx] = v11;
+            }
+        }
+    }
+    else
+    {
+        replaceOcean(out, idx, v10, v21, v01, v12, v11, stoneBeach);
+    }
+}
+
+#ifdef SIMD_X86
+
+/* When all four neighbours match the centre, every branch of shoreCell() keeps
+ * the centre biome. The exception are the oceans that count as snowy (all but
+ * ocean and deepOcean), which replaceOcean() leaves untouched, so those go
+ * through the scalar path together with the shore candidates.
+ */
+TARGET_SSE42 static int mapShoreRowSSE42(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x, k;
+
+    for (x = 0; x + 4 <= areaWidth; x += 4)
+    {
+        const int *p = out + x + z*pWidth;
+        __m128i v10 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i v01 = _mm_loadu_si128((const __m128i*)(p + pWidth));
+        __m128i v11 = _mm_loadu_si128((const __m128i*)(p + pWidth + 1));
+        __m128i v21 = _mm_loadu_si128((const __m128i*)(p + pWidth + 2));
+        __m128i v12 = _mm_loadu_si128((const __m128i*)(p + 2*pWidth + 1));
+        __m128i old = _mm_loadu_si128((const __m128i*)(out + x + z*areaWidth));
+
+        __m128i snowyOcean = _mm_or_si128(
+                _mm_cmpeq_epi32(v11, _mm_set1_epi32(frozenOcean)),
+                _mm_and_si128(_mm_cmpgt_epi32(v11, _mm_set1_epi32(warmOcean-1)),
+                              _mm_cmpgt_epi32(_mm_set1_epi32(frozenDeepOcean+1), v11)));
+        __m128i keep = _mm_andnot_si128(snowyOcean, same4Cross(v11, v10, v21, v01, v12));
+        int slow = ~lanes4(keep) & 0xf;
+
+        _mm_storeu_si128((__m128i*)(out + x + z*areaWidth), _mm_blendv_epi8(old, v11, keep));
+
+        if (slow)
+        {
+            int a11[4], a10[4], a21[4], a01[4], a12[4];
+            _mm_storeu_si128((__m128i*)a11, v11);
+            _mm_storeu_si128((__m128i*)a10, v10);
+            _mm_storeu_si128((__m128i*)a21, v21);
+            _mm_storeu_si128((__m128i*)a01, v01);
+            _mm_storeu_si128((__m128i*)a12, v12);
+
+            for (; slow; slow &= slow - 1)
+            {
+                k = __builtin_ctz(slow);
+                shoreCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
+            }
+        }
+    }
+
+    return x;
+}
+
+TARGET_AVX2 static int mapShoreRowAVX2(int * __restrict out, int areaWidth, int pWidth, int z)
+{
+    int x, k;
+
+    for (x = 0; x + 8 <= areaWidth; x += 8)
+    {
+        const int *p = out + x + z*pWidth;
+        __m256i v10 = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i v01 = _mm256_loadu_si256((const __m256i*)(p + pWidth));
+        __m256i v11 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 1));
+        __m256i v21 = _mm256_loadu_si256((const __m256i*)(p + pWidth + 2));
+        __m256i v12 = _mm256_loadu_si256((const __m256i*)(p + 2*pWidth + 1));
+        __m256i old = _mm256_loadu_si256((const __m256i*)(out + x + z*areaWidth));
+
+        __m256i snowyOcean = _mm256_or_si256(
+                _mm256_cmpeq_epi32(v11, _mm256_set1_epi32(frozenOcean)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(v11, _mm256_set1_epi32(warmOcean-1)),
+                                 _mm256_cmpgt_epi32(_mm256_set1_epi32(frozenDeepOcean+1), v11)));
+        __m256i keep = _mm256_andnot_si256(snowyOcean, same8Cross(v11, v10, v21, v01, v12));
+        int slow = ~lanes8(keep) & 0xff;
+
+        _mm256_storeu_si256((__m256i*)(out + x + z*areaWidth), _mm256_blendv_epi8(old, v11, keep));
+
+        if (slow)
+        {
+            int a11[8], a10[8], a21[8], a01[8], a12[8];
+            _mm256_storeu_si256((__m256i*)a11, v11);
+            _mm256_storeu_si256((__m256i*)a10, v10);
+            _mm256_storeu_si256((__m256i*)a21, v21);
+            _mm256_storeu_si256((__m256i*)a01, v01);
+            _mm256_storeu_si256((__m256i*)a12, v12);
+
+            for (; slow; slow &= slow - 1)
+            {
+                k = __builtin_ctz(slow);
+                shoreCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
+            }
+        }
+    }
+
+    return x;
+}
+
+TARGET_AVX512 static int mapShoreRowAVX512(int * __restrict out, int areaWidth, int pWidth, int z)
 {
-    return biomeExists(id) && (getBiomeType(id) == Jungle || id == forest || id == taiga || isOceanic(id));
+    int x, k;
+
+    for (x = 0; x < areaWidth; x += 16)
+    {
+        const __mmask16 m = tailMask16(areaWidth - x);
+        const int *p = out + x + z*pWidth;
+        __m512i v10 = _mm512_maskz_loadu_epi32(m, p + 1);
+        __m512i v01 = _mm512_maskz_loadu_epi32(m, p + pWidth);
+        __m512i v11 = _mm512_maskz_loadu_epi32(m, p + pWidth + 1);
+        __m512i v21 = _mm512_maskz_loadu_epi32(m, p + pWidth + 2);
+        __m512i v12 = _mm512_maskz_loadu_epi32(m, p + 2*pWidth + 1);
+
+        __mmask16 snowyOcean = _mm512_cmpeq_epi32_mask(v11, _mm512_set1_epi32(frozenOcean)) |
+                (_mm512_cmpge_epi32_mask(v11, _mm512_set1_epi32(warmOcean)) &
+                 _mm512_cmple_epi32_mask(v11, _mm512_set1_epi32(frozenDeepOcean)));
+        __mmask16 keep = same16Cross(v11, v10, v21, v01, v12) & ~snowyOcean & m;
+        unsigned slow = ~keep & m;
+
+        _mm512_mask_storeu_epi32(out + x + z*areaWidth, keep, v11);
+
+        if (slow)
+        {
+            int a11[16], a10[16], a21[16], a01[16], a12[16];
+            _mm512_storeu_si512(a11, v11);
+            _mm512_storeu_si512(a10, v10);
+            _mm512_storeu_si512(a21, v21);
+            _mm512_storeu_si512(a01, v01);
+            _mm512_storeu_si512(a12, v12);
+
+            for (; slow; slow &= slow - 1)
+            {
+                k = __builtin_ctz(slow);
+                shoreCell(out, x + k + z*areaWidth, a11[k], a10[k], a21[k], a01[k], a12[k]);
+            }
+        }
+    }
+
+    return areaWidth;
 }
 
-void mapShore(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+#endif
+
+LAYER_TEMPLATE(mapShore)
 {
     int pX = areaX - 1;
     int pZ = areaZ - 1;
@@ -1303,11 +2197,14 @@ void mapShore(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidt
     int pHeight = areaHeight + 2;
     int x, z;
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
     for (z = 0; z < areaHeight; z++)
     {
-        for (x = 0; x < areaWidth; x++)
+        x = 0;
+        if (kernels.shore)
+            x = kernels.shore(out, areaWidth, pWidth, z);
+        for (; x < areaWidth; x++)
         {
             int v11 = out[x+1 + (z+1)*pWidth];
             int v10 = out[x+1 + (z+0)*pWidth];
@@ -1315,74 +2212,15 @@ void mapShore(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidt
             int v01 = out[x+0 + (z+1)*pWidth];
             int v12 = out[x+1 + (z+2)*pWidth];
 
-            int biome = biomeExists(v11) ? v11 : 0;
-
-            if (v11 == mushroomIsland)
-            {
-                if (v10 != ocean && v21 != ocean && v01 != ocean && v12 != ocean)
-                    out[x + z*areaWidth] = v11;
-                else
-                    out[x + z*areaWidth] = mushroomIslandShore;
-            }
-            else if (/*biome < 128 &&*/ getBiomeType(biome) == Jungle)
-            {
-                if (isBiomeJFTO(v10) && isBiomeJFTO(v21) && isBiomeJFTO(v01) && isBiomeJFTO(v12))
-                {
-                    if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
-                        out[x + z*areaWidth] = v11;
-                    else
-                        out[x + z*areaWidth] = beach;
-                }
-                else
-                {
-                    out[x + z*areaWidth] = jungleEdge;
-                }
-            }
-            else if (v11 != extremeHills && v11 != extremeHillsPlus && v11 != extremeHillsEdge)
-            {
-                if (isBiomeSnowy(biome))
-                {
-                    replaceOcean(out, x + z*areaWidth, v10, v21, v01, v12, v11, coldBeach);
-                }
-                else if (v11 != mesa && v11 != mesaPlateau_F)
-                {
-                    if (v11 != ocean && v11 != deepOcean && v11 != river && v11 != swampland)
-                    {
-                        if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
-                            out[x + z*areaWidth] = v11;
-                        else
-                            out[x + z*areaWidth] = beach;
-                    }
-                    else
-                    {
-                        out[x + z*areaWidth] = v11;
-                    }
-                }
-                else
-                {
-                    if (!isOceanic(v10) && !isOceanic(v21) && !isOceanic(v01) && !isOceanic(v12))
-                    {
-                        if (getBiomeType(v10) == Mesa && getBiomeType(v21) == Mesa && getBiomeType(v01) == Mesa && getBiomeType(v12) == Mesa)
-                            out[x + z*areaWidth] = v11;
-                        else
-                            out[x + z*areaWidth] = desert;
-                    }
-                    else
-                    {
-                        out[x + z*areaWidth] = v11;
-                    }
-                }
-            }
-            else
-            {
-                replaceOcean(out, x + z*areaWidth, v10, v21, v01, v12, v11, stoneBeach);
-            }
+            shoreCell(out, x + z*areaWidth, v11, v10, v21, v01, v12);
         }
     }
 }
 
+GENERIC_LAYER(mapShore)
+
 
-void mapRiverMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapRiverMix)
 {
     int idx;
     int len;
@@ -1397,10 +2235,10 @@ void mapRiverMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
     len = areaWidth*areaHeight;
     buf = (int *) malloc(len*sizeof(int));
 
-    l->p->getMap(l->p, out, areaX, areaZ, areaWidth, areaHeight); // biome chain
+    parent(l->p, out, areaX, areaZ, areaWidth, areaHeight); // biome chain
     memcpy(buf, out, len*sizeof(int));
 
-    l->p2->getMap(l->p2, out, areaX, areaZ, areaWidth, areaHeight); // rivers
+    parent2(l->p2, out, areaX, areaZ, areaWidth, areaHeight); // rivers
 
     for (idx = 0; idx < len; idx++)
     {
@@ -1429,6 +2267,8 @@ void mapRiverMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
     free(buf);
 }
 
+GENERIC_LAYER(mapRiverMix)
+
 
 
 /* Initialises data for the ocean temperature types using the world seed.
@@ -1546,7 +2386,7 @@ void mapOceanTemp(Layer *l, int * __restrict out, int areaX, int areaZ, int area
 }
 
 /* Warning: this function is horribly slow compared to other layers! */
-void mapOceanMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapOceanMix)
 {
     int landX = areaX-8, landZ = areaZ-8;
     int landWidth = areaWidth+17, landHeight = areaHeight+17;
@@ -1558,11 +2398,11 @@ void mapOceanMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
         exit(1);
     }
 
-    l->p->getMap(l->p, out, landX, landZ, landWidth, landHeight);
+    parent(l->p, out, landX, landZ, landWidth, landHeight);
     map1 = (int *) malloc(landWidth*landHeight*sizeof(int));
     memcpy(map1, out, landWidth*landHeight*sizeof(int));
 
-    l->p2->getMap(l->p2, out, areaX, areaZ, areaWidth, areaHeight);
+    parent2(l->p2, out, areaX, areaZ, areaWidth, areaHeight);
     map2 = (int *) malloc(areaWidth*areaHeight*sizeof(int));
     memcpy(map2, out, areaWidth*areaHeight*sizeof(int));
 
@@ -1638,9 +2478,275 @@ void mapOceanMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
     free(map2);
 }
 
+GENERIC_LAYER(mapOceanMix)
+
+
+
+/* Fills the 4x4 blocks of one row of parent cells. p0 and p1 are the parent
+ * rows above and below, j0 and j1 hold the (x, z) jitter of every corner along
+ * them. Note that only the cells after the first one mask their biome id.
+ */
+static void voronoiRow(int *buf, int newWidth, const int *p0, const int *p1,
+        const double *j0, const double *j1, int n)
+{
+    int x, i, j;
+    int v00 = p0[0];
+    int v01 = p1[0];
+
+    for (x = 0; x < n; x++)
+    {
+        double da1 = j0[2*x+0];
+        double da2 = j0[2*x+1];
+        double db1 = j0[2*x+2] + 4.0;
+        double db2 = j0[2*x+3];
+        double dc1 = j1[2*x+0];
+        double dc2 = j1[2*x+1] + 4.0;
+        double dd1 = j1[2*x+2] + 4.0;
+        double dd2 = j1[2*x+3] + 4.0;
+
+        int v10 = p0[x+1] & 255;
+        int v11 = p1[x+1] & 255;
+
+        for (j = 0; j < 4; j++)
+        {
+            int idx = j * newWidth + (x << 2);
+
+            for (i = 0; i < 4; i++)
+            {
+                double da = (j-da2)*(j-da2) + (i-da1)*(i-da1);
+                double db = (j-db2)*(j-db2) + (i-db1)*(i-db1);
+                double dc = (j-dc2)*(j-dc2) + (i-dc1)*(i-dc1);
+                double dd = (j-dd2)*(j-dd2) + (i-dd1)*(i-dd1);
+
+                if (da < db && da < dc && da < dd)
+                {
+                    buf[idx++] = v00;
+                }
+                else if (db < da && db < dc && db < dd)
+                {
+                    buf[idx++] = v10;
+                }
+                else if (dc < da && dc < db && dc < dd)
+                {
+                    buf[idx++] = v01;
+                }
+                else
+                {
+                    buf[idx++] = v11;
+                }
+            }
+        }
+
+        v00 = v10;
+        v01 = v11;
+    }
+}
+
+#ifdef SIMD_X86
+
+/* The vectorised rows evaluate the distances along i with the same operations
+ * as voronoiRow(), so the results are bit-identical as long as the compiler
+ * does not contract them into fused multiply-adds.
+ */
+TARGET_SSE42 static void voronoiRowSSE42(int *buf, int newWidth, const int *p0, const int *p1,
+        const double *j0, const double *j1, int n)
+{
+    const __m128d i0 = _mm_setr_pd(0, 1), i2 = _mm_setr_pd(2, 3);
+    int x, j, h;
+    int v00 = p0[0];
+    int v01 = p1[0];
+
+    for (x = 0; x < n; x++)
+    {
+        __m128d da1 = _mm_set1_pd(j0[2*x+0]);
+        __m128d db1 = _mm_set1_pd(j0[2*x+2] + 4.0);
+        __m128d dc1 = _mm_set1_pd(j1[2*x+0]);
+        __m128d dd1 = _mm_set1_pd(j1[2*x+2] + 4.0);
+        double da2 = j0[2*x+1];
+        double db2 = j0[2*x+3];
+        double dc2 = j1[2*x+1] + 4.0;
+        double dd2 = j1[2*x+3] + 4.0;
+
+        int v10 = p0[x+1] & 255;
+        int v11 = p1[x+1] & 255;
+        __m128i c00 = _mm_set1_epi64x(v00), c10 = _mm_set1_epi64x(v10);
+        __m128i c01 = _mm_set1_epi64x(v01), c11 = _mm_set1_epi64x(v11);
+
+        for (j = 0; j < 4; j++)
+        {
+            __m128d ja = _mm_set1_pd((j-da2)*(j-da2));
+            __m128d jb = _mm_set1_pd((j-db2)*(j-db2));
+            __m128d jc = _mm_set1_pd((j-dc2)*(j-dc2));
+            __m128d jd = _mm_set1_pd((j-dd2)*(j-dd2));
+
+            for (h = 0; h < 2; h++)
+            {
+                __m128d vi = h ? i2 : i0, t;
+                t = _mm_sub_pd(vi, da1); __m128d da = _mm_add_pd(ja, _mm_mul_pd(t, t));
+                t = _mm_sub_pd(vi, db1); __m128d db = _mm_add_pd(jb, _mm_mul_pd(t, t));
+                t = _mm_sub_pd(vi, dc1); __m128d dc = _mm_add_pd(jc, _mm_mul_pd(t, t));
+                t = _mm_sub_pd(vi, dd1); __m128d dd = _mm_add_pd(jd, _mm_mul_pd(t, t));
+
+                __m128d ma = _mm_and_pd(_mm_and_pd(_mm_cmplt_pd(da, db), _mm_cmplt_pd(da, dc)), _mm_cmplt_pd(da, dd));
+                __m128d mb = _mm_and_pd(_mm_and_pd(_mm_cmplt_pd(db, da), _mm_cmplt_pd(db, dc)), _mm_cmplt_pd(db, dd));
+                __m128d mc = _mm_and_pd(_mm_and_pd(_mm_cmplt_pd(dc, da), _mm_cmplt_pd(dc, db)), _mm_cmplt_pd(dc, dd));
+
+                __m128i v = _mm_blendv_epi8(c11, c01, _mm_castpd_si128(mc));
+                v = _mm_blendv_epi8(v, c10, _mm_castpd_si128(mb));
+                v = _mm_blendv_epi8(v, c00, _mm_castpd_si128(ma));
+                _mm_storel_epi64((__m128i*)(buf + j*newWidth + (x << 2) + 2*h), _mm_shuffle_epi32(v, 0x08));
+            }
+        }
+
+        v00 = v10;
+        v01 = v11;
+    }
+}
+
+TARGET_AVX2 static void voronoiRowAVX2(int *buf, int newWidth, const int *p0, const int *p1,
+        const double *j0, const double *j1, int n)
+{
+    const __m256d vi = _mm256_setr_pd(0, 1, 2, 3);
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    int x, j;
+    int v00 = p0[0];
+    int v01 = p1[0];
+
+    for (x = 0; x < n; x++)
+    {
+        __m256d da1 = _mm256_set1_pd(j0[2*x+0]);
+        __m256d db1 = _mm256_set1_pd(j0[2*x+2] + 4.0);
+        __m256d dc1 = _mm256_set1_pd(j1[2*x+0]);
+        __m256d dd1 = _mm256_set1_pd(j1[2*x+2] + 4.0);
+        double da2 = j0[2*x+1];
+        double db2 = j0[2*x+3];
+        double dc2 = j1[2*x+1] + 4.0;
+        double dd2 = j1[2*x+3] + 4.0;
+
+        int v10 = p0[x+1] & 255;
+        int v11 = p1[x+1] & 255;
+        __m256i c00 = _mm256_set1_epi64x(v00), c10 = _mm256_set1_epi64x(v10);
+        __m256i c01 = _mm256_set1_epi64x(v01), c11 = _mm256_set1_epi64x(v11);
+        __m256d ia = _mm256_sub_pd(vi, da1), ib = _mm256_sub_pd(vi, db1);
+        __m256d ic = _mm256_sub_pd(vi, dc1), id = _mm256_sub_pd(vi, dd1);
+        ia = _mm256_mul_pd(ia, ia);
+        ib = _mm256_mul_pd(ib, ib);
+        ic = _mm256_mul_pd(ic, ic);
+        id = _mm256_mul_pd(id, id);
+
+        for (j = 0; j < 4; j++)
+        {
+            __m256d da = _mm256_add_pd(_mm256_set1_pd((j-da2)*(j-da2)), ia);
+            __m256d db = _mm256_add_pd(_mm256_set1_pd((j-db2)*(j-db2)), ib);
+            __m256d dc = _mm256_add_pd(_mm256_set1_pd((j-dc2)*(j-dc2)), ic);
+            __m256d dd = _mm256_add_pd(_mm256_set1_pd((j-dd2)*(j-dd2)), id);
+
+            __m256d ma = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(da, db, _CMP_LT_OQ),
+                    _mm256_cmp_pd(da, dc, _CMP_LT_OQ)), _mm256_cmp_pd(da, dd, _CMP_LT_OQ));
+            __m256d mb = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(db, da, _CMP_LT_OQ),
+                    _mm256_cmp_pd(db, dc, _CMP_LT_OQ)), _mm256_cmp_pd(db, dd, _CMP_LT_OQ));
+            __m256d mc = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(dc, da, _CMP_LT_OQ),
+                    _mm256_cmp_pd(dc, db, _CMP_LT_OQ)), _mm256_cmp_pd(dc, dd, _CMP_LT_OQ));
+
+            __m256i v = _mm256_blendv_epi8(c11, c01, _mm256_castpd_si256(mc));
+            v = _mm256_blendv_epi8(v, c10, _mm256_castpd_si256(mb));
+            v = _mm256_blendv_epi8(v, c00, _mm256_castpd_si256(ma));
+            _mm_storeu_si128((__m128i*)(buf + j*newWidth + (x << 2)),
+                    _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(v, pack)));
+        }
+
+        v00 = v10;
+        v01 = v11;
+    }
+}
+
+/* Two rows of a block per vector. The explicit fp-contract keeps GCC from
+ * fusing the multiply-adds, which AVX-512 capable targets otherwise allow.
+ */
+TARGET_AVX512 __attribute__((optimize("fp-contract=off")))
+static void voronoiRowAVX512(int *buf, int newWidth, const int *p0, const int *p1,
+        const double *j0, const double *j1, int n)
+{
+    const __m512d vi = _mm512_setr_pd(0, 1, 2, 3, 0, 1, 2, 3);
+    int x, j;
+    int v00 = p0[0];
+    int v01 = p1[0];
+
+    for (x = 0; x < n; x++)
+    {
+        __m512d da1 = _mm512_set1_pd(j0[2*x+0]);
+        __m512d db1 = _mm512_set1_pd(j0[2*x+2] + 4.0);
+        __m512d dc1 = _mm512_set1_pd(j1[2*x+0]);
+        __m512d dd1 = _mm512_set1_pd(j1[2*x+2] + 4.0);
+        double da2 = j0[2*x+1];
+        double db2 = j0[2*x+3];
+        double dc2 = j1[2*x+1] + 4.0;
+        double dd2 = j1[2*x+3] + 4.0;
+
+        int v10 = p0[x+1] & 255;
+        int v11 = p1[x+1] & 255;
+        __m512i c00 = _mm512_set1_epi64(v00), c10 = _mm512_set1_epi64(v10);
+        __m512i c01 = _mm512_set1_epi64(v01), c11 = _mm512_set1_epi64(v11);
+        __m512d ia = _mm512_sub_pd(vi, da1), ib = _mm512_sub_pd(vi, db1);
+        __m512d ic = _mm512_sub_pd(vi, dc1), id = _mm512_sub_pd(vi, dd1);
+        ia = _mm512_mul_pd(ia, ia);
+        ib = _mm512_mul_pd(ib, ib);
+        ic = _mm512_mul_pd(ic, ic);
+        id = _mm512_mul_pd(id, id);
+
+        for (j = 0; j < 4; j += 2)
+        {
+            __m512d da = _mm512_add_pd(_mm512_setr_pd(
+                    (j-da2)*(j-da2), (j-da2)*(j-da2), (j-da2)*(j-da2), (j-da2)*(j-da2),
+                    (j+1-da2)*(j+1-da2), (j+1-da2)*(j+1-da2), (j+1-da2)*(j+1-da2), (j+1-da2)*(j+1-da2)), ia);
+            __m512d db = _mm512_add_pd(_mm512_setr_pd(
+                    (j-db2)*(j-db2), (j-db2)*(j-db2), (j-db2)*(j-db2), (j-db2)*(j-db2),
+                    (j+1-db2)*(j+1-db2), (j+1-db2)*(j+1-db2), (j+1-db2)*(j+1-db2), (j+1-db2)*(j+1-db2)), ib);
+            __m512d dc = _mm512_add_pd(_mm512_setr_pd(
+                    (j-dc2)*(j-dc2), (j-dc2)*(j-dc2), (j-dc2)*(j-dc2), (j-dc2)*(j-dc2),
+                    (j+1-dc2)*(j+1-dc2), (j+1-dc2)*(j+1-dc2), (j+1-dc2)*(j+1-dc2), (j+1-dc2)*(j+1-dc2)), ic);
+            __m512d dd = _mm512_add_pd(_mm512_setr_pd(
+                    (j-dd2)*(j-dd2), (j-dd2)*(j-dd2), (j-dd2)*(j-dd2), (j-dd2)*(j-dd2),
+                    (j+1-dd2)*(j+1-dd2), (j+1-dd2)*(j+1-dd2), (j+1-dd2)*(j+1-dd2), (j+1-dd2)*(j+1-dd2)), id);
+
+            __mmask8 ma = _mm512_cmp_pd_mask(da, db, _CMP_LT_OQ) & _mm512_cmp_pd_mask(da, dc, _CMP_LT_OQ) &
+                    _mm512_cmp_pd_mask(da, dd, _CMP_LT_OQ);
+            __mmask8 mb = _mm512_cmp_pd_mask(db, da, _CMP_LT_OQ) & _mm512_cmp_pd_mask(db, dc, _CMP_LT_OQ) &
+                    _mm512_cmp_pd_mask(db, dd, _CMP_LT_OQ);
+            __mmask8 mc = _mm512_cmp_pd_mask(dc, da, _CMP_LT_OQ) & _mm512_cmp_pd_mask(dc, db, _CMP_LT_OQ) &
+                    _mm512_cmp_pd_mask(dc, dd, _CMP_LT_OQ);
+
+            __m512i v = _mm512_mask_blend_epi64(mc, c11, c01);
+            v = _mm512_mask_blend_epi64(mb, v, c10);
+            v = _mm512_mask_blend_epi64(ma, v, c00);
+            __m256i r = _mm512_cvtepi64_epi32(v);
+            _mm_storeu_si128((__m128i*)(buf + j*newWidth + (x << 2)), _mm256_castsi256_si128(r));
+            _mm_storeu_si128((__m128i*)(buf + (j+1)*newWidth + (x << 2)), _mm256_extracti128_si256(r, 1));
+        }
+
+        v00 = v10;
+        v01 = v11;
+    }
+}
+
+#endif
+
+/* The corner jitter of a parent cell is shared by the four blocks around it,
+ * so it is evaluated once per corner and kept for the next row of blocks.
+ */
+static void voronoiJitter(Layer *l, double *jit, int pX, int pZ, int pWidth)
+{
+    int x;
 
+    for (x = 0; x < pWidth; x++)
+    {
+        setChunkSeed(l, (x+pX) << 2, pZ << 2);
+        jit[2*x+0] = (mcNextInt1024(l) / 1024.0 - 0.5) * 3.6;
+        jit[2*x+1] = (mcNextInt1024(l) / 1024.0 - 0.5) * 3.6;
+    }
+}
 
-void mapVoronoiZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int areaWidth, int areaHeight)
+LAYER_TEMPLATE(mapVoronoiZoom)
 {
     areaX -= 2;
     areaZ -= 2;
@@ -1648,80 +2754,250 @@ void mapVoronoiZoom(Layer *l, int * __restrict out, int areaX, int areaZ, int ar
     int pZ = areaZ >> 2;
     int pWidth = (areaWidth >> 2) + 2;
     int pHeight = (areaHeight >> 2) + 2;
+    // the blocks have to cover the offset of the area in the first block too
+    if (((pWidth-1) << 2) < (areaX & 3) + areaWidth)
+        pWidth++;
+    if (((pHeight-1) << 2) < (areaZ & 3) + areaHeight)
+        pHeight++;
     int newWidth = (pWidth-1) << 2;
     int newHeight = (pHeight-1) << 2;
-    int x, z, i, j;
+    int z;
     int *buf = (int *)malloc((newWidth+1)*(newHeight+1)*sizeof(*buf));
+    double *jit = (double *)malloc(4*pWidth*sizeof(*jit));
+    double *j0 = jit, *j1 = jit + 2*pWidth, *jt;
+
+    parent(l->p, out, pX, pZ, pWidth, pHeight);
 
-    l->p->getMap(l->p, out, pX, pZ, pWidth, pHeight);
+    voronoiJitter(l, j0, pX, pZ, pWidth);
 
     for (z = 0; z < pHeight - 1; z++)
     {
-        int v00 = out[(z+0)*pWidth];
-        int v01 = out[(z+1)*pWidth];
+        voronoiJitter(l, j1, pX, pZ+z+1, pWidth);
 
-        for (x = 0; x < pWidth - 1; x++)
-        {
-            setChunkSeed(l, (x+pX) << 2, (z+pZ) << 2);
-            double da1 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6;
-            double da2 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6;
+        (kernels.voronoi ? kernels.voronoi : voronoiRow)(buf + (z << 2) * newWidth, newWidth,
+                out + z*pWidth, out + (z+1)*pWidth, j0, j1, pWidth-1);
 
-            setChunkSeed(l, (x+pX+1) << 2, (z+pZ) << 2);
-            double db1 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6 + 4.0;
-            double db2 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6;
+        jt = j0; j0 = j1; j1 = jt;
+    }
 
-            setChunkSeed(l, (x+pX) << 2, (z+pZ+1) << 2);
-            double dc1 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6;
-            double dc2 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6 + 4.0;
+    for (z = 0; z < areaHeight; z++)
+    {
+        memcpy(&out[z * areaWidth], &buf[(z + (areaZ & 3))*newWidth + (areaX & 3)], areaWidth*sizeof(int));
+    }
 
-            setChunkSeed(l, (x+pX+1) << 2, (z+pZ+1) << 2);
-            double dd1 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6 + 4.0;
-            double dd2 = (mcNextInt(l, 1024) / 1024.0 - 0.5) * 3.6 + 4.0;
+    free(jit);
+    free(buf);
+}
 
-            int v10 = out[x+1 + (z+0)*pWidth] & 255;
-            int v11 = out[x+1 + (z+1)*pWidth] & 255;
+GENERIC_LAYER(mapVoronoiZoom)
 
-            for (j = 0; j < 4; j++)
-            {
-                int idx = ((z << 2) + j) * newWidth + (x << 2);
 
-                for (i = 0; i < 4; i++)
-                {
-                    double da = (j-da2)*(j-da2) + (i-da1)*(i-da1);
-                    double db = (j-db2)*(j-db2) + (i-db1)*(i-db1);
-                    double dc = (j-dc2)*(j-dc2) + (i-dc1)*(i-dc1);
-                    double dd = (j-dd2)*(j-dd2) + (i-dd1)*(i-dd1);
 
-                    if (da < db && da < dc && da < dd)
-                    {
-                        buf[idx++] = v00;
-                    }
-                    else if (db < da && db < dc && db < dd)
-                    {
-                        buf[idx++] = v10;
-                    }
-                    else if (dc < da && dc < db && dc < dd)
-                    {
-                        buf[idx++] = v01;
-                    }
-                    else
-                    {
-                        buf[idx++] = v11;
-                    }
-                }
-            }
+//==============================================================================
+// Kernel Dispatch
+//==============================================================================
 
-            v00 = v10;
-            v01 = v11;
-        }
+static const char *simdLevelNames[SIMD_NUM] = { "scalar", "sse42", "avx2", "avx512" };
+
+int detectSimdLevel()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SIMD_SSE42;
+#endif
+    return SIMD_SCALAR;
+}
+
+int setSimdLevel(int level)
+{
+    int best = detectSimdLevel();
+
+    if (level < 0 || level > best)
+        level = best;
+
+    memset(&kernels, 0, sizeof(kernels));
+
+#ifdef SIMD_X86
+    switch (level)
+    {
+    case SIMD_SSE42:
+        kernels.zoom = mapZoomRowSSE42;
+        kernels.smooth = mapSmoothRowSSE42;
+        kernels.river = mapRiverRowSSE42;
+        kernels.biomeEdge = mapBiomeEdgeRowSSE42;
+        kernels.shore = mapShoreRowSSE42;
+        kernels.voronoi = voronoiRowSSE42;
+        break;
+    case SIMD_AVX2:
+        kernels.zoom = mapZoomRowAVX2;
+        kernels.smooth = mapSmoothRowAVX2;
+        kernels.river = mapRiverRowAVX2;
+        kernels.biomeEdge = mapBiomeEdgeRowAVX2;
+        kernels.hills = mapHillsRowAVX2;
+        kernels.shore = mapShoreRowAVX2;
+        kernels.voronoi = voronoiRowAVX2;
+        break;
+    case SIMD_AVX512:
+        kernels.zoom = mapZoomRowAVX512;
+        kernels.smooth = mapSmoothRowAVX512;
+        kernels.river = mapRiverRowAVX512;
+        kernels.biomeEdge = mapBiomeEdgeRowAVX512;
+        kernels.hills = mapHillsRowAVX512;
+        kernels.shore = mapShoreRowAVX512;
+        kernels.voronoi = voronoiRowAVX512;
+        break;
     }
+#endif
 
-    for (z = 0; z < areaHeight; z++)
+    simdLevel = level;
+    return level;
+}
+
+int getSimdLevel()
+{
+    return simdLevel < 0 ? SIMD_SCALAR : simdLevel;
+}
+
+const char *simdLevelName(int level)
+{
+    return level >= 0 && level < SIMD_NUM ? simdLevelNames[level] : "unknown";
+}
+
+int parseSimdLevel(const char *name)
+{
+    int i;
+    for (i = 0; i < SIMD_NUM; i++)
     {
-        memcpy(&out[z * areaWidth], &buf[(z + (areaZ & 3))*newWidth + (areaX & 3)], areaWidth*sizeof(int));
+        if (strcmp(name, simdLevelNames[i]) == 0)
+            return i;
     }
+    return -1;
+}
 
-    free(buf);
+
+//==============================================================================
+// Built-in Stack Pipelines
+//==============================================================================
+
+#define PIPE(name, map, parent) \
+static void name(Layer *l, int *out, int x, int z, int w, int h) \
+{ \
+    map##With(l, out, x, z, w, h, parent, NULL); \
 }
 
+#define PIPE2(name, map, parent, parent2) \
+static void name(Layer *l, int *out, int x, int z, int w, int h) \
+{ \
+    map##With(l, out, x, z, w, h, parent, parent2); \
+}
 
+// the continent and climate layers shared by both versions
+PIPE(pipe1,  mapZoom, mapIsland)
+PIPE(pipe2,  mapAddIsland, pipe1)
+PIPE(pipe3,  mapZoom, pipe2)
+PIPE(pipe4,  mapAddIsland, pipe3)
+PIPE(pipe5,  mapAddIsland, pipe4)
+PIPE(pipe6,  mapAddIsland, pipe5)
+PIPE(pipe7,  mapRemoveTooMuchOcean, pipe6)
+PIPE(pipe8,  mapAddSnow, pipe7)
+PIPE(pipe9,  mapAddIsland, pipe8)
+PIPE(pipe10, mapCoolWarm, pipe9)
+PIPE(pipe11, mapHeatIce, pipe10)
+PIPE(pipe12, mapSpecial, pipe11)
+PIPE(pipe13, mapZoom, pipe12)
+PIPE(pipe14, mapZoom, pipe13)
+PIPE(pipe15, mapAddIsland, pipe14)
+PIPE(pipe16, mapAddMushroomIsland, pipe15)
+PIPE(pipe17, mapDeepOcean, pipe16)
+PIPE(pipe18, mapBiome, pipe17)
+PIPE(pipe19, mapZoom, pipe18)
+PIPE(pipe20, mapZoom, pipe19)
+PIPE(pipe21, mapBiomeEdge, pipe20)
+PIPE(pipe22, mapRiverInit, pipe17)
+PIPE(pipe23, mapZoom, pipe22)
+PIPE(pipe24, mapZoom, pipe23)
+
+// 1.7
+PIPE2(mc17Pipe25, mapHills, pipe21, pipe24)
+PIPE(mc17Pipe26, mapRareBiome, mc17Pipe25)
+PIPE(mc17Pipe27, mapZoom, mc17Pipe26)
+PIPE(mc17Pipe28, mapAddIsland, mc17Pipe27)
+PIPE(mc17Pipe29, mapZoom, mc17Pipe28)
+PIPE(mc17Pipe30, mapShore, mc17Pipe29)
+PIPE(mc17Pipe31, mapZoom, mc17Pipe30)
+PIPE(mc17Pipe32, mapZoom, mc17Pipe31)
+PIPE(mc17Pipe33, mapZoom, mc17Pipe32)
+PIPE(mc17Pipe34, mapZoom, mc17Pipe33)
+PIPE(mc17Pipe35, mapSmooth, mc17Pipe34)
+PIPE(mc17Pipe36, mapZoom, pipe22)
+PIPE(mc17Pipe37, mapZoom, mc17Pipe36)
+PIPE(mc17Pipe38, mapZoom, mc17Pipe37)
+PIPE(mc17Pipe39, mapZoom, mc17Pipe38)
+PIPE(mc17Pipe40, mapZoom, mc17Pipe39)
+PIPE(mc17Pipe41, mapZoom, mc17Pipe40)
+PIPE(mc17Pipe42, mapRiver, mc17Pipe41)
+PIPE(mc17Pipe43, mapSmooth, mc17Pipe42)
+PIPE2(mc17Pipe44, mapRiverMix, mc17Pipe35, mc17Pipe43)
+PIPE(mc17Pipe45, mapVoronoiZoom, mc17Pipe44)
+
+// 1.13, the river chain starts from the biome chain as in setupGeneratorMC113()
+PIPE2(mc113Pipe25, mapHills113, pipe21, pipe24)
+PIPE(mc113Pipe26, mapRareBiome, mc113Pipe25)
+PIPE(mc113Pipe27, mapZoom, mc113Pipe26)
+PIPE(mc113Pipe28, mapAddIsland, mc113Pipe27)
+PIPE(mc113Pipe29, mapZoom, mc113Pipe28)
+PIPE(mc113Pipe30, mapShore, mc113Pipe29)
+PIPE(mc113Pipe31, mapZoom, mc113Pipe30)
+PIPE(mc113Pipe32, mapZoom, mc113Pipe31)
+PIPE(mc113Pipe33, mapZoom, mc113Pipe32)
+PIPE(mc113Pipe34, mapZoom, mc113Pipe33)
+PIPE(mc113Pipe35, mapSmooth, mc113Pipe34)
+PIPE(mc113Pipe36, mapZoom, pipe22)
+PIPE(mc113Pipe37, mapZoom, mc113Pipe35)
+PIPE(mc113Pipe38, mapZoom, mc113Pipe37)
+PIPE(mc113Pipe39, mapZoom, mc113Pipe38)
+PIPE(mc113Pipe40, mapZoom, mc113Pipe39)
+PIPE(mc113Pipe41, mapZoom, mc113Pipe40)
+PIPE(mc113Pipe42, mapRiver, mc113Pipe41)
+PIPE(mc113Pipe43, mapSmooth, mc113Pipe42)
+PIPE2(mc113Pipe44, mapRiverMix, mc113Pipe35, mc113Pipe43)
+PIPE(mc113Pipe46, mapZoom, mapOceanTemp)
+PIPE(mc113Pipe47, mapZoom, mc113Pipe46)
+PIPE(mc113Pipe48, mapZoom, mc113Pipe47)
+PIPE(mc113Pipe49, mapZoom, mc113Pipe48)
+PIPE(mc113Pipe50, mapZoom, mc113Pipe49)
+PIPE(mc113Pipe51, mapZoom, mc113Pipe50)
+PIPE2(mc113Pipe52, mapOceanMix, mc113Pipe44, mc113Pipe51)
+PIPE(mc113Pipe53, mapVoronoiZoom, mc113Pipe52)
+
+#define SHARED_PIPES \
+    mapIsland, pipe1, pipe2, pipe3, pipe4, pipe5, pipe6, pipe7, pipe8, pipe9, \
+    pipe10, pipe11, pipe12, pipe13, pipe14, pipe15, pipe16, pipe17, pipe18, pipe19, \
+    pipe20, pipe21, pipe22, pipe23, pipe24
+
+void (*const pipelineMC17[PIPELINE_MC17_NUM])(Layer *l, int *out, int x, int z, int w, int h) =
+{
+    SHARED_PIPES,
+    mc17Pipe25, mc17Pipe26, mc17Pipe27, mc17Pipe28, mc17Pipe29,
+    mc17Pipe30, mc17Pipe31, mc17Pipe32, mc17Pipe33, mc17Pipe34,
+    mc17Pipe35, mc17Pipe36, mc17Pipe37, mc17Pipe38, mc17Pipe39,
+    mc17Pipe40, mc17Pipe41, mc17Pipe42, mc17Pipe43, mc17Pipe44,
+    mc17Pipe45,
+};
+
+void (*const pipelineMC113[PIPELINE_MC113_NUM])(Layer *l, int *out, int x, int z, int w, int h) =
+{
+    SHARED_PIPES,
+    mc113Pipe25, mc113Pipe26, mc113Pipe27, mc113Pipe28, mc113Pipe29,
+    mc113Pipe30, mc113Pipe31, mc113Pipe32, mc113Pipe33, mc113Pipe34,
+    mc113Pipe35, mc113Pipe36, mc113Pipe37, mc113Pipe38, mc113Pipe39,
+    mc113Pipe40, mc113Pipe41, mc113Pipe42, mc113Pipe43, mc113Pipe44,
+    mapOceanTemp, mc113Pipe46, mc113Pipe47, mc113Pipe48, mc113Pipe49,
+    mc113Pipe50, mc113Pipe51, mc113Pipe52, mc113Pipe53,
+};
@@ -8,19 +8,18 @@
 #include <inttypes.h>
 
 
-#if defined USE_SIMD && __AVX2__
-#include <emmintrin.h>
-#include <smmintrin.h>
+#if defined __x86_64__ || defined __i386__
+#define SIMD_X86
 #include <immintrin.h>
-#warning "Using AVX2 extensions."
-#elif defined USE_SIMD && defined __SSE4_2__
-#include <emmintrin.h>
-#include <smmintrin.h>
-#warning "Using SSE4.2 extensions."
-#else
-//#warning "Using no SIMD extensions."
 #endif
 
+/* The vectorised kernels are compiled for their instruction set regardless of
+ * the compiler flags and selected at runtime, see setSimdLevel().
+ */
+#define TARGET_SSE42  __attribute__((target("sse4.2")))
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx512bw")))
+
 #define STRUCT(S) typedef struct S S; struct S
 
 #define OPT_O2 __attribute__((optimize("O2")))
@@ -50,6 +49,12 @@ enum BiomeTempCategory
 };
 
 
+enum SimdLevel
+{
+    SIMD_SCALAR, SIMD_SSE42, SIMD_AVX2, SIMD_AVX512, SIMD_NUM
+};
+
+
 STRUCT(Biome)
 {
     int id;
@@ -79,8 +84,26 @@ STRUCT(Layer)
     void (*getMap)(Layer *layer, int *out, int x, int z, int w, int h);
 
     Layer *p, *p2;      // parent layers
+
+    // specialised getMap of a built-in stack layer, see pipelineMC17, NULL
+    // otherwise: reset it when the parents change
+    void (*pipeline)(Layer *layer, int *out, int x, int z, int w, int h);
+
+#ifdef LAYER_TRACE
+    int traceId;        // layer index in the generator, -1 for custom layers
+#endif
 };
 
+/* Generates the area of a layer, every layer calls its parents through this.
+ * Building with LAYER_TRACE records the calls, see traceLayerMap().
+ */
+#ifdef LAYER_TRACE
+void traceLayerMap(Layer *l, int *out, int x, int z, int w, int h);
+#define CALL_MAP(l, out, x, z, w, h) traceLayerMap(l, out, x, z, w, h)
+#else
+#define CALL_MAP(l, out, x, z, w, h) (l)->getMap(l, out, x, z, w, h)
+#endif
+
 
 //==============================================================================
 // Essentials
@@ -88,6 +111,25 @@ STRUCT(Layer)
 
 extern Biome biomes[256];
 
+enum BiomeFlag
+{
+    BIOME_EXISTS        = 0x01,
+    BIOME_OCEANIC       = 0x02, // any ocean, deep or not
+    BIOME_SHALLOW_OCEAN = 0x04,
+    BIOME_SNOWY         = 0x08, // existing biome with a temperature below 0.1
+    BIOME_JUNGLE        = 0x10, // type Jungle
+    BIOME_MESA          = 0x20, // type Mesa
+    BIOME_SHORE_JFTO    = 0x40, // jungle type, forest, taiga or ocean: no jungle edge on the shore layer
+};
+
+/* Lookup tables of the biome predicates, built by initBiomes(): a BiomeFlag
+ * set for every id and 256x256 bit matrices for equalOrPlateau() and
+ * canBeNeighbors().
+ */
+extern uint8_t biomeFlags[256];
+extern uint64_t plateauMatrix[256][4];
+extern uint64_t neighborMatrix[256][4];
+
 
 /* initBiomes() has to be called before any of the generators can be used */
 void initBiomes();
@@ -95,6 +137,22 @@ void initBiomes();
 /* Applies the given world seed to the layer and all dependent layers. */
 void setWorldSeed(Layer *layer, int64_t seed);
 
+/* Returns the best SimdLevel supported by the running CPU. */
+int detectSimdLevel();
+
+/* Selects the layer kernels for the given SimdLevel. Levels the CPU does not
+ * support are lowered to the best supported one, which is returned.
+ * initBiomes() selects detectSimdLevel() unless a level was set before.
+ */
+int setSimdLevel(int level);
+int getSimdLevel();
+
+/* Name of a SimdLevel as used on the command line ("scalar", "sse42", ...).
+ * parseSimdLevel() returns -1 for unknown names.
+ */
+const char *simdLevelName(int level);
+int parseSimdLevel(const char *name);
+
 
 //==============================================================================
 // Static Helpers
@@ -107,7 +165,7 @@ static inline int getBiomeType(int id)
 
 static inline int biomeExists(int id)
 {
-    return !(biomes[id & 0xff].id & (~0xff));
+    return biomeFlags[id & 0xff] & BIOME_EXISTS;
 }
 
 static inline int getTempCategory(int id)
@@ -115,60 +173,42 @@ static inline int getTempCategory(int id)
     return biomes[id & 0xff].tempCat;
 }
 
+/* Bit 'id2' of the row 'id1' of a biome pair matrix. Ids outside 0-255 are
+ * only equal to themselves.
+ */
+static inline int testBiomePair(const uint64_t matrix[256][4], int id1, int id2)
+{
+    if ((unsigned) id1 >= 256 || (unsigned) id2 >= 256) return 0;
+    return (matrix[id1][id2 >> 6] >> (id2 & 63)) & 1;
+}
 
+/* Equality of the biome classes, including the asymmetry of the Java code for
+ * the mutated biomes that do not override isEqualTo().
+ */
 static inline int equalOrPlateau(int id1, int id2)
 {
-    if (id1 == id2) return 1;
-    if (id1 == mesaPlateau_F || id1 == mesaPlateau) return id2 == mesaPlateau_F || id2 == mesaPlateau;
-    if (!biomeExists(id1) || !biomeExists(id2)) return 0;
-    // adjust for asymmetric equality (workaround to simulate a bug in the MC java code)
-    if (id1 >= 128 || id2 >= 128) {
-        // skip biomes that did not overload the isEqualTo() method
-        if (id2 == 130 || id2 == 133 || id2 == 134 || id2 == 149 || id2 == 151 || id2 == 155 ||
-           id2 == 156 || id2 == 157 || id2 == 158 || id2 == 163 || id2 == 164) return 0;
-    }
-    return getBiomeType(id1) == getBiomeType(id2);
+    return id1 == id2 || testBiomePair(plateauMatrix, id1, id2);
 }
 
 static inline int canBeNeighbors(int id1, int id2)
 {
-    if (equalOrPlateau(id1, id2)) return 1;
-    if (!biomeExists(id1) || !biomeExists(id2)) return 0;
-    int tempCat1 = getTempCategory(id1); if (tempCat1 == Lush) return 1;
-    int tempCat2 = getTempCategory(id2); if (tempCat2 == Lush) return 1;
-    return tempCat1 == tempCat2;
+    return id1 == id2 || testBiomePair(neighborMatrix, id1, id2);
 }
 
 static inline int isShallowOcean(int id)
 {
-    return id == ocean || id == frozenOcean ||
-           id == warmOcean || id == lukewarmOcean || id == coldOcean;
+    return (unsigned) id < 256 && (biomeFlags[id] & BIOME_SHALLOW_OCEAN);
 }
 
 static inline int isOceanic(int id)
 {
-    switch(id)
-    {
-    case ocean:
-    case deepOcean:
-    case warmOcean:
-    case warmDeepOcean:
-    case lukewarmOcean:
-    case lukewarmDeepOcean:
-    case coldOcean:
-    case coldDeepOcean:
-    case frozenOcean:
-    case frozenDeepOcean:
-        return 1;
-    default:
-        return 0;
-    }
+    return (unsigned) id < 256 && (biomeFlags[id] & BIOME_OCEANIC);
 }
 
 
 static inline int isBiomeSnowy(int id)
 {
-    return biomeExists(id) && biomes[id&0xff].temp < 0.1;
+    return biomeFlags[id & 0xff] & BIOME_SNOWY;
 }
 
 static inline int mcNextInt(Layer *layer, int mod)
@@ -185,6 +225,39 @@ static inline int mcNextInt(Layer *layer, int mod)
     return ret;
 }
 
+/* Floor modulo of the top 40 bits of a chunk seed by a constant 'mod', as
+ * computed by mcNextInt(). The value is moved to the positive range by a
+ * multiple of 'mod', so the remainder is unsigned and needs no sign fix: a
+ * multiply-high and a shift, or a mask for the powers of two.
+ */
+#define MC_MOD_OFFSET(mod) ((((int64_t)1 << 39) + (mod) - 1) / (mod) * (mod))
+#define mcFloorMod(cs, mod) ((mod) & ((mod) - 1) ? \
+        (int)((uint64_t)(((cs) >> 24) + MC_MOD_OFFSET(mod)) % (mod)) : \
+        (int)(((cs) >> 24) & ((mod) - 1)))
+
+/* mcNextInt() for the constant moduli of the layers: mcNextInt3(l) equals
+ * mcNextInt(l, 3).
+ */
+#define MC_NEXT_INT(mod) \
+static inline int mcNextInt##mod(Layer *layer) \
+{ \
+    int ret = mcFloorMod(layer->chunkSeed, mod); \
+    layer->chunkSeed *= layer->chunkSeed * 6364136223846793005LL + 1442695040888963407LL; \
+    layer->chunkSeed += layer->worldSeed; \
+    return ret; \
+}
+
+MC_NEXT_INT(2)
+MC_NEXT_INT(3)
+MC_NEXT_INT(4)
+MC_NEXT_INT(6)
+MC_NEXT_INT(13)
+MC_NEXT_INT(15)
+MC_NEXT_INT(57)
+MC_NEXT_INT(100)
+MC_NEXT_INT(1024)
+MC_NEXT_INT(299999)
+
 static inline void setChunkSeed(Layer *layer, int64_t chunkX, int64_t chunkZ)
 {
     layer->chunkSeed =  layer->worldSeed;
@@ -213,9 +286,59 @@ static inline void setBaseSeed(Layer *layer, int64_t seed)
     layer->chunkSeed = 0;
 }
 
-#if defined USE_SIMD && __AVX2__
+#ifdef SIMD_X86
+
+TARGET_AVX512 static inline __m512i set16ChunkSeeds(int ws, __m512i xs, __m512i zs)
+{
+    __m512i out = _mm512_set1_epi32(ws);
+    __m512i mul = _mm512_set1_epi32(1284865837);
+    __m512i add = _mm512_set1_epi32(4150755663);
+    out = _mm512_add_epi32(xs, _mm512_mullo_epi32(out, _mm512_add_epi32(add, _mm512_mullo_epi32(out, mul))));
+    out = _mm512_add_epi32(zs, _mm512_mullo_epi32(out, _mm512_add_epi32(add, _mm512_mullo_epi32(out, mul))));
+    out = _mm512_add_epi32(xs, _mm512_mullo_epi32(out, _mm512_add_epi32(add, _mm512_mullo_epi32(out, mul))));
+    return _mm512_add_epi32(zs, _mm512_mullo_epi32(out, _mm512_add_epi32(add, _mm512_mullo_epi32(out, mul))));
+}
+
+TARGET_AVX512 static inline __m512i mc16NextInt(__m512i* cs, int ws, int mask)
+{
+    __m512i ret = _mm512_and_si512(_mm512_set1_epi32(mask), _mm512_srli_epi32(*cs, 24));
+    *cs = _mm512_add_epi32(_mm512_set1_epi32(ws), _mm512_mullo_epi32(*cs, _mm512_add_epi32(_mm512_set1_epi32(4150755663), _mm512_mullo_epi32(*cs, _mm512_set1_epi32(1284865837)))));
+    return ret;
+}
+
+TARGET_AVX512 static inline __m512i select16Random2(__m512i* cs, int ws, __m512i a1, __m512i a2)
+{
+    __m512i val = mc16NextInt(cs, ws, 0x1);
+    return _mm512_mask_blend_epi32(_mm512_test_epi32_mask(val, val), a1, a2);
+}
+
+TARGET_AVX512 static inline __m512i select16Random4(__m512i* cs, int ws, __m512i a1, __m512i a2, __m512i a3, __m512i a4)
+{
+    __m512i val = mc16NextInt(cs, ws, 0x3);
+    __m512i ret = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(val, _mm512_set1_epi32(1)), a1, a2);
+    ret = _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(val, _mm512_set1_epi32(2)), ret, a3);
+    return _mm512_mask_blend_epi32(_mm512_cmpeq_epi32_mask(val, _mm512_set1_epi32(3)), ret, a4);
+}
+
+TARGET_AVX512 static inline __m512i select16ModeOrRandom(__m512i* cs, int ws, __m512i a1, __m512i a2, __m512i a3, __m512i a4)
+{
+    __mmask16 cmp1 = _mm512_cmpeq_epi32_mask(a1, a2);
+    __mmask16 cmp2 = _mm512_cmpeq_epi32_mask(a1, a3);
+    __mmask16 cmp3 = _mm512_cmpeq_epi32_mask(a1, a4);
+    __mmask16 cmp4 = _mm512_cmpeq_epi32_mask(a2, a3);
+    __mmask16 cmp5 = _mm512_cmpeq_epi32_mask(a2, a4);
+    __mmask16 cmp6 = _mm512_cmpeq_epi32_mask(a3, a4);
+    __mmask16 isa1 = (cmp1 & ~cmp6) | (cmp2 & ~cmp5) | (cmp3 & ~cmp4);
+    __mmask16 isa2 = (cmp4 & ~cmp3) | (cmp5 & ~cmp2);
+    __mmask16 isa3 = cmp6 & ~cmp1;
+
+    __m512i ret = select16Random4(cs, ws, a1, a2, a3, a4);
+    ret = _mm512_mask_blend_epi32(isa3, ret, a3);
+    ret = _mm512_mask_blend_epi32(isa2, ret, a2);
+    return _mm512_mask_blend_epi32(isa1, ret, a1);
+}
 
-static inline __m256i set8ChunkSeeds(int ws, __m256i xs, __m256i zs)
+TARGET_AVX2 static inline __m256i set8ChunkSeeds(int ws, __m256i xs, __m256i zs)
 {
     __m256i out = _mm256_set1_epi32(ws);
     __m256i mul = _mm256_set1_epi32(1284865837);
@@ -226,7 +349,7 @@ static inline __m256i set8ChunkSeeds(int ws, __m256i xs, __m256i zs)
     return _mm256_add_epi32(zs, _mm256_mullo_epi32(out, _mm256_add_epi32(add, _mm256_mullo_epi32(out, mul))));
 }
 
-static inline __m256i mc8NextInt(__m256i* cs, int ws, int mask)
+TARGET_AVX2 static inline __m256i mc8NextInt(__m256i* cs, int ws, int mask)
 {
     __m256i and = _mm256_set1_epi32(mask);
     __m256i ret = _mm256_and_si256(and, _mm256_srli_epi32(*cs, 24));
@@ -234,13 +357,13 @@ static inline __m256i mc8NextInt(__m256i* cs, int ws, int mask)
     return _mm256_add_epi32(ret, _mm256_and_si256(and, _mm256_cmpgt_epi32(_mm256_set1_epi32(0), ret)));;
 }
 
-static inline __m256i select8Random2(__m256i* cs, int ws, __m256i a1, __m256i a2)
+TARGET_AVX2 static inline __m256i select8Random2(__m256i* cs, int ws, __m256i a1, __m256i a2)
 {
     __m256i cmp = _mm256_cmpeq_epi32(_mm256_set1_epi32(0), mc8NextInt(cs, ws, 0x1));
     return _mm256_or_si256(_mm256_and_si256(cmp, a1), _mm256_andnot_si256(cmp, a2));
 }
 
-static inline __m256i select8Random4(__m256i* cs, int ws, __m256i a1, __m256i a2, __m256i a3, __m256i a4)
+TARGET_AVX2 static inline __m256i select8Random4(__m256i* cs, int ws, __m256i a1, __m256i a2, __m256i a3, __m256i a4)
 {
     __m256i val = mc8NextInt(cs, ws, 0x3);
     __m256i v2 = _mm256_set1_epi32(2);
@@ -253,7 +376,7 @@ static inline __m256i select8Random4(__m256i* cs, int ws, __m256i a1, __m256i a2
     );
 }
 
-static inline __m256i select8ModeOrRandom(__m256i* cs, int ws, __m256i a1, __m256i a2, __m256i a3, __m256i a4)
+TARGET_AVX2 static inline __m256i select8ModeOrRandom(__m256i* cs, int ws, __m256i a1, __m256i a2, __m256i a3, __m256i a4)
 {
     __m256i cmp1 = _mm256_cmpeq_epi32(a1, a2);
     __m256i cmp2 = _mm256_cmpeq_epi32(a1, a3);
@@ -292,9 +415,7 @@ static inline __m256i select8ModeOrRandom(__m256i* cs, int ws, __m256i a1, __m25
     );
 }
 
-#elif defined USE_SIMD && defined __SSE4_2__
-
-static inline __m128i set4ChunkSeeds(int ws, __m128i xs, __m128i zs)
+TARGET_SSE42 static inline __m128i set4ChunkSeeds(int ws, __m128i xs, __m128i zs)
 {
     __m128i out = _mm_set1_epi32(ws);
     __m128i mul = _mm_set1_epi32(1284865837);
@@ -305,7 +426,7 @@ static inline __m128i set4ChunkSeeds(int ws, __m128i xs, __m128i zs)
     return _mm_add_epi32(zs, _mm_mullo_epi32(out, _mm_add_epi32(add, _mm_mullo_epi32(out, mul))));
 }
 
-static inline __m128i mc4NextInt(__m128i* cs, int ws, int mask)
+TARGET_SSE42 static inline __m128i mc4NextInt(__m128i* cs, int ws, int mask)
 {
     __m128i and = _mm_set1_epi32(mask);
     __m128i ret = _mm_and_si128(and, _mm_srli_epi32(*cs, 24));
@@ -313,13 +434,13 @@ static inline __m128i mc4NextInt(__m128i* cs, int ws, int mask)
     return _mm_add_epi32(ret, _mm_and_si128(and, _mm_cmplt_epi32(ret, _mm_set1_epi32(0))));;
 }
 
-static inline __m128i select4Random2(__m128i* cs, int ws, __m128i a1, __m128i a2)
+TARGET_SSE42 static inline __m128i select4Random2(__m128i* cs, int ws, __m128i a1, __m128i a2)
 {
     __m128i cmp = _mm_cmpeq_epi32(_mm_set1_epi32(0), mc4NextInt(cs, ws, 0x1));
     return _mm_or_si128(_mm_and_si128(cmp, a1), _mm_andnot_si128(cmp, a2));
 }
 
-static inline __m128i select4Random4(__m128i* cs, int ws, __m128i a1, __m128i a2, __m128i a3, __m128i a4)
+TARGET_SSE42 static inline __m128i select4Random4(__m128i* cs, int ws, __m128i a1, __m128i a2, __m128i a3, __m128i a4)
 {
     __m128i val = mc4NextInt(cs, ws, 0x3);
     __m128i v2 = _mm_set1_epi32(2);
@@ -332,7 +453,7 @@ static inline __m128i select4Random4(__m128i* cs, int ws, __m128i a1, __m128i a2
     );
 }
 
-static inline __m128i select4ModeOrRandom(__m128i* cs, int ws, __m128i a1, __m128i a2, __m128i a3, __m128i a4)
+TARGET_SSE42 static inline __m128i select4ModeOrRandom(__m128i* cs, int ws, __m128i a1, __m128i a2, __m128i a3, __m128i a4)
 {
     //((a == b)&(c != d) | (a == c)&(b != d) | (a == d)&(b != c))&a | ((b == c)&(a != d) | (b == d)&(a != c))&b | ((c == d)&(a != b))&c
     __m128i cmp1 = _mm_cmpeq_epi32(a1, a2);
@@ -371,17 +492,17 @@ static inline __m128i select4ModeOrRandom(__m128i* cs, int ws, __m128i a1, __m12
     );
 }
 
-#else
+#endif
 
 static inline int selectRandom2(Layer *l, int a1, int a2)
 {
-    int i = mcNextInt(l, 2);
+    int i = mcNextInt2(l);
     return i == 0 ? a1 : a2;
 }
 
 static inline int selectRandom4(Layer *l, int a1, int a2, int a3, int a4)
 {
-    int i = mcNextInt(l, 4);
+    int i = mcNextInt4(l);
     return i == 0 ? a1 : i == 1 ? a2 : i == 2 ? a3 : a4;
 }
 
@@ -403,7 +524,6 @@ static inline int selectModeOrRandom(Layer *l, int a1, int a2, int a3, int a4)
     return rndarg;
 }
 
-#endif
 
 //==============================================================================
 // Layers
@@ -442,4 +562,14 @@ void mapOceanMix(Layer *l, int * __restrict out, int areaX, int areaZ, int areaW
 
 void mapVoronoiZoom(Layer *l, int * __restrict out, int x, int z, int w, int h);
 
+/* Map functions specialised for the layers of setupGeneratorMC17() and
+ * setupGeneratorMC113(), by layer index. Each one calls the functions of its
+ * parents directly instead of through getMap, so the parent calls are fixed
+ * at compile time and the compiler can inline across the stack.
+ */
+#define PIPELINE_MC17_NUM   46
+#define PIPELINE_MC113_NUM  54
+extern void (*const pipelineMC17[PIPELINE_MC17_NUM])(Layer *l, int *out, int x, int z, int w, int h);
+extern void (*const pipelineMC113[PIPELINE_MC113_NUM])(Layer *l, int *out, int x, int z, int w, int h);
+
 #endif /* LAYER_H_ */
@@ -2,9 +2,15 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <signal.h>
+#include <time.h>
 #include "layers.h"
 #include "generator.h"
 #include "finders.h"
+#include "search.h"
+#include "output.h"
+#include "render.h"
+#include "server.h"
 
 #define OPTIMIZATION 1
 
@@ -15,12 +21,6 @@ static unsigned int str2int(const char *str, int h) {
 
 const char *versions[] = {"1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.13.2", "1.14", "1.15", "UNKNOWN"};
 
-int euclideanDistance(int x1, int y1, int x2, int y2) {
-    double dx = (x1 - x2);
-    double dy = (y1 - y2);
-    return (int) (dx * dx + dy * dy);
-}
-
 enum versions parse_version(char *s) {
     enum versions v;
     switch (str2int(s, 0)) {
@@ -78,14 +78,183 @@ char *inputString(FILE *fp, size_t size) {
 
     return realloc(str, sizeof(char) * len);
 }
+// Converts a search range in blocks to regions, the world border is as far as it goes
+static int toSearchRange(int64_t blocks) {
+    int64_t regions = blocks / 32 / 16;
+    if (regions > WORLD_SEARCH_RANGE) {
+        fprintf(stderr, "Search range clamped to the world border\n");
+        return WORLD_SEARCH_RANGE;
+    }
+    return (int) regions;
+}
+
+static void stopSearch(int sig) {
+    // a second signal kills the program as usual
+    signal(sig, SIG_DFL);
+    requestSearchStop();
+}
+
+static void stopServer(int sig) {
+    signal(sig, SIG_DFL);
+    requestServerStop();
+}
+
+static void printCluster(void *data, int huts, int x, int z) {
+    writeResult((ResultWriter *) data, huts, x, z);
+}
+
 void usage() {
-    printf("For command line use do ./WitchHutFinder [mcversion] [seed] [searchRange]? [filter]? \n"
+    printf("For command line use do ./WitchHutFinder [options] [mcversion] [seed] [searchRange]? [filter]? \n"
            "Valid [mcversion] are 1.7, 1.8, 1.9, 1.10, 1.11, 1.12, 1.13, 1.13.2, 1.14.\n"
            "Valid [searchRange] (optional) is in blocks, default is 150000 which correspond to -150000 to 150000 on both X and Z.\n"
-           "Valid [filter] (optional) is either 2, 3 or 4 for respectively only outputting double, triple or quad witch huts as minimum.\n");
+           "Valid [filter] (optional) is either 2, 3 or 4 for respectively only outputting double, triple or quad witch huts as minimum.\n"
+           "Options:\n"
+           "  --cpu=scalar|sse42|avx2|avx512  force the vector kernels to use, by default the best the CPU supports.\n"
+           "  --threads=N                     number of search threads, by default one per CPU.\n"
+           "  --stats=FILE                    write the counters and timings of the search stages as JSON, - for stdout.\n"
+           "  --progress[=FILE]               report the progress, throughput and ETA on stderr or as JSON status file.\n"
+           "  --progress-interval=SECONDS     time between two progress reports, default is 10.\n"
+           "  --checkpoint[=FILE]             save the progress to FILE, by default out.checkpoint, Ctrl-C saves and stops.\n"
+           "  --checkpoint-interval=SECONDS   time between two checkpoints, default is 60.\n"
+           "  --resume                        continue the search saved in the checkpoint.\n"
+           "  --output=FILE                   write the clusters to FILE instead of out.txt, - for stdout.\n"
+           "  --format=text|csv|ndjson|binary format of the output, default is text.\n"
+           "  --quiet                         do not print the clusters on the console.\n"
+           "  --order=raster|spiral|hilbert   scan west to east, outwards from the center reporting the nearest clusters first,\n"
+           "                                  or in square tiles along a Hilbert curve reporting the clusters sorted at the end.\n"
+           "  --center=X,Z                    center of the spiral search in blocks, default is 0,0.\n"
+           "  --limit=K                       stop the spiral search once the K nearest clusters are found.\n"
+           "  --full-world                    search the whole world up to the border at 30000000 blocks, whatever the range.\n"
+           "  --time-budget=MS                return the clusters found after MS milliseconds, the nearest blocks are searched first.\n"
+           "  --shard=i/N                     only search the part i (from 0) of N of the area, to spread a search over machines.\n"
+           "  --cache=DIR                     keep the generated biome tiles of the seed in DIR for the next runs, also for map.\n"
+           "  --cache-size=MB                 size limit of a new cache file, default is 1024, shared by the seeds of serve.\n"
+           "To combine the results of the shards use ./WitchHutFinder merge [output] [results]...\n"
+           "To draw a biome map use ./WitchHutFinder map [mcversion] [seed] [x] [z] [width] [height] [output.ppm|png]\n"
+           "  --scale=1|4|16|256              blocks per pixel of the map, default is 4.\n"
+           "  --clusters=FILE                 mark the cluster centres of a text result file.\n"
+           "  --no-huts                       do not mark the witch huts.\n"
+           "To answer queries on a Unix socket use ./WitchHutFinder serve [socket], see server.h for the requests\n"
+           "  --seeds=K                       seeds kept warm by the server, default is 16.\n"
+           "  --timeout=MS                    default deadline of a server request, none by default.\n");
+#ifdef LAYER_TRACE
+    printf("  --trace=FILE                    write the calls, cells and time of every layer as a table.\n"
+           "  --trace-folded=FILE             write the layer time per call path as folded stacks.\n");
+#endif
 
 }
 
+// Reads the centres of a text result file, returns NULL if it cannot be read
+static Pos *readCenters(const char *path, int *num) {
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    Pos *centers = NULL;
+    int n = 0, cap = 0, huts, x, z;
+    if (fp == NULL) {
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "CENTER for %d huts: %d,%d", &huts, &x, &z) != 3) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            centers = realloc(centers, cap * sizeof(*centers));
+        }
+        centers[n].x = x;
+        centers[n].z = z;
+        n++;
+    }
+    fclose(fp);
+    *num = n;
+    return centers ? centers : malloc(sizeof(*centers));
+}
+
+static int renderMap(int argc, char *argv[], int threads, int scale, int huts, const char *clustersPath,
+                     const char *cacheDir, int64_t cacheBytes) {
+    MapConfig config;
+    struct timespec start, end;
+    char *endptr;
+    if (argc < 9) {
+        usage();
+        return 1;
+    }
+    config.mcversion = parse_version(argv[2]);
+    if (config.mcversion == MC_LEG) {
+        usage();
+        return 1;
+    }
+    errno = 0;
+    config.seed = strtoll(argv[3], &endptr, 10);
+    if (errno != 0 || *endptr != '\0') {
+        fprintf(stderr, "Invalid seed %s\n", argv[3]);
+        return 1;
+    }
+    // everything is checked before the image file is created
+    long long area[4];
+    for (int i = 0; i < 4; i++) {
+        errno = 0;
+        area[i] = strtoll(argv[4 + i], &endptr, 10);
+        if (errno != 0 || *endptr != '\0' || area[i] < INT_MIN || area[i] > INT_MAX) {
+            fprintf(stderr, "Invalid %s %s\n", i < 2 ? "position" : "size", argv[4 + i]);
+            return 1;
+        }
+    }
+    if (area[2] <= 0 || area[3] <= 0) {
+        fprintf(stderr, "The map size should be positive\n");
+        return 1;
+    }
+    if (area[0] + area[2] > INT_MAX || area[1] + area[3] > INT_MAX) {
+        fprintf(stderr, "The map should end before block %d\n", INT_MAX);
+        return 1;
+    }
+    if (scale != 1 && scale != 4 && scale != 16 && scale != 256) {
+        fprintf(stderr, "Invalid scale %d, it should be 1, 4, 16 or 256\n", scale);
+        return 1;
+    }
+    config.x = (int) area[0];
+    config.z = (int) area[1];
+    config.width = (int) area[2];
+    config.height = (int) area[3];
+    config.scale = scale;
+    config.format = getMapFormat(argv[8]);
+    config.threads = threads;
+    config.huts = huts;
+    config.centers = NULL;
+    config.centerNum = 0;
+    config.cacheDir = cacheDir;
+    config.cacheBytes = cacheBytes;
+    Pos *centers = NULL;
+    if (clustersPath) {
+        centers = readCenters(clustersPath, &config.centerNum);
+        if (centers == NULL) {
+            fprintf(stderr, "Could not read %s\n", clustersPath);
+            return 1;
+        }
+        config.centers = centers;
+    }
+    FILE *fp = fopen(argv[8], "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", argv[8]);
+        free(centers);
+        return 1;
+    }
+    initBiomes();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t pixels = renderBiomeMap(fp, &config);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(fp);
+    free(centers);
+    if (pixels < 0) {
+        fprintf(stderr, "Could not render the map to %s\n", argv[8]);
+        remove(argv[8]);
+        return 1;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("Wrote %" PRId64 " pixels to %s in %.3f seconds (%.1f MP/s)\n", pixels, argv[8], seconds,
+           pixels / seconds * 1e-6);
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
     int mcversion = MC_1_12;
@@ -93,6 +262,195 @@ int main(int argc, char *argv[]) {
     int searchRange = 300;
     char *endptr;
     int OFFSET = 2;
+    int simdLevel = -1;
+    int threads = getCpuCount();
+    const char *statsPath = NULL;
+    const char *progressPath = NULL;
+    double progressInterval = 10;
+    const char *checkpointPath = NULL;
+    double checkpointInterval = 60;
+    int resume = 0;
+    int shard = 0, shardNum = 0;
+    const char *outputPath = "out.txt";
+    int outputFormat = OUTPUT_TEXT;
+    int quiet = 0;
+    int order = ORDER_RASTER;
+    int centerX = 0, centerZ = 0;
+    int limit = 0;
+    int orderSet = 0;
+    int centerSet = 0;
+    double timeBudget = 0;
+    int fullWorld = 0;
+    int mapScale = 4;
+    int mapHuts = 1;
+    const char *clustersPath = NULL;
+    const char *cacheDir = NULL;
+    int64_t cacheBytes = (int64_t) 1024 << 20;
+    int seedNum = 16;
+    double timeout = 0;
+#ifdef LAYER_TRACE
+    const char *tracePath = NULL;
+    const char *foldedPath = NULL;
+#endif
+    // Strip the options so that the positional arguments keep their index
+    int nargs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--cpu=", 6) == 0) {
+            simdLevel = parseSimdLevel(argv[i] + 6);
+            if (simdLevel < 0) {
+                fprintf(stderr, "Unknown cpu level %s, using the detected one\n", argv[i] + 6);
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = atoi(argv[i] + 10);
+            if (threads < 1) {
+                fprintf(stderr, "Invalid thread count %s, using one thread\n", argv[i] + 10);
+                threads = 1;
+            }
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            statsPath = argv[i] + 8;
+        } else if (strcmp(argv[i], "--progress") == 0) {
+            progressPath = "-";
+        } else if (strncmp(argv[i], "--progress=", 11) == 0) {
+            progressPath = argv[i] + 11;
+        } else if (strncmp(argv[i], "--progress-interval=", 20) == 0) {
+            progressInterval = atof(argv[i] + 20);
+        } else if (strcmp(argv[i], "--checkpoint") == 0) {
+            checkpointPath = "out.checkpoint";
+        } else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+            checkpointPath = argv[i] + 13;
+        } else if (strncmp(argv[i], "--checkpoint-interval=", 22) == 0) {
+            checkpointInterval = atof(argv[i] + 22);
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            outputPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--format=", 9) == 0) {
+            outputFormat = parseOutputFormat(argv[i] + 9);
+            if (outputFormat < 0) {
+                fprintf(stderr, "Unknown output format %s, it should be text, csv, ndjson or binary\n", argv[i] + 9);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        } else if (strncmp(argv[i], "--order=", 8) == 0) {
+            if (strcmp(argv[i] + 8, "raster") == 0) {
+                order = ORDER_RASTER;
+            } else if (strcmp(argv[i] + 8, "spiral") == 0) {
+                order = ORDER_SPIRAL;
+            } else if (strcmp(argv[i] + 8, "hilbert") == 0) {
+                order = ORDER_HILBERT;
+            } else {
+                fprintf(stderr, "Unknown order %s, it should be raster, spiral or hilbert\n", argv[i] + 8);
+                return 1;
+            }
+            orderSet = 1;
+        } else if (strncmp(argv[i], "--center=", 9) == 0) {
+            if (sscanf(argv[i] + 9, "%d,%d", &centerX, &centerZ) != 2) {
+                fprintf(stderr, "Invalid center %s, it should be X,Z\n", argv[i] + 9);
+                return 1;
+            }
+            centerSet = 1;
+        } else if (strncmp(argv[i], "--limit=", 8) == 0) {
+            limit = atoi(argv[i] + 8);
+            if (limit < 1) {
+                fprintf(stderr, "Invalid limit %s\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--full-world") == 0) {
+            fullWorld = 1;
+        } else if (strncmp(argv[i], "--time-budget=", 14) == 0) {
+            timeBudget = atof(argv[i] + 14) / 1000;
+            if (timeBudget <= 0) {
+                fprintf(stderr, "Invalid time budget %s\n", argv[i] + 14);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            if (sscanf(argv[i] + 8, "%d/%d", &shard, &shardNum) != 2 || shardNum < 1 || shard < 0 || shard >= shardNum) {
+                fprintf(stderr, "Invalid shard %s, it should be i/N with 0 <= i < N\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            mapScale = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--clusters=", 11) == 0) {
+            clustersPath = argv[i] + 11;
+        } else if (strcmp(argv[i], "--no-huts") == 0) {
+            mapHuts = 0;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cacheDir = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cacheBytes = (int64_t) (atof(argv[i] + 13) * (1 << 20));
+        } else if (strncmp(argv[i], "--seeds=", 8) == 0) {
+            seedNum = atoi(argv[i] + 8);
+            if (seedNum < 1) {
+                fprintf(stderr, "Invalid seed count %s\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            timeout = atof(argv[i] + 10) / 1000;
+#ifdef LAYER_TRACE
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            tracePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--trace-folded=", 15) == 0) {
+            foldedPath = argv[i] + 15;
+#endif
+        } else {
+            argv[nargs++] = argv[i];
+        }
+    }
+    argc = nargs;
+    if ((centerSet || limit) && orderSet && order != ORDER_SPIRAL) {
+        fprintf(stderr, "--center and --limit only apply to --order=spiral\n");
+        return 1;
+    }
+    if ((centerSet || limit) && !orderSet) {
+        order = ORDER_SPIRAL;
+    }
+    if (timeBudget > 0 && !orderSet) {
+        // nearest first gives the most useful answer in a fixed time
+        order = ORDER_SPIRAL;
+    }
+    if (limit && shardNum > 1) {
+        fprintf(stderr, "--limit needs the whole area, it cannot be used with --shard\n");
+        return 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        if (argc < 4) {
+            usage();
+            return 1;
+        }
+        FILE *out = fopen(argv[2], "w");
+        if (out == NULL) {
+            fprintf(stderr, "Could not open %s\n", argv[2]);
+            return 1;
+        }
+        int merged = mergeResults(out, (const char **) argv + 3, argc - 3);
+        fclose(out);
+        if (merged < 0) {
+            return 1;
+        }
+        printf("Merged %d clusters into %s\n", merged, argv[2]);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        if (argc < 3) {
+            usage();
+            return 1;
+        }
+        ServerConfig serverConfig = {argv[2], threads, seedNum, cacheDir, cacheBytes, timeout};
+        initBiomes();
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+        printf("Serving on %s with %d threads\n", argv[2], threads);
+        fflush(stdout);
+        if (runServer(&serverConfig) != 0) {
+            fprintf(stderr, "Could not listen on %s\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "map") == 0) {
+        return renderMap(argc, argv, threads, mapScale, mapHuts, clustersPath, cacheDir, cacheBytes);
+    }
     // Get the information to start the program
     if (argc > 2) {
         mcversion = parse_version(argv[1]);
@@ -111,7 +469,7 @@ int main(int argc, char *argv[]) {
         }
         if (argc > 3) {
             errno = 0;
-            searchRange = (int) (strtoll(argv[3], &endptr, 10) / 32 / 16);
+            searchRange = toSearchRange(strtoll(argv[3], &endptr, 10));
             if ((errno == ERANGE && (searchRange == INT_MAX || searchRange == INT_MIN)) || (errno != 0 && searchRange == 0)) {
                 fprintf(stderr, "Search Range was not parsed correctly\n");
                 usage();
@@ -168,7 +526,7 @@ int main(int argc, char *argv[]) {
         printf("Please input the search range you want to use (in blocks), this will search a square of this size\n");
         res = inputString(stdin, 20);
         errno = 0;
-        searchRange = (int) (strtoll(res, &endptr, 10) / 32 / 16);
+        searchRange = toSearchRange(strtoll(res, &endptr, 10));
         if ((errno == ERANGE && (searchRange == INT_MAX || searchRange == INT_MIN)) || (errno != 0 && searchRange == 0)) {
             fprintf(stderr, "Search Range was not parsed correctly\n");
             usage();
@@ -200,131 +558,78 @@ int main(int argc, char *argv[]) {
 
     }
 
-    OFFSET = OFFSET - 4;
-    printf("Using seed %ld and version %s\n", seed, versions[mcversion]);
+    if (fullWorld) {
+        searchRange = WORLD_SEARCH_RANGE;
+    }
+    // the status lines must not mix with the results on stdout
+    FILE *info = strcmp(outputPath, "-") == 0 ? stderr : stdout;
+    fprintf(info, "Using seed %ld and version %s\n", seed, versions[mcversion]);
     // Basic initialization
-    StructureConfig featureConfig;
-    initBiomes();
-    LayerStack g;
-    Pos qhpos[4];
-    if (mcversion >= MC_1_13) {
-        featureConfig = SWAMP_HUT_CONFIG;
-        g = setupGeneratorMC113();
-    } else {
-        featureConfig = FEATURE_CONFIG;
-        g = setupGeneratorMC17();
+    if (simdLevel >= 0) {
+        setSimdLevel(simdLevel);
     }
-    clock_t before = clock();
-    int results[3] = {0, 0, 0};
+    initBiomes();
+    fprintf(info, "Using %s kernels\n", simdLevelName(getSimdLevel()));
     assert(seed != NULL);
 
-    Layer layerBiomeDummy;
-    setupLayer(256, &layerBiomeDummy, NULL, 200, NULL);
-    setWorldSeed(&layerBiomeDummy, seed);
-    FILE *fp;
-
-    fp = fopen("out.txt", "w+");
-    fprintf(fp, "Using seed %ld and version %s\n", seed, versions[mcversion]);
-    for (int regPosX = -searchRange; regPosX < searchRange; ++regPosX) {
-        for (int regPosZ = -searchRange; regPosZ < searchRange; ++regPosZ) {
-            int skipTest = 0;
-            qhpos[0] = getStructurePos(featureConfig, seed, 0 + regPosX, 0 + regPosZ);
-            qhpos[1] = getStructurePos(featureConfig, seed, 0 + regPosX, 1 + regPosZ);
-            if (euclideanDistance(qhpos[0].x, qhpos[0].z, qhpos[1].x, qhpos[1].z) < 65536) {
-                skipTest = 1;
-            }
-            qhpos[2] = getStructurePos(featureConfig, seed, 1 + regPosX, 0 + regPosZ);
-            if (skipTest || euclideanDistance(qhpos[0].x, qhpos[0].z, qhpos[2].x, qhpos[2].z) < 65536 || euclideanDistance(qhpos[1].x, qhpos[1].z, qhpos[2].x, qhpos[2].z) < 65536) {
-                skipTest = 1;
-            }
-            qhpos[3] = getStructurePos(featureConfig, seed, 1 + regPosX, 1 + regPosZ);
-            if (skipTest || euclideanDistance(qhpos[0].x, qhpos[0].z, qhpos[3].x, qhpos[3].z) < 65536 || euclideanDistance(qhpos[1].x, qhpos[1].z, qhpos[3].x, qhpos[3].z) < 65536
-                || euclideanDistance(qhpos[2].x, qhpos[2].z, qhpos[3].x, qhpos[3].z) < 65536) {
-                skipTest = 1;
-            }
-            if (!skipTest) {
-                continue;
-            }
-            int areaX = (int) ((unsigned int) regPosX << 1u) + 1;
-            int areaZ = (int) ((unsigned int) regPosZ << 1u) + 1;
-            //printf("(%d,%d) (%d,%d) (%d,%d) (%d,%d)\n",qhpos[0].x,qhpos[0].z,qhpos[1].x,qhpos[1].z,qhpos[2].x,qhpos[2].z,qhpos[3].x,qhpos[3].z);
-            if (OPTIMIZATION) {
-                int swpc = 0;
-                setChunkSeed(&layerBiomeDummy, areaX + 1, areaZ + 1);
-                swpc += mcNextInt(&layerBiomeDummy, 6) == 5;
-                setChunkSeed(&layerBiomeDummy, areaX, areaZ + 1);
-                swpc += mcNextInt(&layerBiomeDummy, 6) == 5;
-                setChunkSeed(&layerBiomeDummy, areaX + 1, areaZ);
-                swpc += mcNextInt(&layerBiomeDummy, 6) == 5;
-                setChunkSeed(&layerBiomeDummy, areaX, areaZ);
-                swpc += mcNextInt(&layerBiomeDummy, 6) == 5;
-                if (swpc < OFFSET + 4) {
-                    continue;
-                }
-            }
-            int count = 0;
-            applySeed(&g, seed);
-            int correctPos[4] = {-1, -1, -1, -1};
-            if (getBiomeAtPos(g, qhpos[0]) == swampland) {
-                correctPos[count++] = 0;
-            } else {
-                if (count <= 0 + OFFSET) {
-                    continue;
-                }
-            }
-            if (getBiomeAtPos(g, qhpos[1]) == swampland) {
-                correctPos[count++] = 1;
-            } else {
-                if (count <= 1 + OFFSET) {
-                    continue;
-                }
-            }
-            if (getBiomeAtPos(g, qhpos[2]) == swampland) {
-                correctPos[count++] = 2;
-            } else {
-                if (count <= 2 + OFFSET) {
-                    continue;
-                }
-            }
-            if (getBiomeAtPos(g, qhpos[3]) == swampland) {
-                correctPos[count++] = 3;
-            } else {
-                if (count <= 3 + OFFSET) {
-                    continue;
-                }
-            }
-            assert(count >= 4 + OFFSET);
-            if (count >= 4 + OFFSET) {
-                for (int j = 0; j < count - 1; ++j) {
-                    int maxi = count - j;
-                    int x = 0;
-                    int z = 0;
-                    for (int i = 0; i < maxi; ++i) {
-                        x += qhpos[correctPos[i]].x;
-                        z += qhpos[correctPos[i]].z;
-                    }
-                    x = (int) (x / (double) maxi);
-                    z = (int) (z / (double) maxi);
-                    int valid = 1;
-                    for (int i = 0; i < maxi; ++i) {
-                        if (euclideanDistance(qhpos[correctPos[i]].x, qhpos[correctPos[i]].z, x, z) > 16384)
-                            valid = 0;
-                    }
-                    if (valid && maxi >= OFFSET + 4) {
-                        printf("CENTER for %d huts: %d,%d\n", maxi, x, z);
-                        fprintf(fp, "CENTER for %d huts: %d,%d\n", maxi, x, z);
-                        results[maxi - 2]++;
-                    }
-                }
-            }
+    ResultWriter *writer = openResultWriter(outputPath, outputFormat, !quiet, seed, mcversion, versions[mcversion]);
+    if (writer == NULL) {
+        fprintf(stderr, "Could not open %s\n", outputPath);
+        return 1;
+    }
+    if (resume && !checkpointPath) {
+        checkpointPath = "out.checkpoint";
+    }
+    if (checkpointPath) {
+        signal(SIGINT, stopSearch);
+        signal(SIGTERM, stopSearch);
+    }
+    SearchConfig config = {mcversion, seed, searchRange, OFFSET, OPTIMIZATION, threads, progressPath, progressInterval,
+                           checkpointPath, checkpointInterval, resume, shard, shardNum, order, centerX, centerZ, limit,
+                           timeBudget, cacheDir, cacheBytes};
+    SearchStats stats;
+    int status = searchQuadHuts(&config, printCluster, writer, &stats);
+    closeResultWriter(writer);
+    if (status < 0) {
+        return 1;
+    }
+    int results[3] = {(int) stats.clusters[0], (int) stats.clusters[1], (int) stats.clusters[2]};
+    if (statsPath) {
+        FILE *statsFile = strcmp(statsPath, "-") == 0 ? info : fopen(statsPath, "w");
+        if (statsFile) {
+            writeSearchReport(statsFile, versions[mcversion], &config, &stats);
+            if (statsFile != info) fclose(statsFile);
+        } else {
+            fprintf(stderr, "Could not open %s\n", statsPath);
         }
     }
-    fclose(fp);
-    clock_t difference = clock() - before;
-    unsigned long msec = difference * 1000 / CLOCKS_PER_SEC;
-    printf("Found %d double witch huts, %d triple witch huts, %d quad witch huts, the results are in out.txt\n", results[0], results[1], results[2]);
-    if (OPTIMIZATION) printf("Warning, it is possible to have some wrongfully double witch hut, this is due to an optimization\n");
-    printf("Took %lu seconds %lu milliseconds for search range %d on seed %ld with generator %s\n", msec / 1000, msec % 1000, searchRange * 32 * 16, seed, versions[mcversion]);
-    printf("Press any key to exit\n");
+#ifdef LAYER_TRACE
+    FILE *traceFile;
+    if (tracePath && (traceFile = fopen(tracePath, "w"))) {
+        printLayerTrace(traceFile);
+        fclose(traceFile);
+    }
+    if (foldedPath && (traceFile = fopen(foldedPath, "w"))) {
+        printLayerTraceFolded(traceFile);
+        fclose(traceFile);
+    }
+#endif
+    unsigned long msec = (unsigned long) (stats.wall * 1000);
+    if (status == 2) {
+        fprintf(info, "Time budget used up after searching %.3f%% of the area (%" PRId64 " of %" PRId64 " region blocks)",
+               100.0 * stats.regions / stats.areaRegions, stats.regions, stats.areaRegions);
+        if (order == ORDER_SPIRAL) {
+            fprintf(info, ", every cluster within %" PRId64 " blocks of the center is listed", stats.exactRadius);
+        }
+        fprintf(info, "\n");
+    } else if (status > 0) {
+        fprintf(info, "Search stopped after %d of %d tiles, continue it with --resume\n", stats.tilesDone, stats.tiles);
+    }
+    fprintf(info, "Found %d double witch huts, %d triple witch huts, %d quad witch huts, the results are in %s\n", results[0], results[1], results[2],
+           strcmp(outputPath, "-") == 0 ? "stdout" : outputPath);
+    if (OPTIMIZATION) fprintf(info, "Warning, it is possible to have some wrongfully double witch hut, this is due to an optimization\n");
+    fprintf(info, "Took %lu seconds %lu milliseconds for search range %d on seed %ld with generator %s\n", msec / 1000, msec % 1000, searchRange * 32 * 16, seed, versions[mcversion]);
+    fprintf(info, "Used %.3f seconds of CPU time on %d threads\n", stats.cpu, stats.threads);
+    fprintf(info, "Press any key to exit\n");
     inputString(stdin,20);
 }
\ No newline at end of file
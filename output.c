@@ -0,0 +1,218 @@
+#include "output.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_SIZE  4096            // clusters, a power of two
+#define BATCH_SIZE  (64 * 1024)     // bytes formatted before a write
+
+
+STRUCT(ClusterRecord)
+{
+    int huts, x, z;
+};
+
+/* Single producer, single consumer ring: the producer only moves 'head' and
+ * the writer thread only moves 'tail', each on its own cache line.
+ */
+struct ResultWriter
+{
+    ClusterRecord queue[QUEUE_SIZE];
+    uint64_t head;
+    char pad0[64];
+    uint64_t tail;
+    char pad1[64];
+    int closing;
+    int waiting;            // the writer is about to wait or waits on 'cond'
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    // a cluster was queued or the writer is closed
+
+    FILE *fp;
+    int format, echo;
+    int64_t seed;
+    int mcversion;
+    const char *version;
+    pthread_t thread;
+};
+
+static const char *formatNames[OUTPUT_NUM] = {"text", "csv", "ndjson", "binary"};
+
+int parseOutputFormat(const char *name)
+{
+    int i;
+    for (i = 0; i < OUTPUT_NUM; i++)
+    {
+        if (strcmp(name, formatNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static char *putLE(char *p, uint64_t v, int bytes)
+{
+    int i;
+    for (i = 0; i < bytes; i++)
+        *p++ = (char) (v >> (8 * i));
+    return p;
+}
+
+/* Formats one cluster at 'p' in 'format' and returns the end. */
+static char *formatResult(const ResultWriter *w, int format, char *p, const ClusterRecord *r)
+{
+    switch (format)
+    {
+    case OUTPUT_CSV:
+        return p + sprintf(p, "%" PRId64 ",%s,%d,%d,%d\n", w->seed, w->version, r->huts, r->x, r->z);
+    case OUTPUT_NDJSON:
+        return p + sprintf(p, "{\"seed\":%" PRId64 ",\"version\":\"%s\",\"huts\":%d,\"x\":%d,\"z\":%d}\n",
+                w->seed, w->version, r->huts, r->x, r->z);
+    case OUTPUT_BINARY:
+        p = putLE(p, r->huts, 1);
+        p = putLE(p, (uint32_t) r->x, 4);
+        return putLE(p, (uint32_t) r->z, 4);
+    default:
+        return p + sprintf(p, "CENTER for %d huts: %d,%d\n", r->huts, r->x, r->z);
+    }
+}
+
+static void writeHeader(ResultWriter *w)
+{
+    char buf[32], *p;
+
+    switch (w->format)
+    {
+    case OUTPUT_CSV:
+        fprintf(w->fp, "seed,version,huts,x,z\n");
+        break;
+    case OUTPUT_NDJSON:
+        break;
+    case OUTPUT_BINARY:
+        p = buf;
+        memcpy(p, OUTPUT_BINARY_MAGIC, 4);
+        p = putLE(p + 4, (uint64_t) w->seed, 8);
+        p = putLE(p, (uint32_t) w->mcversion, 4);
+        fwrite(buf, 1, p - buf, w->fp);
+        break;
+    default:
+        fprintf(w->fp, "Using seed %" PRId64 " and version %s\n", w->seed, w->version);
+        break;
+    }
+}
+
+static void *writerThread(void *arg)
+{
+    ResultWriter *w = (ResultWriter *) arg;
+    char *buf = (char *) malloc(BATCH_SIZE + 256);
+    char *echo = w->echo ? (char *) malloc(BATCH_SIZE + 256) : NULL;
+    uint64_t tail = w->tail, head;
+
+    for (;;)
+    {
+        head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            if (__atomic_load_n(&w->closing, __ATOMIC_ACQUIRE))
+            {
+                // the producer is done, but may have pushed before closing
+                if (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == tail)
+                    break;
+                continue;
+            }
+            fflush(w->fp);
+            // the producer signals if it sees 'waiting', or the new head is
+            // seen here before waiting
+            pthread_mutex_lock(&w->lock);
+            __atomic_store_n(&w->waiting, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) == tail &&
+                   !__atomic_load_n(&w->closing, __ATOMIC_SEQ_CST))
+                pthread_cond_wait(&w->cond, &w->lock);
+            __atomic_store_n(&w->waiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&w->lock);
+            continue;
+        }
+
+        char *p = buf, *e = echo;
+        while (tail != head && p - buf < BATCH_SIZE)
+        {
+            const ClusterRecord *r = &w->queue[tail & (QUEUE_SIZE - 1)];
+            p = formatResult(w, w->format, p, r);
+            if (e)
+                e = formatResult(w, OUTPUT_TEXT, e, r);
+            tail++;
+        }
+        __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+
+        fwrite(buf, 1, p - buf, w->fp);
+        if (e)
+            fwrite(echo, 1, e - echo, stdout);
+    }
+
+    free(echo);
+    free(buf);
+    return NULL;
+}
+
+static void wakeWriter(ResultWriter *w)
+{
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+ResultWriter *openResultWriter(const char *path, int format, int echo,
+        int64_t seed, int mcversion, const char *version)
+{
+    ResultWriter *w = (ResultWriter *) calloc(1, sizeof(*w));
+    int toStdout = strcmp(path, "-") == 0;
+
+    w->fp = toStdout ? stdout : fopen(path, format == OUTPUT_BINARY ? "wb" : "w");
+    if (w->fp == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+    w->format = format;
+    // the clusters are already on stdout
+    w->echo = echo && !toStdout;
+    w->seed = seed;
+    w->mcversion = mcversion;
+    w->version = version;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    writeHeader(w);
+    pthread_create(&w->thread, NULL, writerThread, w);
+    return w;
+}
+
+void writeResult(ResultWriter *w, int huts, int x, int z)
+{
+    uint64_t head = w->head;
+    ClusterRecord *r;
+
+    while (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == QUEUE_SIZE)
+        sched_yield();
+
+    r = &w->queue[head & (QUEUE_SIZE - 1)];
+    r->huts = huts;
+    r->x = x;
+    r->z = z;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->waiting, __ATOMIC_SEQ_CST))
+        wakeWriter(w);
+}
+
+void closeResultWriter(ResultWriter *w)
+{
+    __atomic_store_n(&w->closing, 1, __ATOMIC_SEQ_CST);
+    wakeWriter(w);
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    fflush(w->fp);
+    if (w->fp != stdout)
+        fclose(w->fp);
+    free(w);
+}
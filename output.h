@@ -0,0 +1,44 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include "layers.h"
+
+#include <stdio.h>
+
+enum OutputFormat
+{
+    OUTPUT_TEXT,    // "CENTER for 2 huts: x,z" lines, the historic out.txt
+    OUTPUT_CSV,     // seed,version,huts,x,z
+    OUTPUT_NDJSON,  // one JSON object per line
+    OUTPUT_BINARY,  // header followed by 9 byte little endian records
+    OUTPUT_NUM
+};
+
+/* The binary format starts with the magic "WHF1", the int64 seed and the
+ * int32 mcversion, then every cluster is an uint8 hut count and the int32 x
+ * and z of its centre, all little endian.
+ */
+#define OUTPUT_BINARY_MAGIC "WHF1"
+
+typedef struct ResultWriter ResultWriter;
+
+/* Starts a writer thread for the results of a search. 'path' is a file, "-"
+ * for stdout. With 'echo' the clusters are printed on stdout as well, in the
+ * text format. Returns NULL if the file cannot be opened.
+ */
+ResultWriter *openResultWriter(const char *path, int format, int echo,
+        int64_t seed, int mcversion, const char *version);
+
+/* Queues a cluster for the writer thread, it only blocks when the queue is
+ * full. The calls have to be serialised, e.g. by the ClusterCallback of the
+ * search, but may come from any thread.
+ */
+void writeResult(ResultWriter *w, int huts, int x, int z);
+
+/* Writes the queued clusters, stops the writer thread and closes the file. */
+void closeResultWriter(ResultWriter *w);
+
+/* Returns the OutputFormat for a name (text, csv, ndjson, binary) or -1. */
+int parseOutputFormat(const char *name);
+
+#endif /* OUTPUT_H_ */
@@ -0,0 +1,384 @@
+#include "render.h"
+#include "generator.h"
+#include "tilecache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MARKER_HUT      2   // half size in pixels of the hut squares
+#define MARKER_CENTER   6   // arm length in pixels of the centre crosses
+#define STORED_BLOCK    65535
+#define CACHE_TILE_SIDE 256 // cells per side of the cached tiles
+
+
+/* The usual biome map colours, the mutated biomes are brightened copies. */
+static unsigned char biomeColors[256][3] =
+{
+    [ocean]                 = {  0,   0, 112},
+    [plains]                = {141, 179,  96},
+    [desert]                = {250, 148,  24},
+    [extremeHills]          = { 96,  96,  96},
+    [forest]                = {  5, 102,  33},
+    [taiga]                 = { 11, 102,  89},
+    [swampland]             = {  7, 249, 178},
+    [river]                 = {  0,   0, 255},
+    [hell]                  = {255,   0,   0},
+    [sky]                   = {128, 128, 255},
+    [frozenOcean]           = {112, 112, 214},
+    [frozenRiver]           = {160, 160, 255},
+    [icePlains]             = {255, 255, 255},
+    [iceMountains]          = {160, 160, 160},
+    [mushroomIsland]        = {255,   0, 255},
+    [mushroomIslandShore]   = {160,   0, 255},
+    [beach]                 = {250, 222,  85},
+    [desertHills]           = {210,  95,  18},
+    [forestHills]           = { 34,  85,  28},
+    [taigaHills]            = { 22,  57,  51},
+    [extremeHillsEdge]      = {114, 120, 154},
+    [jungle]                = { 83, 123,   9},
+    [jungleHills]           = { 44,  66,   5},
+    [jungleEdge]            = { 98, 139,  23},
+    [deepOcean]             = {  0,   0,  48},
+    [stoneBeach]            = {162, 162, 132},
+    [coldBeach]             = {250, 240, 192},
+    [birchForest]           = { 48, 116,  68},
+    [birchForestHills]      = { 31,  95,  50},
+    [roofedForest]          = { 64,  81,  26},
+    [coldTaiga]             = { 49,  85,  74},
+    [coldTaigaHills]        = { 36,  63,  54},
+    [megaTaiga]             = { 89, 102,  81},
+    [megaTaigaHills]        = { 69,  79,  62},
+    [extremeHillsPlus]      = { 80, 112,  80},
+    [savanna]               = {189, 178,  95},
+    [savannaPlateau]        = {167, 157, 100},
+    [mesa]                  = {217,  69,  21},
+    [mesaPlateau_F]         = {176, 151, 101},
+    [mesaPlateau]           = {202, 140, 101},
+    [skyIslandLow]          = {128, 128, 255},
+    [skyIslandMedium]       = {128, 128, 255},
+    [skyIslandHigh]         = {128, 128, 255},
+    [skyIslandBarren]       = {128, 128, 255},
+    [warmOcean]             = {  0,   0, 172},
+    [lukewarmOcean]         = {  0,   0, 144},
+    [coldOcean]             = { 32,  32, 112},
+    [warmDeepOcean]         = {  0,   0,  80},
+    [lukewarmDeepOcean]     = {  0,   0,  64},
+    [coldDeepOcean]         = { 32,  32,  56},
+    [frozenDeepOcean]       = { 64,  64, 144},
+};
+
+static uint32_t crcTable[256];
+
+static void initTables(void)
+{
+    uint32_t c;
+    int i, k;
+
+    if (crcTable[1])
+        return;
+    for (i = 0; i < 128; i++)
+    {
+        if (!biomeExists(i + 128))
+            continue;
+        for (k = 0; k < 3; k++)
+        {
+            int v = biomeColors[i][k] + 40;
+            biomeColors[i + 128][k] = v > 255 ? 255 : v;
+        }
+    }
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crcTable[i] = c;
+    }
+}
+
+static uint32_t updateCrc(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len--)
+        crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void putBE32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void writeChunk(FILE *fp, const char *type, const unsigned char *data, size_t len)
+{
+    unsigned char buf[4];
+    uint32_t crc;
+
+    putBE32(buf, (uint32_t) len);
+    fwrite(buf, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    if (len)
+        fwrite(data, 1, len, fp);
+    crc = updateCrc(0xffffffffu, (const unsigned char *) type, 4);
+    if (len)
+        crc = updateCrc(crc, data, len);
+    putBE32(buf, crc ^ 0xffffffffu);
+    fwrite(buf, 1, 4, fp);
+}
+
+static int floorDiv(int64_t a, int b)
+{
+    return (int) (a >= 0 ? a / b : -((-a + b - 1) / b));
+}
+
+static int getScaleLayer(const LayerStack *g, int scale)
+{
+    switch (scale)
+    {
+    case 1:   return g->layerNum - 1;
+    case 4:   return g->layerNum - 2;
+    case 16:  return L_SHORE_16;
+    case 256: return L_BIOME_256;
+    default:  return -1;
+    }
+}
+
+/* Positions of the witch huts of the area that are in a swamp. */
+static Pos *findHuts(const MapConfig *config, LayerStack *g, int *num)
+{
+    const StructureConfig sconf = config->mcversion >= MC_1_13 ? SWAMP_HUT_CONFIG : FEATURE_CONFIG;
+    const int regionBlocks = sconf.regionSize * 16;
+    int x0 = floorDiv(config->x, regionBlocks), x1 = floorDiv((int64_t) config->x + config->width - 1, regionBlocks);
+    int z0 = floorDiv(config->z, regionBlocks), z1 = floorDiv((int64_t) config->z + config->height - 1, regionBlocks);
+    Pos *huts = NULL;
+    int n = 0, cap = 0, x, z;
+
+    for (x = x0; x <= x1; x++)
+    {
+        for (z = z0; z <= z1; z++)
+        {
+            Pos p = getStructurePos(sconf, config->seed, x, z);
+            if (p.x < config->x || p.x >= (int64_t) config->x + config->width ||
+                p.z < config->z || p.z >= (int64_t) config->z + config->height)
+                continue;
+            if (getBiomeAtPos(*g, p) != swampland)
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? 2 * cap : 64;
+                huts = (Pos *) realloc(huts, cap * sizeof(*huts));
+            }
+            huts[n++] = p;
+        }
+    }
+    *num = n;
+    return huts;
+}
+
+static void setPixel(unsigned char *rows, size_t stride, int width, int z0, int z1,
+        int x, int z, const unsigned char *rgb)
+{
+    if (x < 0 || x >= width || z < z0 || z >= z1)
+        return;
+    memcpy(rows + (z - z0) * stride + 3 * (size_t) x, rgb, 3);
+}
+
+/* Draws the parts of the markers that fall on the pixel rows z0 to z1. */
+static void drawMarkers(const MapConfig *config, const Pos *huts, int hutNum, int px0, int pz0,
+        int width, unsigned char *rows, size_t stride, int z0, int z1)
+{
+    static const unsigned char black[3] = {0, 0, 0}, white[3] = {255, 255, 255}, red[3] = {255, 0, 0};
+    int i, dx, dz;
+
+    for (i = 0; i < hutNum; i++)
+    {
+        int x = floorDiv(huts[i].x, config->scale) - px0;
+        int z = floorDiv(huts[i].z, config->scale) - pz0;
+        if (z + MARKER_HUT < z0 || z - MARKER_HUT >= z1)
+            continue;
+        for (dz = -MARKER_HUT; dz <= MARKER_HUT; dz++)
+        {
+            for (dx = -MARKER_HUT; dx <= MARKER_HUT; dx++)
+            {
+                int edge = dx == -MARKER_HUT || dx == MARKER_HUT || dz == -MARKER_HUT || dz == MARKER_HUT;
+                setPixel(rows, stride, width, z0, z1, x + dx, z + dz, edge ? black : white);
+            }
+        }
+    }
+    for (i = 0; i < config->centerNum; i++)
+    {
+        int x = floorDiv(config->centers[i].x, config->scale) - px0;
+        int z = floorDiv(config->centers[i].z, config->scale) - pz0;
+        if (z + MARKER_CENTER < z0 || z - MARKER_CENTER >= z1)
+            continue;
+        for (dx = -MARKER_CENTER; dx <= MARKER_CENTER; dx++)
+        {
+            setPixel(rows, stride, width, z0, z1, x + dx, z, red);
+            setPixel(rows, stride, width, z0, z1, x, z + dx, red);
+        }
+    }
+}
+
+int64_t renderBiomeMap(FILE *fp, const MapConfig *config)
+{
+    LayerStack g = setupGenerator(config->mcversion);
+    int layerId = getScaleLayer(&g, config->scale);
+    int px0, pz0, width, height, bandRows, z, i;
+    size_t stride, bandBytes;
+    unsigned char *rows, *stored = NULL;
+    uint8_t *ids;
+    int *cells = NULL;
+    TileCache *cache = NULL;
+    Pos *huts = NULL;
+    int hutNum = 0;
+    uint32_t adlerA = 1, adlerB = 0;
+    int64_t rawLeft;
+
+    if (layerId < 0 || config->width <= 0 || config->height <= 0)
+    {
+        freeGenerator(g);
+        return -1;
+    }
+    initTables();
+    applySeed(&g, config->seed);
+    if (config->huts)
+        huts = findHuts(config, &g, &hutNum);
+
+    px0 = floorDiv(config->x, config->scale);
+    pz0 = floorDiv(config->z, config->scale);
+    width = floorDiv((int64_t) config->x + config->width + config->scale - 1, config->scale) - px0;
+    height = floorDiv((int64_t) config->z + config->height + config->scale - 1, config->scale) - pz0;
+
+    // enough rows for two tiles per thread
+    bandRows = (config->threads > 1 ? config->threads : 1) * 2 * GEN_TILE_CELLS / width;
+    if (bandRows < 1)
+        bandRows = 1;
+    if (bandRows > height)
+        bandRows = height;
+
+    // the PNG rows start with their filter type
+    stride = 3 * (size_t) width + (config->format == MAP_PNG);
+    ids = (uint8_t *) malloc((size_t) width * bandRows);
+    if (config->cacheDir)
+    {
+        cache = openTileCache(config->cacheDir, config->seed, config->mcversion, layerId,
+                CACHE_TILE_SIDE, config->cacheBytes);
+        if (cache)
+            cells = (int *) malloc((size_t) width * bandRows * sizeof(int));
+    }
+    rows = (unsigned char *) malloc(stride * bandRows);
+    rawLeft = (int64_t) stride * height;
+
+    if (config->format == MAP_PNG)
+    {
+        unsigned char ihdr[13];
+        fwrite("\x89PNG\r\n\x1a\n", 1, 8, fp);
+        putBE32(ihdr, width);
+        putBE32(ihdr + 4, height);
+        ihdr[8] = 8;    // bits per channel
+        ihdr[9] = 2;    // RGB
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        writeChunk(fp, "IHDR", ihdr, sizeof(ihdr));
+        bandBytes = stride * bandRows;
+        stored = (unsigned char *) malloc(2 + bandBytes + 5 * (bandBytes / STORED_BLOCK + 1) + 4);
+    }
+    else
+    {
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    }
+
+    for (z = 0; z < height; z += bandRows)
+    {
+        int h = height - z < bandRows ? height - z : bandRows;
+        int j;
+
+        if (cache)
+        {
+            size_t k, n = (size_t) width * h;
+            genAreaCached(cache, &g, cells, px0, pz0 + z, width, h);
+            for (k = 0; k < n; k++)
+                ids[k] = (uint8_t) cells[k];
+        }
+        else
+        {
+            genArea8(&g.layers[layerId], ids, px0, pz0 + z, width, h, config->threads);
+        }
+        for (j = 0; j < h; j++)
+        {
+            unsigned char *row = rows + j * stride;
+            const uint8_t *src = ids + (size_t) j * width;
+            if (config->format == MAP_PNG)
+                *row++ = 0;
+            for (i = 0; i < width; i++, row += 3)
+                memcpy(row, biomeColors[src[i]], 3);
+        }
+        drawMarkers(config, huts, hutNum, px0, pz0, width, rows + (config->format == MAP_PNG),
+                stride, z, z + h);
+
+        if (config->format == MAP_PNG)
+        {
+            // stored deflate blocks, the zlib header goes first and the
+            // Adler-32 of the raw rows last
+            unsigned char *p = stored;
+            size_t len = stride * h, k;
+
+            if (z == 0)
+            {
+                *p++ = 0x78;
+                *p++ = 0x01;
+            }
+            for (k = 0; k < len; k += STORED_BLOCK)
+            {
+                size_t n = len - k < STORED_BLOCK ? len - k : STORED_BLOCK;
+                size_t m;
+                rawLeft -= n;
+                *p++ = rawLeft == 0;
+                *p++ = n & 0xff;
+                *p++ = n >> 8;
+                *p++ = ~n & 0xff;
+                *p++ = (~n >> 8) & 0xff;
+                memcpy(p, rows + k, n);
+                for (m = 0; m < n; m++)
+                {
+                    adlerA += p[m];
+                    if (adlerA >= 65521)
+                        adlerA -= 65521;
+                    adlerB += adlerA;
+                    if (adlerB >= 65521)
+                        adlerB -= 65521;
+                }
+                p += n;
+            }
+            if (rawLeft == 0)
+            {
+                putBE32(p, adlerB << 16 | adlerA);
+                p += 4;
+            }
+            writeChunk(fp, "IDAT", stored, p - stored);
+        }
+        else
+        {
+            fwrite(rows, stride, h, fp);
+        }
+    }
+
+    if (config->format == MAP_PNG)
+        writeChunk(fp, "IEND", NULL, 0);
+
+    if (cache)
+        closeTileCache(cache);
+    free(cells);
+    free(stored);
+    free(rows);
+    free(ids);
+    free(huts);
+    freeGenerator(g);
+    return (int64_t) width * height;
+}
+
+int getMapFormat(const char *path)
+{
+    size_t len = strlen(path);
+    return len >= 4 && strcmp(path + len - 4, ".png") == 0 ? MAP_PNG : MAP_PPM;
+}
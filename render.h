@@ -0,0 +1,44 @@
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include "finders.h"
+
+#include <stdio.h>
+
+enum MapFormat
+{
+    MAP_PPM,    // binary PPM (P6)
+    MAP_PNG,    // PNG with stored, uncompressed deflate blocks
+};
+
+STRUCT(MapConfig)
+{
+    int mcversion;
+    int64_t seed;
+    int x, z;           // north-west corner of the area in blocks
+    int width, height;  // size of the area in blocks
+    int scale;          // blocks per pixel: 1, 4, 16 or 256
+    int format;         // MapFormat
+    int threads;        // generator threads, <= 1 renders on the caller
+    int huts;           // mark the witch huts of the area
+    const Pos *centers; // cluster centres to mark, in blocks
+    int centerNum;
+    const char *cacheDir;   // tile cache of the layer of the scale, NULL for none
+    int64_t cacheBytes;     // size limit of a new cache file
+};
+
+/* Writes the biome map of an area to 'fp', one pixel per 'scale' blocks.
+ * The map is generated in bands of rows with genArea8() on the layer of the
+ * scale, so the memory stays bounded whatever the size of the area. The witch
+ * huts that can spawn are drawn as black squares, the cluster centres as red
+ * crosses. With a 'cacheDir' the bands are read from the tile cache of the
+ * seed, see openTileCache(), and the missing tiles are generated on the caller
+ * and added to it. Returns the number of pixels written or -1 for an invalid
+ * scale.
+ */
+int64_t renderBiomeMap(FILE *fp, const MapConfig *config);
+
+/* Returns the MapFormat for a file name, MAP_PNG for a ".png" extension. */
+int getMapFormat(const char *path);
+
+#endif /* RENDER_H_ */
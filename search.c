@@ -0,0 +1,1638 @@
+#include "search.h"
+#include "output.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Number of region columns per work unit. Each tile recomputes the hut
+ * positions of one extra column, so the tiles must not be too thin.
+ */
+#define TILE_COLUMNS 16
+
+/* Smallest side in region blocks of the square tiles of the Hilbert order,
+ * it doubles on large areas to keep the number of tiles moderate.
+ */
+#define HILBERT_TILE 32
+#define HILBERT_MAX_TILES 256   // per side
+
+/* Candidates per batch between the filters and the biome checks, and batches
+ * the queue holds per thread.
+ */
+#define BATCH_CANDIDATES 64
+#define QUEUE_BATCHES 4
+
+/* Side of the cached scale 1 tiles of the biome checks, a tile of 64x64 costs
+ * little more to generate than a single position.
+ */
+#define CACHE_TILE_SIDE 64
+
+#define CHECKPOINT_MAGIC "WitchHutFinder-checkpoint-4"
+
+
+int euclideanDistance(int x1, int y1, int x2, int y2)
+{
+    double dx = (x1 - x2);
+    double dy = (y1 - y2);
+    return (int) (dx * dx + dy * dy);
+}
+
+int hasCloseHuts(const Pos qhpos[4])
+{
+    int i, j;
+
+    for (i = 1; i < 4; i++)
+    {
+        for (j = 0; j < i; j++)
+        {
+            if (euclideanDistance(qhpos[i].x, qhpos[i].z, qhpos[j].x, qhpos[j].z) < HUT_PAIR_DIST)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+int countSwampCandidates(Layer *l, int regX, int regZ)
+{
+    int areaX = (int) ((unsigned int) regX << 1u) + 1;
+    int areaZ = (int) ((unsigned int) regZ << 1u) + 1;
+    int swpc = 0;
+
+    setChunkSeed(l, areaX + 1, areaZ + 1);
+    swpc += mcNextInt6(l) == 5;
+    setChunkSeed(l, areaX, areaZ + 1);
+    swpc += mcNextInt6(l) == 5;
+    setChunkSeed(l, areaX + 1, areaZ);
+    swpc += mcNextInt6(l) == 5;
+    setChunkSeed(l, areaX, areaZ);
+    swpc += mcNextInt6(l) == 5;
+    return swpc;
+}
+
+
+//==============================================================================
+// Quad Hut Search
+//==============================================================================
+
+/* A cluster is identified by the regions of its huts: (regX, regZ) is the
+ * smallest region coordinate on each axis and bit 2*dx+dz of 'mask' is set for
+ * the hut of region (regX+dx, regZ+dz). Overlapping 2x2 blocks find the same
+ * huts with the same key.
+ */
+STRUCT(Cluster)
+{
+    int huts, x, z;
+    int regX, regZ, mask;
+    int seq;            // order in the tile until the tile is done
+};
+
+static int cmpClusterSeq(const void *a, const void *b)
+{
+    return ((const Cluster *) a)->seq - ((const Cluster *) b)->seq;
+}
+
+static int cmpCluster(const void *a, const void *b)
+{
+    const Cluster *p = (const Cluster *) a, *q = (const Cluster *) b;
+    if (p->x != q->x)
+        return (p->x > q->x) - (p->x < q->x);
+    if (p->z != q->z)
+        return (p->z > q->z) - (p->z < q->z);
+    return (p->huts > q->huts) - (p->huts < q->huts);
+}
+
+/* Cluster of a spiral search waiting for the rings that could hold a nearer one. */
+STRUCT(PendingCluster)
+{
+    int64_t dist;       // squared distance to the center
+    Cluster c;
+};
+
+/* Clusters and counters of one tile, the clusters are reported once all the
+ * tiles before it are done.
+ */
+STRUCT(TileResult)
+{
+    Cluster *clusters;
+    int num, cap;
+    int done;
+    int skip;           // belongs to another shard
+    int partial;        // cut short by the time budget, its clusters are still reported
+    int produced;       // all its candidates are queued
+    int outstanding;    // batches of candidates not checked yet
+    int aborted;        // the search stopped before the end of the tile
+    int64_t regions, geometric, candidates, biomeChecks[4];
+};
+
+/* Finished tiles of a search, copied with their clusters so that the file
+ * is written without the lock of the search.
+ */
+STRUCT(CheckpointSnapshot)
+{
+    int64_t seq;
+    int num;
+    int *ids;           // tile numbers
+    TileResult *tiles;
+};
+
+STRUCT(Candidate)
+{
+    Pos qhpos[4];
+    int regX, regZ;
+};
+
+/* Candidates of one tile on their way to the biome checks, 'first' is the
+ * index in the tile of the first one.
+ */
+STRUCT(CandidateBatch)
+{
+    int tile, first, num;
+    Candidate items[BATCH_CANDIDATES];
+};
+
+typedef struct Worker Worker;
+
+STRUCT(SearchState)
+{
+    const SearchConfig *config;
+    StructureConfig featureConfig;
+    ClusterCallback callback;
+    void *data;
+    TileCache *cache;   // scale 1 tiles for the biome checks, NULL for none
+
+    pthread_mutex_t lock;
+    CandidateBatch **queue;     // bounded FIFO between the producers and the biome checks
+    int queueHead, queueNum, queueCap;
+    int64_t queueDepthSum;
+    pthread_cond_t queueCond;   // a batch was queued or a producer finished
+    int producers;      // workers filtering a tile
+    int tileNum;
+    int shardTiles;     // tiles of this shard
+    int64_t shardRegions;
+    int nextTile;       // next tile to hand out
+    int nextReport;     // next tile to pass to the callback
+    TileResult *tiles;
+    SearchStats stats;
+    Cluster *window;    // clusters reported from the last two region columns
+    int windowNum, windowCap;
+    PendingCluster *pending;    // spiral search: clusters not reported yet
+    int pendingNum, pendingCap;
+    int64_t reported;
+    int limitReached;   // the spiral search found enough clusters
+    double deadline;    // wallTime() at which the time budget runs out, 0 for none
+    int timeUp;
+
+    Worker *workers;
+    int workerNum;
+    double startWall;
+    int64_t restoredRegions;    // regions of the tiles loaded from the checkpoint
+    double lastCheckpoint;
+    int64_t checkpointSeq;      // snapshots taken
+    pthread_mutex_t checkpointLock; // held while a checkpoint file is written
+    int64_t checkpointWritten;  // last snapshot written, under checkpointLock
+    pthread_cond_t progressCond;
+    int finished;       // tells the progress reporter to stop
+};
+
+STRUCT(Worker)
+{
+    SearchState *state;
+    LayerStack g;
+    Layer layerBiomeDummy;
+    Pos *column, *nextColumn;
+    CandidateBatch *batch;      // being filled by the producer
+    int tile, tileCandidates;   // tile being produced
+    TileResult scratch;         // clusters of the batch being checked
+    SearchStats stats;
+    int64_t doneRegions, doneCandidates;    // published for the progress reporter
+    char pad[64];       // keeps the counters of two workers off the same cache line
+};
+
+static const char *stageNames[STAGE_NUM] = {"structures", "filters", "biomes"};
+
+static double wallTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double threadCpuTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Adds the time since (*wall, *cpu) to 'stage' and starts the next lap. The
+ * laps are long enough for the clock reads not to matter: a column of hut
+ * positions, a column of filters or the biome checks of a candidate.
+ */
+static void lapStage(SearchStats *stats, int stage, double *wall, double *cpu)
+{
+    double now = wallTime();
+    double nowCpu = threadCpuTime();
+    stats->stageWall[stage] += now - *wall;
+    stats->stageCpu[stage] += nowCpu - *cpu;
+    *wall = now;
+    *cpu = nowCpu;
+}
+
+static void addCluster(TileResult *t, Cluster c)
+{
+    if (t->num == t->cap)
+    {
+        t->cap = t->cap ? 2 * t->cap : 16;
+        t->clusters = (Cluster *) realloc(t->clusters, t->cap * sizeof(*t->clusters));
+    }
+    t->clusters[t->num++] = c;
+}
+
+/* Checks the biomes of the huts of the 2x2 region block at (regX, regZ) and
+ * reports the clusters among them. qhpos[i] is the hut of the region
+ * (regX + i/2, regZ + i%2).
+ */
+static void checkBlock(Worker *w, TileResult *t, const Pos qhpos[4], int regX, int regZ)
+{
+    const int offset = w->state->config->minHuts - 4;
+    int correctPos[4] = {-1, -1, -1, -1};
+    int count = 0;
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+    {
+        w->stats.biomeChecks[i]++;
+        if ((w->state->cache ? getCachedBiome(w->state->cache, &w->g, qhpos[i].x, qhpos[i].z)
+                : getBiomeAtPos(w->g, qhpos[i])) == swampland)
+            correctPos[count++] = i;
+        else if (count <= i + offset)
+            return;
+    }
+
+    for (j = 0; j < count - 1; ++j)
+    {
+        int maxi = count - j;
+        int x = 0;
+        int z = 0;
+        for (i = 0; i < maxi; ++i)
+        {
+            x += qhpos[correctPos[i]].x;
+            z += qhpos[correctPos[i]].z;
+        }
+        x = (int) (x / (double) maxi);
+        z = (int) (z / (double) maxi);
+        int valid = 1;
+        for (i = 0; i < maxi; ++i)
+        {
+            if (euclideanDistance(qhpos[correctPos[i]].x, qhpos[correctPos[i]].z, x, z) > HUT_CENTER_DIST)
+                valid = 0;
+        }
+        if (valid && maxi >= offset + 4)
+        {
+            Cluster c = {maxi, x, z, 0, 0, 0, 0};
+            int dx = 1, dz = 1;
+            for (i = 0; i < maxi; ++i)
+            {
+                dx &= correctPos[i] >> 1;
+                dz &= correctPos[i] & 1;
+            }
+            for (i = 0; i < maxi; ++i)
+                c.mask |= 1 << (correctPos[i] - 2 * dx - dz);
+            c.regX = regX + dx;
+            c.regZ = regZ + dz;
+            addCluster(t, c);
+        }
+    }
+}
+
+static volatile sig_atomic_t stopRequested;
+
+void requestSearchStop(void)
+{
+    stopRequested = 1;
+}
+
+/* Whether the search was asked to stop, by requestSearchStop() or its own
+ * flag.
+ */
+static int isCancelled(const SearchState *s)
+{
+    return stopRequested || (s->config->stop && *s->config->stop);
+}
+
+static int isStopped(SearchState *s)
+{
+    if (s->deadline > 0 && wallTime() >= s->deadline)
+        __atomic_store_n(&s->timeUp, 1, __ATOMIC_RELAXED);
+    return isCancelled(s) || __atomic_load_n(&s->limitReached, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&s->timeUp, __ATOMIC_RELAXED);
+}
+
+/* The tiles are strips of TILE_COLUMNS region columns from west to east. */
+static void getTileColumns(const SearchConfig *config, int tile, int *x0, int *x1)
+{
+    *x0 = -config->searchRange + tile * TILE_COLUMNS;
+    *x1 = *x0 + TILE_COLUMNS < config->searchRange ? *x0 + TILE_COLUMNS : config->searchRange;
+}
+
+/* Region block at the origin of a spiral search, the one holding the center. */
+static void getCenterBlock(const SearchConfig *config, int *regX, int *regZ)
+{
+    *regX = config->centerX >> 9;
+    *regZ = config->centerZ >> 9;
+}
+
+/* Gets the side 'side' (west, east, south, north) of the ring 'ring' of a
+ * spiral search, clipped to the world border: 'n' region blocks from (x, z)
+ * to the north for the west and east sides, to the east for the others. The
+ * corners belong to the west and east sides. Returns zero if nothing is left.
+ */
+static int getRingSide(const SearchConfig *config, int ring, int side, int *x, int *z, int *n)
+{
+    int cx, cz, lo, hi;
+
+    getCenterBlock(config, &cx, &cz);
+    if (ring == 0 && side > 0)
+        return 0;
+    if (side < 2)
+    {
+        *x = side ? cx + ring : cx - ring;
+        lo = cz - ring;
+        hi = cz + ring;
+        if (*x < WORLD_MIN_REGION || *x >= WORLD_MAX_REGION)
+            return 0;
+    }
+    else
+    {
+        *z = side == 3 ? cz + ring : cz - ring;
+        lo = cx - ring + 1;
+        hi = cx + ring - 1;
+        if (*z < WORLD_MIN_REGION || *z >= WORLD_MAX_REGION)
+            return 0;
+    }
+    lo = lo > WORLD_MIN_REGION ? lo : WORLD_MIN_REGION;
+    hi = hi < WORLD_MAX_REGION - 1 ? hi : WORLD_MAX_REGION - 1;
+    if (side < 2)
+        *z = lo;
+    else
+        *x = lo;
+    *n = hi - lo + 1;
+    return *n > 0;
+}
+
+/* Gets the side of the square tiles of the Hilbert order and the side of the
+ * power of two grid of tiles the curve covers.
+ */
+static void getHilbertGrid(const SearchConfig *config, int *side, int *gridSize)
+{
+    int tiles;
+
+    *side = HILBERT_TILE;
+    while ((tiles = (2 * config->searchRange + *side - 1) / *side) > HILBERT_MAX_TILES)
+        *side *= 2;
+    for (*gridSize = 1; *gridSize < tiles; *gridSize *= 2);
+}
+
+/* Gets the region blocks [x0, x1) x [z0, z1) of the tile at the position
+ * 'tile' along the Hilbert curve. Returns zero if the tile is outside of the
+ * search area, the curve fills a power of two grid.
+ */
+static int getHilbertTile(const SearchConfig *config, int tile, int *x0, int *x1, int *z0, int *z1)
+{
+    int side, gridSize, n, tx = 0, tz = 0, t, rx, rz, tmp;
+
+    getHilbertGrid(config, &side, &gridSize);
+    for (n = 1, t = tile; n < gridSize; n *= 2, t /= 4)
+    {
+        rx = 1 & (t / 2);
+        rz = 1 & (t ^ rx);
+        if (rz == 0)
+        {
+            if (rx == 1)
+            {
+                tx = n - 1 - tx;
+                tz = n - 1 - tz;
+            }
+            tmp = tx;
+            tx = tz;
+            tz = tmp;
+        }
+        tx += n * rx;
+        tz += n * rz;
+    }
+
+    *x0 = -config->searchRange + tx * side;
+    *z0 = -config->searchRange + tz * side;
+    *x1 = *x0 + side < config->searchRange ? *x0 + side : config->searchRange;
+    *z1 = *z0 + side < config->searchRange ? *z0 + side : config->searchRange;
+    return *x0 < *x1 && *z0 < *z1;
+}
+
+/* Number of region blocks of a tile. */
+static int64_t getTileRegions(const SearchConfig *config, int tile)
+{
+    int x0, x1, z0, z1, x, z, n, side;
+    int64_t regions = 0;
+
+    if (config->order == ORDER_SPIRAL)
+    {
+        for (side = 0; side < 4; side++)
+        {
+            if (getRingSide(config, tile, side, &x, &z, &n))
+                regions += n;
+        }
+        return regions;
+    }
+    if (config->order == ORDER_HILBERT)
+        return getHilbertTile(config, tile, &x0, &x1, &z0, &z1) ? (int64_t) (x1 - x0) * (z1 - z0) : 0;
+    getTileColumns(config, tile, &x0, &x1);
+    return (int64_t) (x1 - x0) * 2 * config->searchRange;
+}
+
+static void addCandidate(Worker *w, const Pos qhpos[4], int regX, int regZ, double *wall, double *cpu);
+
+/* Searches the n region blocks of a line: a[i] and b[i] are the huts of the
+ * regions (regX + i*dx, regZ + i*dz) and of their neighbours across the line,
+ * at (regX + i*dx + dz, regZ + i*dz + dx). Returns zero if the search was
+ * stopped in the middle, a line across the world takes a good fraction of a
+ * second.
+ */
+static int searchLine(Worker *w, const Pos *a, const Pos *b, int n,
+        int regX, int regZ, int dx, int dz, double *wall, double *cpu)
+{
+    const SearchConfig *config = w->state->config;
+    Pos qhpos[4];
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if ((i & 4095) == 4095 && isStopped(w->state))
+            break;
+        qhpos[0] = a[i];
+        qhpos[1] = dx ? b[i] : a[i + 1];
+        qhpos[2] = dx ? a[i + 1] : b[i];
+        qhpos[3] = b[i + 1];
+        if (!hasCloseHuts(qhpos))
+            continue;
+        w->stats.geometric++;
+        if (config->prefilter && countSwampCandidates(&w->layerBiomeDummy, regX + i*dx, regZ + i*dz) < config->minHuts)
+            continue;
+        w->stats.candidates++;
+        addCandidate(w, qhpos, regX + i*dx, regZ + i*dz, wall, cpu);
+    }
+    w->stats.regions += i;
+    __atomic_store_n(&w->doneRegions, w->stats.regions, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->doneCandidates, w->stats.candidates, __ATOMIC_RELAXED);
+    lapStage(&w->stats, STAGE_FILTERS, wall, cpu);
+    return i == n;
+}
+
+/* Scans the region blocks [x0, x1) x [z0, z1) column by column. Returns zero
+ * if the search was stopped before the end of the tile.
+ */
+static int searchColumns(Worker *w, int x0, int x1, int z0, int z1, double *wall, double *cpu)
+{
+    const SearchConfig *config = w->state->config;
+    const int columnLength = z1 - z0 + 1;
+    int regPosX;
+
+    // Hut positions of the current and the next region column, the latter is reused for the next regPosX
+    getStructurePosBatch(w->state->featureConfig, config->seed, x0, z0, columnLength, w->nextColumn);
+    for (regPosX = x0; regPosX < x1; ++regPosX)
+    {
+        if (isStopped(w->state))
+            return 0;
+        Pos *swap = w->column;
+        w->column = w->nextColumn;
+        w->nextColumn = swap;
+        getStructurePosBatch(w->state->featureConfig, config->seed, regPosX + 1, z0, columnLength, w->nextColumn);
+        lapStage(&w->stats, STAGE_STRUCTURES, wall, cpu);
+
+        if (!searchLine(w, w->column, w->nextColumn, z1 - z0, regPosX, z0, 0, 1, wall, cpu))
+            return 0;
+    }
+    return 1;
+}
+
+/* Scans the ring of region blocks at the distance 'ring' from the center
+ * block, side by side. Returns zero if the search was stopped.
+ */
+static int searchRing(Worker *w, int ring, double *wall, double *cpu)
+{
+    const SearchConfig *config = w->state->config;
+    const StructureConfig sconf = w->state->featureConfig;
+    int x, z, n, side, i;
+
+    for (side = 0; side < 4; side++)
+    {
+        if (isStopped(w->state))
+            return 0;
+        if (!getRingSide(config, ring, side, &x, &z, &n))
+            continue;
+        if (side < 2)
+        {
+            // west and east sides, as columns
+            getStructurePosBatch(sconf, config->seed, x, z, n + 1, w->column);
+            getStructurePosBatch(sconf, config->seed, x + 1, z, n + 1, w->nextColumn);
+            lapStage(&w->stats, STAGE_STRUCTURES, wall, cpu);
+            if (!searchLine(w, w->column, w->nextColumn, n, x, z, 0, 1, wall, cpu))
+                return 0;
+        }
+        else
+        {
+            // south and north sides, as rows
+            for (i = 0; i <= n; i++)
+            {
+                w->column[i] = getStructurePos(sconf, config->seed, x + i, z);
+                w->nextColumn[i] = getStructurePos(sconf, config->seed, x + i, z + 1);
+            }
+            lapStage(&w->stats, STAGE_STRUCTURES, wall, cpu);
+            if (!searchLine(w, w->column, w->nextColumn, n, x, z, 1, 0, wall, cpu))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int64_t centerDistance(const SearchConfig *config, const Cluster *c)
+{
+    int64_t dx = c->x - (int64_t) config->centerX;
+    int64_t dz = c->z - (int64_t) config->centerZ;
+    return dx*dx + dz*dz;
+}
+
+static int cmpPending(const void *a, const void *b)
+{
+    const PendingCluster *p = (const PendingCluster *) a, *q = (const PendingCluster *) b;
+    if (p->dist != q->dist)
+        return p->dist < q->dist ? -1 : 1;
+    if (p->c.x != q->c.x)
+        return p->c.x < q->c.x ? -1 : 1;
+    if (p->c.z != q->c.z)
+        return p->c.z < q->c.z ? -1 : 1;
+    return q->c.huts - p->c.huts;
+}
+
+/* Position of a cluster along the scan: its region column, or its ring for a
+ * spiral search.
+ */
+static int getSweep(const SearchConfig *config, const Cluster *c)
+{
+    int cx, cz, dx, dz;
+    if (config->order != ORDER_SPIRAL)
+        return c->regX;
+    getCenterBlock(config, &cx, &cz);
+    dx = abs(c->regX - cx);
+    dz = abs(c->regZ - cz);
+    return dx > dz ? dx : dz;
+}
+
+/* Returns non-zero if the cluster 'c' was already reported. The blocks found
+ * in scan order can only repeat a cluster of their own region column or of
+ * the previous one, so the window forgets the older clusters. The key of a
+ * cluster found in the ring k lies in the ring k-1, k or k+1, so a spiral
+ * search keeps a margin of two rings.
+ */
+static int isDuplicate(SearchState *s, const Cluster *c)
+{
+    const int margin = s->config->order == ORDER_SPIRAL ? 2 : 1;
+    const int sweep = getSweep(s->config, c);
+    int i, n = 0;
+
+    for (i = 0; i < s->windowNum; i++)
+    {
+        const Cluster *p = &s->window[i];
+        if (p->regX == c->regX && p->regZ == c->regZ && p->mask == c->mask)
+            return 1;
+        if (getSweep(s->config, p) >= sweep - margin)
+            s->window[n++] = *p;
+    }
+    if (n == s->windowCap)
+    {
+        s->windowCap = s->windowCap ? 2 * s->windowCap : 64;
+        s->window = (Cluster *) realloc(s->window, s->windowCap * sizeof(*s->window));
+    }
+    s->window[n++] = *c;
+    s->windowNum = n;
+    return 0;
+}
+
+static void reportCluster(SearchState *s, const Cluster *c)
+{
+    s->stats.clusters[c->huts - 2]++;
+    s->reported++;
+    if (s->callback)
+        s->callback(s->data, c->huts, c->x, c->z);
+}
+
+/* Reports the pending clusters of a spiral search that are at most
+ * 'maxDist' blocks from the center, nearest first, and at most 'quota' of
+ * them, -1 for any number.
+ */
+static void reportPending(SearchState *s, int64_t maxDist, int64_t quota)
+{
+    int i, n = 0;
+
+    qsort(s->pending, s->pendingNum, sizeof(*s->pending), cmpPending);
+    for (i = 0; i < s->pendingNum; i++)
+    {
+        if ((maxDist >= 0 && s->pending[i].dist > maxDist * maxDist) || quota == 0)
+        {
+            s->pending[n++] = s->pending[i];
+        }
+        else
+        {
+            reportCluster(s, &s->pending[i].c);
+            if (quota > 0)
+                quota--;
+        }
+    }
+    s->pendingNum = n;
+}
+
+/* Clusters a spiral search may still report before its limit, -1 for any. */
+static int64_t getQuota(const SearchState *s)
+{
+    return s->config->limit > 0 ? s->config->limit - s->reported : -1;
+}
+
+static int cmpPendingKey(const void *a, const void *b)
+{
+    const Cluster *p = &((const PendingCluster *) a)->c, *q = &((const PendingCluster *) b)->c;
+    if (p->regX != q->regX)
+        return p->regX < q->regX ? -1 : 1;
+    if (p->regZ != q->regZ)
+        return p->regZ < q->regZ ? -1 : 1;
+    return p->mask - q->mask;
+}
+
+static int cmpPendingPos(const void *a, const void *b)
+{
+    return cmpCluster(&((const PendingCluster *) a)->c, &((const PendingCluster *) b)->c);
+}
+
+/* Reports the pending clusters of a Hilbert search once, sorted by position. */
+static void reportSorted(SearchState *s)
+{
+    int i, n = 0;
+
+    qsort(s->pending, s->pendingNum, sizeof(*s->pending), cmpPendingKey);
+    for (i = 0; i < s->pendingNum; i++)
+    {
+        if (n == 0 || cmpPendingKey(&s->pending[n-1], &s->pending[i]) != 0)
+            s->pending[n++] = s->pending[i];
+    }
+    qsort(s->pending, n, sizeof(*s->pending), cmpPendingPos);
+    for (i = 0; i < n; i++)
+        reportCluster(s, &s->pending[i].c);
+    s->pendingNum = 0;
+}
+
+static void flushPending(SearchState *s)
+{
+    if (s->config->order == ORDER_HILBERT)
+        reportSorted(s);
+    else
+        reportPending(s, -1, getQuota(s));
+}
+
+/* Reports the clusters of a tile that were not reported yet, or queues them
+ * in a spiral or Hilbert search. The latter visits the neighbouring tiles in
+ * no particular order, it only drops the duplicates at the end.
+ */
+static void reportTile(SearchState *s, TileResult *t)
+{
+    const SearchConfig *config = s->config;
+    int i, n = 0;
+
+    for (i = 0; i < t->num; i++)
+    {
+        const Cluster *c = &t->clusters[i];
+        if (config->order != ORDER_HILBERT && isDuplicate(s, c))
+            continue;
+        if (config->order != ORDER_RASTER)
+        {
+            if (s->pendingNum == s->pendingCap)
+            {
+                s->pendingCap = s->pendingCap ? 2 * s->pendingCap : 64;
+                s->pending = (PendingCluster *) realloc(s->pending, s->pendingCap * sizeof(*s->pending));
+            }
+            s->pending[s->pendingNum].dist = centerDistance(config, c);
+            s->pending[s->pendingNum++].c = *c;
+        }
+        else
+        {
+            reportCluster(s, c);
+        }
+        t->clusters[n++] = *c;
+    }
+    t->num = n;
+}
+
+/* Passes the clusters of the finished tiles to the callback in scan order,
+ * without the ones already reported. The caller holds the lock.
+ *
+ * A spiral search holds the clusters back until no later ring can have a
+ * nearer one: the centre of a cluster found in the ring k is at least
+ * (k - 2) * 512 blocks from the center on one axis. A Hilbert search reports
+ * everything sorted by position at the end.
+ */
+static void reportTiles(SearchState *s)
+{
+    const SearchConfig *config = s->config;
+
+    while (s->nextReport < s->tileNum && s->tiles[s->nextReport].done && !s->limitReached)
+    {
+        reportTile(s, &s->tiles[s->nextReport++]);
+        if (config->order == ORDER_SPIRAL)
+        {
+            int next = s->nextReport;
+            reportPending(s, s->nextReport < s->tileNum ? (next > 2 ? (next - 2) * (int64_t) 512 : 0) : -1,
+                    getQuota(s));
+            if (config->limit > 0 && s->reported == config->limit)
+                __atomic_store_n(&s->limitReached, 1, __ATOMIC_RELAXED);
+        }
+        else if (config->order == ORDER_HILBERT && s->nextReport == s->tileNum)
+        {
+            reportSorted(s);
+        }
+    }
+}
+
+/* Copies the finished tiles and their counters. The caller holds the lock. */
+static CheckpointSnapshot *takeCheckpoint(SearchState *s)
+{
+    CheckpointSnapshot *cp = (CheckpointSnapshot *) calloc(1, sizeof(*cp));
+    int k, n = 0;
+
+    for (k = 0; k < s->tileNum; k++)
+        n += s->tiles[k].done && !s->tiles[k].skip;
+    cp->ids = (int *) malloc((n ? n : 1) * sizeof(int));
+    cp->tiles = (TileResult *) malloc((n ? n : 1) * sizeof(TileResult));
+    for (k = 0; k < s->tileNum; k++)
+    {
+        const TileResult *t = &s->tiles[k];
+        TileResult *c = &cp->tiles[cp->num];
+        if (!t->done || t->skip)
+            continue;
+        *c = *t;
+        c->clusters = (Cluster *) malloc((t->num ? t->num : 1) * sizeof(Cluster));
+        memcpy(c->clusters, t->clusters, t->num * sizeof(Cluster));
+        cp->ids[cp->num++] = k;
+    }
+    cp->seq = ++s->checkpointSeq;
+    s->lastCheckpoint = wallTime();
+    return cp;
+}
+
+/* Writes the configuration and the tiles of a snapshot, then frees it. The
+ * file is replaced at once so that a crash leaves either the previous or the
+ * new checkpoint. The lock of the search is not needed, a snapshot older than
+ * the file is dropped.
+ */
+static void writeCheckpoint(SearchState *s, CheckpointSnapshot *cp)
+{
+    const SearchConfig *config = s->config;
+    char tmpPath[4096];
+    FILE *fp = NULL;
+    int k, i;
+
+    pthread_mutex_lock(&s->checkpointLock);
+    if (cp->seq > s->checkpointWritten)
+    {
+        snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", config->checkpointPath);
+        if ((fp = fopen(tmpPath, "w")) == NULL)
+            fprintf(stderr, "Could not write the checkpoint %s\n", tmpPath);
+    }
+    if (fp)
+    {
+        fprintf(fp, "%s\n", CHECKPOINT_MAGIC);
+        fprintf(fp, "seed %" PRId64 "\nversion %d\nrange %d\nfilter %d\nprefilter %d\nshard %d %d\n"
+                "order %d %d %d\ntiles %d\n",
+                config->seed, config->mcversion, config->searchRange, config->minHuts,
+                config->prefilter, config->shard, config->shardNum,
+                config->order, config->centerX, config->centerZ, s->tileNum);
+        for (k = 0; k < cp->num; k++)
+        {
+            const TileResult *t = &cp->tiles[k];
+            fprintf(fp, "tile %d %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %d",
+                    cp->ids[k], t->regions, t->geometric, t->candidates,
+                    t->biomeChecks[0], t->biomeChecks[1], t->biomeChecks[2], t->biomeChecks[3], t->num);
+            for (i = 0; i < t->num; i++)
+            {
+                const Cluster *c = &t->clusters[i];
+                fprintf(fp, " %d %d %d %d %d %d", c->huts, c->x, c->z, c->regX, c->regZ, c->mask);
+            }
+            fprintf(fp, "\n");
+        }
+        if (fflush(fp) != 0 || fclose(fp) != 0 || rename(tmpPath, config->checkpointPath) != 0)
+            fprintf(stderr, "Could not write the checkpoint %s\n", config->checkpointPath);
+        s->checkpointWritten = cp->seq;
+    }
+    pthread_mutex_unlock(&s->checkpointLock);
+
+    for (k = 0; k < cp->num; k++)
+        free(cp->tiles[k].clusters);
+    free(cp->tiles);
+    free(cp->ids);
+    free(cp);
+}
+
+/* Marks the tiles of the checkpoint as done. Returns zero if the checkpoint
+ * does not belong to this search.
+ */
+static int loadCheckpoint(SearchState *s)
+{
+    const SearchConfig *config = s->config;
+    char magic[64];
+    int64_t seed;
+    int version, range, filter, prefilter, shard, shardNum, order, centerX, centerZ, tileNum;
+    int k, i, n;
+    FILE *fp;
+
+    if ((fp = fopen(config->checkpointPath, "r")) == NULL)
+    {
+        fprintf(stderr, "Could not open the checkpoint %s\n", config->checkpointPath);
+        return 0;
+    }
+    if (fscanf(fp, "%63s seed %" SCNd64 " version %d range %d filter %d prefilter %d shard %d %d order %d %d %d tiles %d",
+            magic, &seed, &version, &range, &filter, &prefilter, &shard, &shardNum,
+            &order, &centerX, &centerZ, &tileNum) != 12 ||
+        strcmp(magic, CHECKPOINT_MAGIC) != 0)
+    {
+        fprintf(stderr, "%s is not a checkpoint\n", config->checkpointPath);
+        fclose(fp);
+        return 0;
+    }
+    if (seed != config->seed || version != config->mcversion || range != config->searchRange ||
+        filter != config->minHuts || prefilter != config->prefilter || shard != config->shard ||
+        shardNum != config->shardNum || order != config->order || centerX != config->centerX ||
+        centerZ != config->centerZ || tileNum != s->tileNum)
+    {
+        fprintf(stderr, "The checkpoint %s is for another search\n", config->checkpointPath);
+        fclose(fp);
+        return 0;
+    }
+
+    while (fscanf(fp, " tile %d", &k) == 1 && k >= 0 && k < s->tileNum && !s->tiles[k].skip)
+    {
+        TileResult *t = &s->tiles[k];
+        if (fscanf(fp, "%" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %d",
+                &t->regions, &t->geometric, &t->candidates, &t->biomeChecks[0], &t->biomeChecks[1],
+                &t->biomeChecks[2], &t->biomeChecks[3], &n) != 8)
+            break;
+        for (i = 0; i < n; i++)
+        {
+            Cluster c;
+            if (fscanf(fp, "%d %d %d %d %d %d", &c.huts, &c.x, &c.z, &c.regX, &c.regZ, &c.mask) != 6 ||
+                c.huts < 2 || c.huts > 4)
+                break;
+            addCluster(t, c);
+        }
+        if (i < n)
+        {
+            t->num = 0;
+            break;
+        }
+        t->done = 1;
+        s->restoredRegions += t->regions;
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Completes a tile once its candidates are produced and checked: its
+ * clusters are put back in scan order and reported. The caller holds the lock.
+ * Returns a snapshot to pass to writeCheckpoint() once the lock is released
+ * when a checkpoint is due, NULL otherwise.
+ */
+static CheckpointSnapshot *finishTile(SearchState *s, TileResult *t)
+{
+    qsort(t->clusters, t->num, sizeof(*t->clusters), cmpClusterSeq);
+    if (t->aborted)
+    {
+        // out of time the clusters found so far are the answer, otherwise
+        // the tile is searched again on resume
+        if (s->timeUp && !isCancelled(s))
+            t->partial = 1;
+        else
+            t->num = 0;
+        return NULL;
+    }
+    t->done = 1;
+    reportTiles(s);
+    if (s->config->checkpointPath && wallTime() - s->lastCheckpoint >= s->config->checkpointInterval)
+        return takeCheckpoint(s);
+    return NULL;
+}
+
+static CandidateBatch *popBatch(SearchState *s)
+{
+    CandidateBatch *b = s->queue[s->queueHead];
+    s->queueHead = (s->queueHead + 1) % s->queueCap;
+    s->queueNum--;
+    return b;
+}
+
+/* Checks the biomes of a batch of candidates and gives its clusters to the
+ * tile, the last batch of a produced tile finishes it. A stopped search
+ * drops the batches left.
+ */
+static void checkBatch(Worker *w, CandidateBatch *b, double *wall, double *cpu)
+{
+    SearchState *s = w->state;
+    TileResult *t = &s->tiles[b->tile];
+    CheckpointSnapshot *cp = NULL;
+    int64_t checks[4];
+    int stopped = isStopped(s);
+    int i, j, num;
+
+    memcpy(checks, w->stats.biomeChecks, sizeof(checks));
+    w->scratch.num = 0;
+    for (i = 0; i < b->num && !stopped; i++)
+    {
+        num = w->scratch.num;
+        checkBlock(w, &w->scratch, b->items[i].qhpos, b->items[i].regX, b->items[i].regZ);
+        for (j = num; j < w->scratch.num; j++)
+            w->scratch.clusters[j].seq = 4 * (b->first + i) + j - num;
+    }
+    lapStage(&w->stats, STAGE_BIOMES, wall, cpu);
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < w->scratch.num; i++)
+        addCluster(t, w->scratch.clusters[i]);
+    for (i = 0; i < 4; i++)
+        t->biomeChecks[i] += w->stats.biomeChecks[i] - checks[i];
+    if (stopped)
+        t->aborted = 1;
+    if (--t->outstanding == 0 && t->produced)
+        cp = finishTile(s, t);
+    pthread_mutex_unlock(&s->lock);
+    if (cp)
+        writeCheckpoint(s, cp);
+    free(b);
+}
+
+/* Queues the batch the producer filled. When the queue is full the producer
+ * checks the oldest batch itself, which holds it back without any risk of
+ * all the threads waiting on each other.
+ */
+static void queueBatch(Worker *w, double *wall, double *cpu)
+{
+    SearchState *s = w->state;
+    CandidateBatch *b = w->batch;
+
+    if (b == NULL)
+        return;
+    w->batch = NULL;
+    lapStage(&w->stats, STAGE_FILTERS, wall, cpu);
+
+    pthread_mutex_lock(&s->lock);
+    s->tiles[b->tile].outstanding++;
+    while (s->queueNum == s->queueCap)
+    {
+        CandidateBatch *oldest = popBatch(s);
+        s->stats.queueFull++;
+        pthread_mutex_unlock(&s->lock);
+        checkBatch(w, oldest, wall, cpu);
+        pthread_mutex_lock(&s->lock);
+    }
+    s->queue[(s->queueHead + s->queueNum++) % s->queueCap] = b;
+    s->stats.batches++;
+    s->queueDepthSum += s->queueNum;
+    if (s->queueNum > s->stats.queueMax)
+        s->stats.queueMax = s->queueNum;
+    pthread_cond_signal(&s->queueCond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void addCandidate(Worker *w, const Pos qhpos[4], int regX, int regZ, double *wall, double *cpu)
+{
+    CandidateBatch *b = w->batch;
+    Candidate *c;
+
+    if (b == NULL)
+    {
+        b = w->batch = (CandidateBatch *) malloc(sizeof(*b));
+        b->tile = w->tile;
+        b->first = w->tileCandidates;
+        b->num = 0;
+    }
+    c = &b->items[b->num++];
+    memcpy(c->qhpos, qhpos, sizeof(c->qhpos));
+    c->regX = regX;
+    c->regZ = regZ;
+    w->tileCandidates++;
+    if (b->num == BATCH_CANDIDATES)
+        queueBatch(w, wall, cpu);
+}
+
+/* Produces the candidates of one tile and stores its counters. Returns zero
+ * if the search was stopped before the end of the tile.
+ */
+static int searchTile(Worker *w, int tile)
+{
+    const SearchConfig *config = w->state->config;
+    SearchState *s = w->state;
+    TileResult *t = &s->tiles[tile];
+    double wall = wallTime();
+    double cpu = threadCpuTime();
+    SearchStats start = w->stats;
+    CheckpointSnapshot *cp = NULL;
+    int x0, x1, z0, z1, done;
+
+    w->tile = tile;
+    w->tileCandidates = 0;
+    if (config->order == ORDER_SPIRAL)
+    {
+        done = searchRing(w, tile, &wall, &cpu);
+    }
+    else if (config->order == ORDER_HILBERT)
+    {
+        getHilbertTile(config, tile, &x0, &x1, &z0, &z1);
+        done = searchColumns(w, x0, x1, z0, z1, &wall, &cpu);
+    }
+    else
+    {
+        getTileColumns(config, tile, &x0, &x1);
+        done = searchColumns(w, x0, x1, -config->searchRange, config->searchRange, &wall, &cpu);
+    }
+    queueBatch(w, &wall, &cpu);
+
+    pthread_mutex_lock(&s->lock);
+    t->regions = w->stats.regions - start.regions;
+    t->geometric = w->stats.geometric - start.geometric;
+    t->candidates = w->stats.candidates - start.candidates;
+    t->produced = 1;
+    if (!done)
+        t->aborted = 1;
+    if (t->outstanding == 0)
+        cp = finishTile(s, t);
+    pthread_mutex_unlock(&s->lock);
+    if (cp)
+        writeCheckpoint(s, cp);
+    return done;
+}
+
+/* Every worker is both a producer, running the cheap filters over a tile,
+ * and a consumer of the candidate batches. It checks the queued batches
+ * first and only takes a new tile when the queue is empty.
+ */
+static void *searchWorker(void *arg)
+{
+    Worker *w = (Worker *) arg;
+    SearchState *s = w->state;
+    CandidateBatch *b;
+    int tile;
+
+    for (;;)
+    {
+        b = NULL;
+        tile = -1;
+        pthread_mutex_lock(&s->lock);
+        for (;;)
+        {
+            if (s->queueNum > 0)
+            {
+                b = popBatch(s);
+                break;
+            }
+            while (s->nextTile < s->tileNum && s->tiles[s->nextTile].done)
+                s->nextTile++;
+            if (s->nextTile < s->tileNum && !isStopped(s))
+            {
+                tile = s->nextTile++;
+                s->producers++;
+                break;
+            }
+            if (s->producers == 0)
+                break;
+            pthread_cond_wait(&s->queueCond, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (b)
+        {
+            double wall = wallTime();
+            double cpu = threadCpuTime();
+            checkBatch(w, b, &wall, &cpu);
+            continue;
+        }
+        if (tile < 0)
+            break;
+
+        searchTile(w, tile);
+        pthread_mutex_lock(&s->lock);
+        s->producers--;
+        pthread_cond_broadcast(&s->queueCond);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+static void reportProgress(SearchState *s, int done)
+{
+    const SearchConfig *config = s->config;
+    const int64_t total = s->shardRegions;
+    int64_t regions = s->restoredRegions, candidates = 0;
+    double elapsed = wallTime() - s->startWall;
+    double rate, eta;
+    int i;
+
+    for (i = 0; i < s->workerNum; i++)
+    {
+        regions += __atomic_load_n(&s->workers[i].doneRegions, __ATOMIC_RELAXED);
+        candidates += __atomic_load_n(&s->workers[i].doneCandidates, __ATOMIC_RELAXED);
+    }
+    rate = elapsed > 0 ? (regions - s->restoredRegions) / elapsed : 0;
+    eta = rate > 0 ? (total - regions) / rate : -1;
+
+    if (strcmp(config->progressPath, "-") == 0)
+    {
+        int e = (int) eta;
+        fprintf(stderr, "Progress: %5.1f%% (%" PRId64 "/%" PRId64 " regions), %.0f regions/s, %.0f candidates/s, ",
+                total ? 100.0 * regions / total : 100.0, regions, total, rate, elapsed > 0 ? candidates / elapsed : 0);
+        if (eta < 0)
+            fprintf(stderr, "ETA unknown\n");
+        else
+            fprintf(stderr, "ETA %d:%02d:%02d\n", e / 3600, e / 60 % 60, e % 60);
+        return;
+    }
+
+    // the status file is replaced at once so that a reader never sees half of it
+    char tmpPath[4096];
+    FILE *fp;
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", config->progressPath);
+    if ((fp = fopen(tmpPath, "w")) == NULL)
+        return;
+    fprintf(fp, "{\"done\": %s, \"fraction\": %.6f, \"regions\": %" PRId64 ", \"total_regions\": %" PRId64 ", "
+            "\"candidates\": %" PRId64 ", \"elapsed_s\": %.1f, \"regions_per_s\": %.1f, "
+            "\"candidates_per_s\": %.1f, \"eta_s\": %.1f}\n",
+            done ? "true" : "false", total ? (double) regions / total : 1.0, regions, total,
+            candidates, elapsed, rate, elapsed > 0 ? candidates / elapsed : 0, eta);
+    fclose(fp);
+    rename(tmpPath, config->progressPath);
+}
+
+static void *progressWorker(void *arg)
+{
+    SearchState *s = (SearchState *) arg;
+    struct timespec deadline;
+    double next;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->finished)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        next = deadline.tv_nsec * 1e-9 + s->config->progressInterval;
+        deadline.tv_sec += (time_t) next;
+        deadline.tv_nsec = (long) ((next - (time_t) next) * 1e9);
+        if (pthread_cond_timedwait(&s->progressCond, &s->lock, &deadline) != 0 && !s->finished)
+        {
+            pthread_mutex_unlock(&s->lock);
+            reportProgress(s, 0);
+            pthread_mutex_lock(&s->lock);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int searchQuadHuts(const SearchConfig *config, ClusterCallback callback, void *data,
+        SearchStats *stats)
+{
+    const int threads = config->threads > 1 ? config->threads : 1;
+    SearchConfig clamped = *config;
+    SearchState s;
+    Worker *workers;
+    pthread_t *tids, progressTid;
+    double startWall = wallTime();
+    clock_t startCpu = clock();
+    int i, j, columnLength;
+
+    // the area stops at the world border
+    if (clamped.searchRange > WORLD_SEARCH_RANGE)
+        clamped.searchRange = WORLD_SEARCH_RANGE;
+    config = &clamped;
+    // a spiral side needs one more region than a column
+    columnLength = 2 * config->searchRange + 2;
+
+    memset(&s, 0, sizeof(s));
+    s.config = config;
+    s.featureConfig = config->mcversion >= MC_1_13 ? SWAMP_HUT_CONFIG : FEATURE_CONFIG;
+    s.callback = callback;
+    s.data = data;
+    if (config->order == ORDER_SPIRAL)
+    {
+        // no ring beyond the one that reaches the farthest world border
+        int cx, cz, maxRing;
+        getCenterBlock(config, &cx, &cz);
+        maxRing = cx - WORLD_MIN_REGION;
+        maxRing = maxRing > WORLD_MAX_REGION - cx ? maxRing : WORLD_MAX_REGION - cx;
+        maxRing = maxRing > cz - WORLD_MIN_REGION ? maxRing : cz - WORLD_MIN_REGION;
+        maxRing = maxRing > WORLD_MAX_REGION - cz ? maxRing : WORLD_MAX_REGION - cz;
+        s.tileNum = (config->searchRange < maxRing ? config->searchRange : maxRing) + 1;
+    }
+    else if (config->order == ORDER_HILBERT)
+    {
+        int side, gridSize;
+        getHilbertGrid(config, &side, &gridSize);
+        s.tileNum = gridSize * gridSize;
+    }
+    else
+        s.tileNum = (2 * config->searchRange + TILE_COLUMNS - 1) / TILE_COLUMNS;
+    s.tiles = (TileResult *) calloc(s.tileNum, sizeof(*s.tiles));
+    s.startWall = startWall;
+    s.deadline = config->timeBudget > 0 ? startWall + config->timeBudget : 0;
+    s.lastCheckpoint = startWall;
+    for (i = 0; i < s.tileNum; i++)
+    {
+        // the tiles are dealt round-robin to the shards so that each one
+        // gets strips from all over the area
+        if ((config->shardNum > 1 && i % config->shardNum != config->shard) || getTileRegions(config, i) == 0)
+        {
+            s.tiles[i].done = s.tiles[i].skip = 1;
+            continue;
+        }
+        s.shardTiles++;
+        s.shardRegions += getTileRegions(config, i);
+    }
+    if (config->checkpointPath && config->resume && !loadCheckpoint(&s))
+    {
+        free(s.tiles);
+        return -1;
+    }
+    if (config->cache)
+    {
+        s.cache = config->cache;
+    }
+    else if (config->cacheDir)
+    {
+        s.cache = openTileCache(config->cacheDir, config->seed, config->mcversion,
+                -1, CACHE_TILE_SIDE, config->cacheBytes);
+    }
+    if (s.cache)
+    {
+        // a shared cache counts the tiles of the other searches as well
+        TileCacheStats cacheStats;
+        getTileCacheStats(s.cache, &cacheStats);
+        s.stats.cacheHits = -cacheStats.hits;
+        s.stats.cacheMisses = -cacheStats.misses;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_mutex_init(&s.checkpointLock, NULL);
+    pthread_cond_init(&s.progressCond, NULL);
+    pthread_cond_init(&s.queueCond, NULL);
+    s.queueCap = QUEUE_BATCHES * threads;
+    s.queue = (CandidateBatch **) malloc(s.queueCap * sizeof(*s.queue));
+    // the clusters found before the checkpoint are reported again
+    reportTiles(&s);
+
+    workers = (Worker *) calloc(threads, sizeof(*workers));
+    s.workers = workers;
+    s.workerNum = threads;
+    tids = (pthread_t *) malloc(threads * sizeof(*tids));
+    for (i = 0; i < threads; i++)
+    {
+        Worker *w = &workers[i];
+        w->state = &s;
+        w->g = setupGenerator(config->mcversion);
+        applySeed(&w->g, config->seed);
+        setupLayer(256, &w->layerBiomeDummy, NULL, 200, NULL);
+        setWorldSeed(&w->layerBiomeDummy, config->seed);
+        w->column = (Pos *) malloc(columnLength * sizeof(Pos));
+        w->nextColumn = (Pos *) malloc(columnLength * sizeof(Pos));
+    }
+
+    if (config->progressPath && config->progressInterval > 0)
+        pthread_create(&progressTid, NULL, progressWorker, &s);
+
+    if (threads == 1)
+    {
+        searchWorker(&workers[0]);
+    }
+    else
+    {
+        for (i = 0; i < threads; i++)
+            pthread_create(&tids[i], NULL, searchWorker, &workers[i]);
+        for (i = 0; i < threads; i++)
+            pthread_join(tids[i], NULL);
+    }
+
+    if (config->progressPath && config->progressInterval > 0)
+    {
+        pthread_mutex_lock(&s.lock);
+        s.finished = 1;
+        pthread_cond_signal(&s.progressCond);
+        pthread_mutex_unlock(&s.lock);
+        pthread_join(progressTid, NULL);
+        reportProgress(&s, 1);
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        Worker *w = &workers[i];
+        for (j = 0; j < STAGE_NUM; j++)
+        {
+            s.stats.stageWall[j] += w->stats.stageWall[j];
+            s.stats.stageCpu[j] += w->stats.stageCpu[j];
+        }
+        free(w->column);
+        free(w->nextColumn);
+        free(w->scratch.clusters);
+        freeGenerator(w->g);
+    }
+
+    if (config->order == ORDER_SPIRAL)
+        s.stats.exactRadius = s.nextReport == s.tileNum ? -1 : s.nextReport > 2 ? (s.nextReport - 2) * 512 : 0;
+    if (s.timeUp && !isCancelled(&s))
+    {
+        // the best answer in time: every cluster found, also in the tiles
+        // that are not finished or not reported yet
+        for (i = s.nextReport; i < s.tileNum; i++)
+        {
+            if (s.tiles[i].done || s.tiles[i].partial)
+                reportTile(&s, &s.tiles[i]);
+        }
+        flushPending(&s);
+    }
+
+    if (config->checkpointPath)
+        writeCheckpoint(&s, takeCheckpoint(&s));
+    if (s.cache)
+    {
+        TileCacheStats cacheStats;
+        getTileCacheStats(s.cache, &cacheStats);
+        s.stats.cacheHits += cacheStats.hits;
+        s.stats.cacheMisses += cacheStats.misses;
+        if (s.cache != config->cache)
+            closeTileCache(s.cache);
+    }
+
+    // the counters only cover the finished tiles, with the ones of the
+    // checkpoint, and the ones cut by the time budget
+    for (i = 0; i < s.tileNum; i++)
+    {
+        TileResult *t = &s.tiles[i];
+        free(t->clusters);
+        if (t->skip || !(t->done || t->partial))
+            continue;
+        s.stats.tilesDone += t->done;
+        s.stats.regions += t->regions;
+        s.stats.geometric += t->geometric;
+        s.stats.candidates += t->candidates;
+        for (j = 0; j < 4; j++)
+            s.stats.biomeChecks[j] += t->biomeChecks[j];
+    }
+    s.stats.areaRegions = s.shardRegions;
+    s.stats.tiles = s.shardTiles;
+    s.stats.queueCapacity = s.queueCap;
+    s.stats.queueMean = s.stats.batches ? (double) s.queueDepthSum / s.stats.batches : 0;
+    s.stats.threads = threads;
+    s.stats.wall = wallTime() - startWall;
+    s.stats.cpu = (double)(clock() - startCpu) / CLOCKS_PER_SEC;
+    if (stats)
+        *stats = s.stats;
+
+    pthread_cond_destroy(&s.queueCond);
+    pthread_cond_destroy(&s.progressCond);
+    pthread_mutex_destroy(&s.checkpointLock);
+    pthread_mutex_destroy(&s.lock);
+    free(tids);
+    free(workers);
+    free(s.window);
+    free(s.pending);
+    free(s.queue);
+    free(s.tiles);
+    if (s.stats.tilesDone == s.stats.tiles || s.limitReached)
+        return 0;
+    return s.timeUp && !isCancelled(&s) ? 2 : 1;
+}
+
+void writeSearchReport(FILE *fp, const char *version, const SearchConfig *config,
+        const SearchStats *stats)
+{
+    int i;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"seed\": %" PRId64 ",\n", config->seed);
+    fprintf(fp, "  \"version\": \"%s\",\n", version);
+    fprintf(fp, "  \"search_range\": %d,\n", config->searchRange);
+    fprintf(fp, "  \"min_huts\": %d,\n", config->minHuts);
+    fprintf(fp, "  \"prefilter\": %s,\n", config->prefilter ? "true" : "false");
+    fprintf(fp, "  \"threads\": %d,\n", stats->threads);
+    fprintf(fp, "  \"shard\": \"%d/%d\",\n", config->shardNum > 1 ? config->shard : 0,
+            config->shardNum > 1 ? config->shardNum : 1);
+    fprintf(fp, "  \"tiles\": %d,\n", stats->tiles);
+    fprintf(fp, "  \"tiles_done\": %d,\n", stats->tilesDone);
+    fprintf(fp, "  \"area_regions\": %" PRId64 ",\n", stats->areaRegions);
+    fprintf(fp, "  \"coverage\": %.6f,\n", stats->areaRegions ? (double) stats->regions / stats->areaRegions : 1.0);
+    fprintf(fp, "  \"counters\": {\n");
+    fprintf(fp, "    \"regions\": %" PRId64 ",\n", stats->regions);
+    fprintf(fp, "    \"geometric\": %" PRId64 ",\n", stats->geometric);
+    fprintf(fp, "    \"candidates\": %" PRId64 ",\n", stats->candidates);
+    fprintf(fp, "    \"biome_checks\": [%" PRId64 ", %" PRId64 ", %" PRId64 ", %" PRId64 "],\n",
+            stats->biomeChecks[0], stats->biomeChecks[1], stats->biomeChecks[2], stats->biomeChecks[3]);
+    fprintf(fp, "    \"clusters\": {\"2\": %" PRId64 ", \"3\": %" PRId64 ", \"4\": %" PRId64 "}\n",
+            stats->clusters[0], stats->clusters[1], stats->clusters[2]);
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"queue\": {\"capacity\": %d, \"batches\": %" PRId64 ", \"mean_depth\": %.2f, "
+            "\"max_depth\": %d, \"full\": %" PRId64 "},\n",
+            stats->queueCapacity, stats->batches, stats->queueMean, stats->queueMax, stats->queueFull);
+    if (config->cacheDir || config->cache)
+    {
+        fprintf(fp, "  \"cache\": {\"hits\": %" PRId64 ", \"misses\": %" PRId64 "},\n",
+                stats->cacheHits, stats->cacheMisses);
+    }
+    fprintf(fp, "  \"stages\": {\n");
+    for (i = 0; i < STAGE_NUM; i++)
+    {
+        fprintf(fp, "    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}%s\n", stageNames[i],
+                stats->stageWall[i], stats->stageCpu[i], i < STAGE_NUM-1 ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"total\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}\n", stats->wall, stats->cpu);
+    fprintf(fp, "}\n");
+}
+
+static const char *mergeVersions[] = {"1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.13.2", "1.14", "1.15"};
+static const char *formatNames[OUTPUT_NUM] = {"text", "csv", "ndjson", "binary"};
+
+/* Keeps the "Using seed" line of the first search merged and warns once per
+ * file about clusters of another search.
+ */
+static void checkSearch(char *header, const char *line, const char *path, int *warned)
+{
+    if (header[0] == 0)
+        strcpy(header, line);
+    else if (strcmp(header, line) != 0 && !*warned)
+    {
+        fprintf(stderr, "Warning: %s is from another search: %s", path, line);
+        *warned = 1;
+    }
+}
+
+static int64_t getLE(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    while (bytes--)
+        v = v << 8 | p[bytes];
+    return (int64_t) v;
+}
+
+static int readBinaryResults(FILE *fp, const char *path, TileResult *all, char *header)
+{
+    unsigned char buf[12];
+    size_t n;
+    int64_t seed;
+    int mcversion, warned = 0;
+    char line[256];
+
+    if (fread(buf, 1, 12, fp) != 12)
+        return -1;
+    seed = getLE(buf, 8);
+    mcversion = (int) getLE(buf + 8, 4);
+    if (mcversion < 0 || mcversion > MC_1_15)
+        return -1;
+    sprintf(line, "Using seed %" PRId64 " and version %s\n", seed, mergeVersions[mcversion]);
+    checkSearch(header, line, path, &warned);
+
+    while ((n = fread(buf, 1, 9, fp)) == 9)
+    {
+        Cluster c = {buf[0], (int) getLE(buf + 1, 4), (int) getLE(buf + 5, 4), 0, 0, 0, 0};
+        addCluster(all, c);
+    }
+    return n == 0 ? 0 : -1;
+}
+
+/* Reads the lines of a text, csv or ndjson result file, returns the line
+ * number that could not be read or 0.
+ */
+static int readLineResults(FILE *fp, int format, const char *path, TileResult *all, char *header)
+{
+    char line[256], search[256], version[16];
+    int64_t seed;
+    int num = 0, warned = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        Cluster c = {0, 0, 0, 0, 0, 0, 0};
+        int ok = 0;
+        num++;
+        switch (format)
+        {
+        case OUTPUT_CSV:
+            ok = strcmp(line, "seed,version,huts,x,z\n") == 0 ||
+                sscanf(line, "%" SCNd64 ",%15[^,],%d,%d,%d", &seed, version, &c.huts, &c.x, &c.z) == 5;
+            break;
+        case OUTPUT_NDJSON:
+            ok = sscanf(line, "{\"seed\":%" SCNd64 ",\"version\":\"%15[^\"]\",\"huts\":%d,\"x\":%d,\"z\":%d}",
+                    &seed, version, &c.huts, &c.x, &c.z) == 5;
+            break;
+        default:
+            if (sscanf(line, "CENTER for %d huts: %d,%d", &c.huts, &c.x, &c.z) == 3)
+                addCluster(all, c);
+            else if (strncmp(line, "Using seed", 10) == 0)
+                checkSearch(header, line, path, &warned);
+            else
+                return num;
+            continue;
+        }
+        if (!ok)
+            return num;
+        if (c.huts)
+        {
+            sprintf(search, "Using seed %" PRId64 " and version %s\n", seed, version);
+            checkSearch(header, search, path, &warned);
+            addCluster(all, c);
+        }
+    }
+    return 0;
+}
+
+int mergeResults(FILE *out, const char **paths, int n)
+{
+    TileResult all;
+    char first[8], header[256] = "";
+    int i, k, format, bad, written = 0;
+
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < n; i++)
+    {
+        FILE *fp = fopen(paths[i], "rb");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "Could not open %s\n", paths[i]);
+            free(all.clusters);
+            return -1;
+        }
+        // the format is told by the start of the file
+        memset(first, 0, sizeof(first));
+        if (fread(first, 1, 4, fp) == 4 && memcmp(first, OUTPUT_BINARY_MAGIC, 4) == 0)
+            format = OUTPUT_BINARY;
+        else if (first[0] == 0 || strncmp(first, "Usin", 4) == 0 || strncmp(first, "CENT", 4) == 0)
+            format = OUTPUT_TEXT;
+        else if (strncmp(first, "seed", 4) == 0)
+            format = OUTPUT_CSV;
+        else if (first[0] == '{')
+            format = OUTPUT_NDJSON;
+        else
+        {
+            fprintf(stderr, "Could not read %s: not a result file in the text, csv, ndjson or binary format\n",
+                    paths[i]);
+            fclose(fp);
+            free(all.clusters);
+            return -1;
+        }
+
+        if (format == OUTPUT_BINARY)
+            bad = readBinaryResults(fp, paths[i], &all, header);
+        else
+        {
+            rewind(fp);
+            bad = readLineResults(fp, format, paths[i], &all, header);
+        }
+        fclose(fp);
+        if (bad)
+        {
+            if (bad > 0)
+                fprintf(stderr, "Could not read line %d of %s in the %s format\n", bad, paths[i], formatNames[format]);
+            else
+                fprintf(stderr, "Could not read %s: truncated or invalid %s file\n", paths[i], formatNames[format]);
+            free(all.clusters);
+            return -1;
+        }
+    }
+
+    qsort(all.clusters, all.num, sizeof(*all.clusters), cmpCluster);
+    fputs(header, out);
+    for (k = 0; k < all.num; k++)
+    {
+        if (k > 0 && cmpCluster(&all.clusters[k-1], &all.clusters[k]) == 0)
+            continue;
+        fprintf(out, "CENTER for %d huts: %d,%d\n", all.clusters[k].huts, all.clusters[k].x, all.clusters[k].z);
+        written++;
+    }
+    free(all.clusters);
+    return written;
+}
+
+int getCpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#endif
+}
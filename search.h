@@ -0,0 +1,200 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include "finders.h"
+#include "tilecache.h"
+
+#include <signal.h>
+
+/* Squared block distance under which two huts can be loaded from one spot. */
+#define HUT_PAIR_DIST 65536
+
+/* Squared block distance every hut of a cluster must have to its centre. */
+#define HUT_CENTER_DIST 16384
+
+/* Distance of the world border from 0,0 in blocks. The regions of 512 blocks
+ * from WORLD_MIN_REGION to WORLD_MAX_REGION lie entirely inside.
+ */
+#define WORLD_BORDER 30000000
+#define WORLD_MIN_REGION (-(WORLD_BORDER / 512))
+#define WORLD_MAX_REGION (WORLD_BORDER / 512 - 1)
+
+/* Largest searchRange, it covers the whole world. */
+#define WORLD_SEARCH_RANGE WORLD_MAX_REGION
+
+
+//==============================================================================
+// Quad Hut Filters
+//==============================================================================
+
+/* Squared euclidean distance between (x1, y1) and (x2, y2). */
+int euclideanDistance(int x1, int y1, int x2, int y2);
+
+/* Geometric filter for the 2x2 regions block of the huts 'qhpos', it returns
+ * non-zero if at least one pair of huts is closer than HUT_PAIR_DIST.
+ */
+int hasCloseHuts(const Pos qhpos[4]);
+
+/* Biome prefilter for the 2x2 regions block starting at region (regX, regZ).
+ * Counts the scale 256 cells of the block for which mapBiome can roll a
+ * swamp, 'l' has to be a layer with base seed 200 seeded with the world seed.
+ * A count below the number of huts wanted rules the block out, the opposite
+ * is not guaranteed.
+ */
+int countSwampCandidates(Layer *l, int regX, int regZ);
+
+
+//==============================================================================
+// Quad Hut Search
+//==============================================================================
+
+enum SearchOrder
+{
+    ORDER_RASTER,       // region columns from west to east
+    ORDER_SPIRAL,       // rings of region blocks around a center, nearest first
+    ORDER_HILBERT,      // square tiles along a Hilbert curve, sorted by position at the end
+};
+
+STRUCT(SearchConfig)
+{
+    int mcversion;
+    int64_t seed;
+    int searchRange;    // the regions -searchRange to searchRange are scanned, at most WORLD_SEARCH_RANGE
+    int minHuts;        // smallest cluster reported: 2, 3 or 4
+    int prefilter;      // use countSwampCandidates(), may let through wrong doubles
+    int threads;        // number of worker threads, <= 1 scans on the caller
+    const char *progressPath;   // progress report: NULL for none, "-" for stderr or a status file
+    double progressInterval;    // seconds between two progress reports
+    const char *checkpointPath; // finished tiles are saved to this file, NULL for none
+    double checkpointInterval;  // seconds between two checkpoints
+    int resume;                 // continue from the checkpoint
+    int shard, shardNum;        // only search the part 'shard' of 'shardNum', 0 parts for all
+    int order;                  // SearchOrder
+    int centerX, centerZ;       // origin of a spiral search, in blocks
+    int limit;                  // a spiral search stops after this many clusters, 0 for no limit
+    double timeBudget;          // seconds after which the search returns what it found, 0 for none
+    const char *cacheDir;       // tile cache of the biome checks, NULL for none
+    int64_t cacheBytes;         // size limit of a new cache file
+    TileCache *cache;           // open cache of the seed used instead of cacheDir, NULL for none
+    const volatile sig_atomic_t *stop;  // the search stops once this is non-zero, NULL for none
+};
+
+enum SearchStage
+{
+    STAGE_STRUCTURES,   // hut positions of the region columns
+    STAGE_FILTERS,      // geometric filter and prefilter, producing candidate batches
+    STAGE_BIOMES,       // biome checks of the candidate batches
+    STAGE_NUM
+};
+
+STRUCT(SearchStats)
+{
+    int64_t regions;    // 2x2 region blocks scanned
+    int64_t geometric;  // blocks passing hasCloseHuts()
+    int64_t candidates; // blocks passing the filters, their biomes get checked
+    int64_t biomeChecks[4]; // getBiomeAtPos() calls for each hut of a block
+    int64_t clusters[3];// clusters of 2, 3 and 4 huts reported, without duplicates
+
+    double stageWall[STAGE_NUM]; // seconds, summed over the threads
+    double stageCpu[STAGE_NUM];
+    double wall, cpu;   // whole search
+    int threads;
+    int tiles, tilesDone;   // work units of the search, done ones include the checkpoint
+    int64_t areaRegions;    // region blocks of the area, to compare with 'regions'
+    int64_t exactRadius;    // spiral search: every cluster this close to the center was reported, -1 for all
+
+    int queueCapacity;      // candidate batches between the filters and the biome checks
+    int64_t batches;        // batches queued
+    double queueMean;       // mean queue depth once a batch is queued
+    int queueMax;
+    int64_t queueFull;      // batches a producer checked itself as the queue was full
+
+    int64_t cacheHits, cacheMisses; // tiles of the biome checks read from and added to the cache
+};
+
+/* Called for every cluster found, 'x' and 'z' are the block coordinates of
+ * its centre. The calls are serialised and follow the scan order, region
+ * column by region column, whatever the number of threads. A cluster found
+ * by two overlapping region blocks is only reported once.
+ */
+typedef void (*ClusterCallback)(void *data, int huts, int x, int z);
+
+/* Searches the configured area for clusters of at least 'minHuts' witch huts.
+ * initBiomes() has to be called first. The totals are stored in 'stats'.
+ *
+ * The search runs in two stages: the hut positions and the cheap filters of
+ * a tile produce batches of candidates, which go through a bounded queue to
+ * the biome checks. Every thread checks the queued batches before it takes a
+ * new tile, and a producer facing a full queue checks a batch itself.
+ * Returns 0 when the whole area was searched, 1 if the search was stopped
+ * with requestSearchStop() or its 'stop' flag, 2 if the time budget ran out and -1 if the
+ * checkpoint could not be resumed.
+ *
+ * With a 'checkpointPath' the finished tiles, their clusters and counters are
+ * saved every 'checkpointInterval' seconds and when the search returns. With
+ * 'resume' the search skips the tiles of the checkpoint and reports their
+ * clusters again first, so the callback sees the same sequence as without
+ * interruption.
+ *
+ * With 'shardNum' > 1 the tiles are dealt round-robin to the shards and only
+ * the tiles of 'shard' are searched. The shards of one search can run on
+ * different machines, mergeResults() combines their outputs.
+ *
+ * With the ORDER_HILBERT order the area is cut into squares visited along a
+ * Hilbert curve, so that the consecutive tiles of a thread are neighbours.
+ * The clusters are reported at the end, sorted by x, z and hut count.
+ *
+ * The area is clipped to the world border, a 'searchRange' above
+ * WORLD_SEARCH_RANGE searches the whole world.
+ *
+ * With the ORDER_SPIRAL order the rings of region blocks around the center
+ * block are searched outwards up to the ring 'searchRange', and the clusters
+ * are reported by increasing distance to (centerX, centerZ). A cluster is
+ * held back until the rings that could hold a nearer one are done. With a
+ * 'limit' the search stops once that many clusters have been reported, they
+ * are then the nearest ones of the area.
+ *
+ * With a 'timeBudget' the threads stop at the end of their current region
+ * column or ring side once the time is up, measured on the monotonic clock.
+ * All the clusters found by then are reported, including the ones of the
+ * tiles cut short, and 'regions' tells how much of the area was covered.
+ * The spiral order makes the best use of a budget: the nearest blocks are
+ * searched first.
+ *
+ * With a 'cacheDir' the biome checks read the scale 1 biomes from the tile
+ * cache of the seed in that directory, see openTileCache(). The tiles they
+ * generate are added to it, so the biome checks of a rerun on the same seed
+ * skip the generator. An open 'cache' of the scale 1 layer of the seed, which
+ * other searches may share, is used as it is.
+ *
+ * With a 'progressPath' a reporter thread prints the fraction of the regions
+ * done, the regions and candidates per second and an ETA every
+ * 'progressInterval' seconds. On stderr this is one line per report, a status
+ * file is replaced by a JSON object each time.
+ */
+int searchQuadHuts(const SearchConfig *config, ClusterCallback callback, void *data,
+        SearchStats *stats);
+
+/* Makes the running searches stop after their current region column, it is
+ * safe to call from a signal handler. The request is never withdrawn, so it
+ * is meant for a program that exits afterwards; a process that runs many
+ * searches stops them one by one with their 'stop' flag.
+ */
+void requestSearchStop(void);
+
+/* Writes the configuration and the statistics of a search as a JSON object. */
+void writeSearchReport(FILE *fp, const char *version, const SearchConfig *config,
+        const SearchStats *stats);
+
+/* Reads the clusters of the result files 'paths', as written by main in any
+ * OutputFormat, and writes them to 'out' in the text format sorted by
+ * position without duplicates. Returns the number of clusters written or -1
+ * if a file could not be opened or is not in one of the formats, which is
+ * printed with the name of the file and the format.
+ */
+int mergeResults(FILE *out, const char **paths, int n);
+
+/* Number of online processors, used as the default thread count. */
+int getCpuCount(void);
+
+#endif /* SEARCH_H_ */
@@ -0,0 +1,617 @@
+#include "server.h"
+#include "search.h"
+#include "tilecache.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LINE        (1 << 20)   // longest request, with its batch of positions
+#define MAX_WORDS       65536
+#define POLL_MS         200         // the idle threads check the stop flag this often
+#define CACHE_TILE_SIDE 64          // same tiles as the biome checks of a search
+#define BACKLOG         64
+#define SEARCH_TIMEOUT  60.0        // seconds, deadline of a search sent without one
+#define MAX_HUTS_SIDE   65536       // blocks per side of a huts area, 128 regions
+
+
+static const char *versionNames[MC_LEG] =
+{
+    "1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.13.2", "1.14", "1.15"
+};
+
+STRUCT(SeedEntry)
+{
+    int64_t seed;
+    int mcversion;
+    TileCache *cache;   // NULL for a free entry
+    int refs;           // requests using the cache
+    uint64_t lastUse;
+};
+
+STRUCT(Server)
+{
+    const ServerConfig *config;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // a connection was queued or the server stops
+    int *conns;                 // accepted connections waiting for a thread
+    int connHead, connNum, connCap;
+    SeedEntry *seeds;
+    uint64_t useCount;
+};
+
+STRUCT(ServerWorker)
+{
+    Server *server;
+    LayerStack g[MC_LEG];   // set up on first use
+    int64_t seed[MC_LEG];
+    char *in;               // bytes read from the connection
+    size_t inLen, inCap;
+    char *out;              // reply being built
+    size_t outLen, outCap;
+    double deadline;
+};
+
+static volatile sig_atomic_t serverStop;
+
+void requestServerStop(void)
+{
+    serverStop = 1;
+}
+
+static double wallTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int parseVersion(const char *name)
+{
+    int i;
+    for (i = 0; i < MC_LEG; i++)
+    {
+        if (strcmp(name, versionNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void appendf(ServerWorker *w, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(w->out + w->outLen, w->outCap - w->outLen, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && w->outLen + n < w->outCap)
+            break;
+        w->outCap = 2 * w->outCap + n;
+        w->out = (char *) realloc(w->out, w->outCap);
+    }
+    w->outLen += n;
+}
+
+static int sendAll(int fd, const char *p, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Reads the next request of the connection, without the line break. Returns
+ * NULL once the client is gone, the line is too long or the server stops.
+ */
+static char *readLine(ServerWorker *w, int fd, size_t *consumed)
+{
+    size_t scanned = 0;
+
+    for (;;)
+    {
+        char *nl = (char *) memchr(w->in + scanned, '\n', w->inLen - scanned);
+        struct pollfd pfd = {fd, POLLIN, 0};
+        ssize_t n;
+
+        if (nl)
+        {
+            *nl = 0;
+            if (nl > w->in && nl[-1] == '\r')
+                nl[-1] = 0;
+            *consumed = nl + 1 - w->in;
+            return w->in;
+        }
+        scanned = w->inLen;
+        if (w->inLen >= MAX_LINE)
+            return NULL;
+        if (w->inLen + 4096 > w->inCap)
+        {
+            w->inCap = 2 * w->inCap + 4096;
+            w->in = (char *) realloc(w->in, w->inCap);
+        }
+        n = poll(&pfd, 1, POLL_MS);
+        if (serverStop)
+            return NULL;
+        if (n <= 0)
+            continue;
+        n = read(fd, w->in + w->inLen, w->inCap - w->inLen);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return NULL;
+        w->inLen += n;
+    }
+}
+
+/* Returns the generator of the version seeded with 'seed'. */
+static LayerStack *getGenerator(ServerWorker *w, int mcversion, int64_t seed)
+{
+    LayerStack *g = &w->g[mcversion];
+    if (g->layers == NULL)
+    {
+        *g = setupGenerator(mcversion);
+        applySeed(g, seed);
+    }
+    else if (w->seed[mcversion] != seed)
+    {
+        applySeed(g, seed);
+    }
+    w->seed[mcversion] = seed;
+    return g;
+}
+
+/* Takes the warm tile cache of the seed, replacing the least recently used
+ * one that is not in use. Returns NULL if all of them are in use.
+ */
+static SeedEntry *acquireSeed(Server *s, int mcversion, int64_t seed)
+{
+    const ServerConfig *config = s->config;
+    SeedEntry *e = NULL;
+    TileCache *old = NULL;
+    int i;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < config->seedNum; i++)
+    {
+        SeedEntry *t = &s->seeds[i];
+        if (t->cache && t->seed == seed && t->mcversion == mcversion)
+        {
+            e = t;
+            break;
+        }
+    }
+    if (e == NULL)
+    {
+        for (i = 0; i < config->seedNum; i++)
+        {
+            SeedEntry *t = &s->seeds[i];
+            if (t->refs == 0 && (e == NULL || (e->cache && (!t->cache || t->lastUse < e->lastUse))))
+                e = t;
+        }
+        if (e)
+        {
+            // opening only maps the file, the old cache is flushed unlocked
+            old = e->cache;
+            e->seed = seed;
+            e->mcversion = mcversion;
+            // the warm seeds share the limit
+            e->cache = openTileCache(config->cacheDir, seed, mcversion, -1, CACHE_TILE_SIDE,
+                    config->cacheBytes / config->seedNum);
+        }
+    }
+    if (e)
+    {
+        e->refs++;
+        e->lastUse = ++s->useCount;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (old)
+        closeTileCache(old);
+    return e;
+}
+
+static void releaseSeed(Server *s, SeedEntry *e)
+{
+    if (e == NULL)
+        return;
+    pthread_mutex_lock(&s->lock);
+    e->refs--;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int getBiome(SeedEntry *e, LayerStack *g, int x, int z)
+{
+    Pos pos = {x, z};
+    return e && e->cache ? getCachedBiome(e->cache, g, x, z) : getBiomeAtPos(*g, pos);
+}
+
+static int timedOut(const ServerWorker *w)
+{
+    return w->deadline > 0 && wallTime() > w->deadline;
+}
+
+static void handleBiomes(ServerWorker *w, int mcversion, int64_t seed, char **words, int n)
+{
+    LayerStack *g = getGenerator(w, mcversion, seed);
+    SeedEntry *e;
+    int *ids = (int *) malloc(n * sizeof(int));
+    int i, x, z;
+
+    for (i = 0; i < n; i++)
+    {
+        if (sscanf(words[i], "%d,%d", &x, &z) != 2)
+        {
+            appendf(w, "ERR bad position %s\n", words[i]);
+            free(ids);
+            return;
+        }
+    }
+    e = acquireSeed(w->server, mcversion, seed);
+    for (i = 0; i < n; i++)
+    {
+        if ((i & 63) == 0 && timedOut(w))
+            break;
+        sscanf(words[i], "%d,%d", &x, &z);
+        ids[i] = getBiome(e, g, x, z);
+    }
+    releaseSeed(w->server, e);
+
+    if (i < n)
+    {
+        appendf(w, "ERR deadline\n");
+    }
+    else
+    {
+        appendf(w, "OK");
+        for (i = 0; i < n; i++)
+            appendf(w, " %d", ids[i]);
+        appendf(w, "\n");
+    }
+    free(ids);
+}
+
+static void handleHuts(ServerWorker *w, int mcversion, int64_t seed, int x, int z, int width, int height)
+{
+    const StructureConfig sconf = mcversion >= MC_1_13 ? SWAMP_HUT_CONFIG : FEATURE_CONFIG;
+    const int64_t regionBlocks = sconf.regionSize * 16;
+    int64_t x1 = (int64_t) x + width, z1 = (int64_t) z + height;
+    int64_t rx0 = x >= 0 ? x / regionBlocks : -((-(int64_t) x + regionBlocks - 1) / regionBlocks);
+    int64_t rz0 = z >= 0 ? z / regionBlocks : -((-(int64_t) z + regionBlocks - 1) / regionBlocks);
+    LayerStack *g = getGenerator(w, mcversion, seed);
+    SeedEntry *e = acquireSeed(w->server, mcversion, seed);
+    int64_t rx, rz;
+    int count = 0;
+
+    for (rz = rz0; rz * regionBlocks < z1; rz++)
+    {
+        if (timedOut(w))
+            break;
+        for (rx = rx0; rx * regionBlocks < x1; rx++)
+        {
+            Pos p = getStructurePos(sconf, seed, (int) rx, (int) rz);
+            if (p.x < x || p.x >= x1 || p.z < z || p.z >= z1)
+                continue;
+            if (getBiome(e, g, p.x, p.z) != swampland)
+                continue;
+            appendf(w, "HUT %d %d\n", p.x, p.z);
+            count++;
+        }
+    }
+    releaseSeed(w->server, e);
+
+    if (rz * regionBlocks < z1)
+    {
+        w->outLen = 0;
+        appendf(w, "ERR deadline\n");
+    }
+    else
+    {
+        appendf(w, "OK %d\n", count);
+    }
+}
+
+static void appendCluster(void *data, int huts, int x, int z)
+{
+    appendf((ServerWorker *) data, "CENTER for %d huts: %d,%d\n", huts, x, z);
+}
+
+static void handleSearch(ServerWorker *w, int mcversion, int64_t seed, char **words, int n)
+{
+    SearchConfig config;
+    SearchStats stats;
+    SeedEntry *e;
+    int64_t range;
+    long limit = 0;
+    char *end = NULL;
+    int status;
+
+    memset(&config, 0, sizeof(config));
+    config.mcversion = mcversion;
+    config.seed = seed;
+    config.prefilter = 1;
+    config.threads = 1;
+    config.order = ORDER_RASTER;
+    range = n > 0 ? strtoll(words[0], NULL, 10) / 512 : -1;
+    config.minHuts = n > 1 ? atoi(words[1]) : 0;
+    if (n > 3)
+        limit = strtol(words[3], &end, 10);
+    if (n < 2 || n > 4 || range < 1 || config.minHuts < 2 || config.minHuts > 4 ||
+        (n > 2 && sscanf(words[2], "%d,%d", &config.centerX, &config.centerZ) != 2) ||
+        (n > 3 && (*end != '\0' || limit < 1 || limit > INT_MAX)))
+    {
+        appendf(w, "ERR usage: search VERSION SEED RANGE MINHUTS [X,Z [LIMIT]]\n");
+        return;
+    }
+    config.searchRange = range > WORLD_SEARCH_RANGE ? WORLD_SEARCH_RANGE : (int) range;
+    if (n > 2)
+        config.order = ORDER_SPIRAL;
+    config.limit = (int) limit;
+    config.stop = &serverStop;
+    // a search over the whole world would run for hours
+    config.timeBudget = w->deadline > 0 ? w->deadline - wallTime() : SEARCH_TIMEOUT;
+    if (config.timeBudget <= 0)
+    {
+        appendf(w, "ERR deadline\n");
+        return;
+    }
+
+    e = acquireSeed(w->server, mcversion, seed);
+    config.cache = e ? e->cache : NULL;
+    status = searchQuadHuts(&config, appendCluster, w, &stats);
+    releaseSeed(w->server, e);
+
+    if (status == 0 || status == 2)
+    {
+        appendf(w, "OK %" PRId64 " %s\n", stats.clusters[0] + stats.clusters[1] + stats.clusters[2],
+                status == 0 ? "complete" : "partial");
+    }
+    else
+    {
+        w->outLen = 0;
+        appendf(w, "ERR stopped\n");
+    }
+}
+
+/* Answers one request into the reply buffer. */
+static void handleRequest(ServerWorker *w, char *line, char **words)
+{
+    const ServerConfig *config = w->server->config;
+    int n = 0, i, mcversion;
+    double timeout = config->timeout;
+    int64_t seed;
+    char *save, *word, *end;
+
+    for (word = strtok_r(line, " \t", &save); word; word = strtok_r(NULL, " \t", &save))
+    {
+        if (strncmp(word, "timeout=", 8) == 0)
+            timeout = atof(word + 8) / 1000;
+        else if (n < MAX_WORDS)
+            words[n++] = word;
+    }
+    w->deadline = timeout > 0 ? wallTime() + timeout : 0;
+    if (n == 0)
+    {
+        appendf(w, "ERR empty request\n");
+        return;
+    }
+    if (strcmp(words[0], "ping") == 0)
+    {
+        appendf(w, "OK\n");
+        return;
+    }
+    if (n < 3)
+    {
+        appendf(w, "ERR usage: %s VERSION SEED ...\n", words[0]);
+        return;
+    }
+    mcversion = parseVersion(words[1]);
+    errno = 0;
+    seed = strtoll(words[2], &end, 10);
+    if (mcversion < 0 || errno || *end)
+    {
+        appendf(w, "ERR bad version or seed\n");
+        return;
+    }
+
+    if (strcmp(words[0], "biome") == 0 && n == 5)
+    {
+        char pos[64];
+        snprintf(pos, sizeof(pos), "%s,%s", words[3], words[4]);
+        words[3] = pos;
+        handleBiomes(w, mcversion, seed, words + 3, 1);
+    }
+    else if (strcmp(words[0], "biomes") == 0 && n > 3)
+    {
+        handleBiomes(w, mcversion, seed, words + 3, n - 3);
+    }
+    else if (strcmp(words[0], "huts") == 0 && n == 7)
+    {
+        int area[4];
+        for (i = 0; i < 4; i++)
+            area[i] = atoi(words[3 + i]);
+        if (area[2] <= 0 || area[3] <= 0)
+            appendf(w, "ERR bad area\n");
+        else if (area[2] > MAX_HUTS_SIDE || area[3] > MAX_HUTS_SIDE)
+            appendf(w, "ERR area larger than %d blocks\n", MAX_HUTS_SIDE);
+        else
+            handleHuts(w, mcversion, seed, area[0], area[1], area[2], area[3]);
+    }
+    else if (strcmp(words[0], "search") == 0)
+    {
+        handleSearch(w, mcversion, seed, words + 3, n - 3);
+    }
+    else
+    {
+        appendf(w, "ERR unknown request %s\n", words[0]);
+    }
+}
+
+static void serveConnection(ServerWorker *w, int fd)
+{
+    char **words = (char **) malloc(MAX_WORDS * sizeof(char *));
+    size_t consumed;
+    char *line;
+
+    w->inLen = 0;
+    while ((line = readLine(w, fd, &consumed)) != NULL)
+    {
+        w->outLen = 0;
+        handleRequest(w, line, words);
+        if (sendAll(fd, w->out, w->outLen) != 0)
+            break;
+        memmove(w->in, w->in + consumed, w->inLen - consumed);
+        w->inLen -= consumed;
+    }
+    free(words);
+    close(fd);
+}
+
+static void *serverWorker(void *arg)
+{
+    ServerWorker *w = (ServerWorker *) arg;
+    Server *s = w->server;
+    int i;
+
+    for (;;)
+    {
+        int fd;
+        pthread_mutex_lock(&s->lock);
+        while (s->connNum == 0 && !serverStop)
+        {
+            // woken by the accept loop, which also checks the stop flag
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if (s->connNum == 0)
+        {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        fd = s->conns[s->connHead];
+        s->connHead = (s->connHead + 1) % s->connCap;
+        s->connNum--;
+        pthread_mutex_unlock(&s->lock);
+        serveConnection(w, fd);
+    }
+
+    for (i = 0; i < MC_LEG; i++)
+    {
+        if (w->g[i].layers)
+            freeGenerator(w->g[i]);
+    }
+    free(w->in);
+    free(w->out);
+    return NULL;
+}
+
+int runServer(const ServerConfig *config)
+{
+    const int threads = config->threads > 1 ? config->threads : 1;
+    struct sockaddr_un addr;
+    ServerWorker *workers;
+    pthread_t *tids;
+    Server s;
+    int fd, i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(config->socketPath) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, config->socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    unlink(config->socketPath);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, BACKLOG) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    serverStop = 0;
+    memset(&s, 0, sizeof(s));
+    s.config = config;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    s.connCap = BACKLOG * threads;
+    s.conns = (int *) malloc(s.connCap * sizeof(int));
+    s.seeds = (SeedEntry *) calloc(config->seedNum > 0 ? config->seedNum : 1, sizeof(SeedEntry));
+
+    workers = (ServerWorker *) calloc(threads, sizeof(*workers));
+    tids = (pthread_t *) malloc(threads * sizeof(*tids));
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].server = &s;
+        pthread_create(&tids[i], NULL, serverWorker, &workers[i]);
+    }
+
+    while (!serverStop)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int conn;
+
+        if (poll(&pfd, 1, POLL_MS) <= 0)
+            continue;
+        conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+            continue;
+        pthread_mutex_lock(&s.lock);
+        if (s.connNum == s.connCap)
+        {
+            pthread_mutex_unlock(&s.lock);
+            sendAll(conn, "ERR busy\n", 9);
+            close(conn);
+            continue;
+        }
+        s.conns[(s.connHead + s.connNum) % s.connCap] = conn;
+        s.connNum++;
+        pthread_cond_signal(&s.cond);
+        pthread_mutex_unlock(&s.lock);
+    }
+
+    close(fd);
+    unlink(config->socketPath);
+    pthread_mutex_lock(&s.lock);
+    // the queued connections are dropped
+    for (i = 0; i < s.connNum; i++)
+        close(s.conns[(s.connHead + i) % s.connCap]);
+    s.connNum = 0;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.lock);
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    for (i = 0; i < config->seedNum; i++)
+    {
+        if (s.seeds[i].cache)
+            closeTileCache(s.seeds[i].cache);
+    }
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+    free(s.seeds);
+    free(s.conns);
+    free(tids);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "finders.h"
+
+STRUCT(ServerConfig)
+{
+    const char *socketPath; // Unix domain socket to listen on, replaced if it exists
+    int threads;            // connections served at once
+    int seedNum;            // warm seeds kept, the least recently used is dropped
+    const char *cacheDir;   // tile files of the seeds, NULL to keep the tiles in memory
+    int64_t cacheBytes;     // tile cache limit of the server, split among the seeds
+    double timeout;         // default deadline of a request in seconds, 0 for none
+};
+
+/* Serves the requests of local clients on a Unix domain socket until
+ * requestServerStop() is called, initBiomes() has to be called first.
+ *
+ * A request is one line of words separated by spaces, the reply is any
+ * number of data lines ended by a line starting with "OK" or "ERR":
+ *
+ *   ping                                       OK
+ *   biome VERSION SEED X Z                     OK ID
+ *   biomes VERSION SEED X,Z X,Z ...            OK ID ID ...
+ *   huts VERSION SEED X Z WIDTH HEIGHT         HUT X Z lines, OK COUNT
+ *   search VERSION SEED RANGE MINHUTS [X,Z [LIMIT]]
+ *                                              CENTER lines, OK COUNT complete|partial
+ *
+ * The biomes are the scale 1 biome ids at block positions. 'huts' lists the
+ * witch huts of the area that are in a swamp, the area being at most 65536
+ * blocks on each side. 'search' runs searchQuadHuts() on one thread over
+ * RANGE blocks around 0,0, or in spiral order around X,Z stopping after LIMIT
+ * clusters, and prints the clusters like out.txt.
+ *
+ * Any request can end with "timeout=MS", its deadline counted from the moment
+ * it is read. A search returns what it found by then as "partial", the other
+ * requests reply "ERR deadline". A search without a deadline gets one of 60
+ * seconds, so that no request can keep a thread for hours.
+ *
+ * Each connection is served by one thread of a pool of 'threads', its requests
+ * in turn. Every thread keeps a generator per version, seeded again when the
+ * seed changes, and the biomes go through a tile cache per seed shared by the
+ * threads, 'seedNum' of them being kept warm. Each holds at most 'cacheBytes'
+ * / 'seedNum' of tiles, so all of them together stay within 'cacheBytes'. A
+ * tile file already in 'cacheDir' keeps the limit it was written with. Returns 0 once stopped or -1 if
+ * the socket cannot be opened.
+ */
+int runServer(const ServerConfig *config);
+
+/* Makes runServer() return once the requests being served are answered, it
+ * is safe to call from a signal handler. The running searches are cut short,
+ * they then reply "ERR stopped".
+ */
+void requestServerStop(void);
+
+#endif /* SERVER_H_ */
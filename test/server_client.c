@@ -0,0 +1,354 @@
+/* Test of the query server through a local client.
+ *
+ * The server runs on a thread of the test, listening on a socket in /tmp.
+ * Clients on several threads send biome, batch, hut and search requests for a
+ * few seeds and versions, and every reply has to equal the result of the
+ * library functions called directly. The deadlines and the errors are checked
+ * as well, then the server is stopped during a search and started again.
+ *
+ * usage: server_client
+ */
+
+#include "server.h"
+#include "search.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define CLIENTS     4
+#define POINTS      200
+
+STRUCT(Client)
+{
+    int fd;
+    FILE *fp;
+    char *reply;    // lines of the last reply
+    size_t len, cap;
+};
+
+STRUCT(ClientTask)
+{
+    const char *path;
+    int mcversion;
+    int64_t seed;
+    int failures;
+};
+
+static const char *versionNames[] = {"1.7", "1.8", "1.9", "1.10", "1.11", "1.12", "1.13", "1.13.2", "1.14", "1.15"};
+
+static int connectClient(Client *c, const char *path)
+{
+    struct sockaddr_un addr;
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // the server may not be listening yet
+    for (i = 0; i < 100; i++)
+    {
+        c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+        {
+            c->fp = fdopen(c->fd, "r+");
+            return 0;
+        }
+        close(c->fd);
+        usleep(50000);
+    }
+    return -1;
+}
+
+static void closeClient(Client *c)
+{
+    fclose(c->fp);
+    free(c->reply);
+}
+
+/* Sends a request and reads its reply, returns its last line. */
+static const char *request(Client *c, const char *fmt, ...)
+{
+    char line[4096];
+    const char *last = NULL;
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(c->fp, fmt, ap);
+    va_end(ap);
+    fputc('\n', c->fp);
+    fflush(c->fp);
+
+    c->len = 0;
+    while (fgets(line, sizeof(line), c->fp))
+    {
+        size_t n = strlen(line);
+        if (c->len + n + 1 > c->cap)
+        {
+            c->cap = 2 * c->cap + n + 1;
+            c->reply = (char *) realloc(c->reply, c->cap);
+        }
+        memcpy(c->reply + c->len, line, n + 1);
+        last = c->reply + c->len;
+        c->len += n;
+        if (strncmp(line, "OK", 2) == 0 || strncmp(line, "ERR", 3) == 0)
+            return last;
+    }
+    return "EOF\n";
+}
+
+static void appendCluster(void *data, int huts, int x, int z)
+{
+    char *out = (char *) data;
+    sprintf(out + strlen(out), "CENTER for %d huts: %d,%d\n", huts, x, z);
+}
+
+static int checkQueries(Client *c, int mcversion, int64_t seed)
+{
+    const char *version = versionNames[mcversion];
+    LayerStack g = setupGenerator(mcversion);
+    char *batch = (char *) malloc(POINTS * 32), *expected = (char *) malloc(POINTS * 8 + 64);
+    const char *reply;
+    int failures = 0;
+    int i, count;
+
+    applySeed(&g, seed);
+    srand((unsigned int) seed);
+
+    // single positions, then the same ones as a batch
+    strcpy(expected, "OK");
+    batch[0] = 0;
+    for (i = 0; i < POINTS; i++)
+    {
+        Pos p = {rand() % 200000 - 100000, rand() % 200000 - 100000};
+        int id = getBiomeAtPos(g, p);
+        char want[32];
+        sprintf(want, "OK %d\n", id);
+        reply = request(c, "biome %s %lld %d %d", version, (long long) seed, p.x, p.z);
+        if (strcmp(reply, want) != 0)
+        {
+            printf("biome %s %lld %d %d: got %s", version, (long long) seed, p.x, p.z, reply);
+            failures++;
+        }
+        sprintf(batch + strlen(batch), " %d,%d", p.x, p.z);
+        sprintf(expected + strlen(expected), " %d", id);
+    }
+    strcat(expected, "\n");
+    reply = request(c, "biomes %s %lld%s", version, (long long) seed, batch);
+    if (strcmp(reply, expected) != 0)
+    {
+        printf("biomes %s %lld: wrong reply\n", version, (long long) seed);
+        failures++;
+    }
+
+    // the huts of 8x8 regions
+    const StructureConfig sconf = mcversion >= MC_1_13 ? SWAMP_HUT_CONFIG : FEATURE_CONFIG;
+    expected[0] = 0;
+    count = 0;
+    for (i = 0; i < 64; i++)
+    {
+        Pos p = getStructurePos(sconf, seed, i % 8 - 4, i / 8 - 4);
+        if (getBiomeAtPos(g, p) == swampland)
+        {
+            sprintf(expected + strlen(expected), "HUT %d %d\n", p.x, p.z);
+            count++;
+        }
+    }
+    sprintf(expected + strlen(expected), "OK %d\n", count);
+    request(c, "huts %s %lld -2048 -2048 4096 4096", version, (long long) seed);
+    if (strcmp(c->reply, expected) != 0)
+    {
+        printf("huts %s %lld: got\n%s", version, (long long) seed, c->reply);
+        failures++;
+    }
+
+    free(batch);
+    free(expected);
+    freeGenerator(g);
+    return failures;
+}
+
+static int checkSearch(Client *c, int mcversion, int64_t seed, int range)
+{
+    SearchConfig config;
+    SearchStats stats;
+    char *expected = (char *) calloc(1, 1 << 20);
+    int failures = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.mcversion = mcversion;
+    config.seed = seed;
+    config.searchRange = range / 512;
+    config.minHuts = 2;
+    config.prefilter = 1;
+    config.threads = 1;
+    searchQuadHuts(&config, appendCluster, expected, &stats);
+    sprintf(expected + strlen(expected), "OK %lld complete\n",
+            (long long) (stats.clusters[0] + stats.clusters[1] + stats.clusters[2]));
+
+    // twice, the second one runs on the warm tiles of the first
+    for (int i = 0; i < 2; i++)
+    {
+        request(c, "search %s %lld %d 2", versionNames[mcversion], (long long) seed, range);
+        if (strcmp(c->reply, expected) != 0)
+        {
+            printf("search %s %lld %d: got\n%s", versionNames[mcversion], (long long) seed, range, c->reply);
+            failures++;
+        }
+    }
+    free(expected);
+    return failures;
+}
+
+static void *clientThread(void *arg)
+{
+    ClientTask *t = (ClientTask *) arg;
+    Client c;
+
+    if (connectClient(&c, t->path) != 0)
+    {
+        printf("cannot connect to %s\n", t->path);
+        t->failures++;
+        return NULL;
+    }
+    t->failures += checkQueries(&c, t->mcversion, t->seed);
+    closeClient(&c);
+    return NULL;
+}
+
+/* Sends a search over the whole world, which the stop of the server cuts. */
+static void *stoppedSearchThread(void *arg)
+{
+    ClientTask *t = (ClientTask *) arg;
+    Client c;
+
+    if (connectClient(&c, t->path) != 0)
+    {
+        t->failures++;
+        return NULL;
+    }
+    if (strcmp(request(&c, "search 1.14 1 30000000 2"), "ERR stopped\n") != 0)
+    {
+        printf("search during the stop: got %s", c.reply);
+        t->failures++;
+    }
+    closeClient(&c);
+    return NULL;
+}
+
+static void *serverThread(void *arg)
+{
+    static int status;
+    status = runServer((const ServerConfig *) arg);
+    return &status;
+}
+
+int main(void)
+{
+    static const int versions[CLIENTS] = {MC_1_7, MC_1_12, MC_1_13, MC_1_14};
+    char path[64];
+    ServerConfig config;
+    ClientTask tasks[CLIENTS];
+    pthread_t server, clients[CLIENTS];
+    Client c;
+    const char *reply;
+    void *status;
+    int failures = 0;
+    int i;
+
+    initBiomes();
+    sprintf(path, "/tmp/server_client_%d.sock", (int) getpid());
+    memset(&config, 0, sizeof(config));
+    config.socketPath = path;
+    config.threads = CLIENTS;
+    config.seedNum = 2;     // fewer than the clients, so seeds get dropped
+    config.cacheBytes = 64 << 20;
+    pthread_create(&server, NULL, serverThread, &config);
+
+    // concurrent clients on different seeds and versions
+    for (i = 0; i < CLIENTS; i++)
+    {
+        tasks[i].path = path;
+        tasks[i].mcversion = versions[i];
+        tasks[i].seed = 1000 + i * 7919;
+        tasks[i].failures = 0;
+        pthread_create(&clients[i], NULL, clientThread, &tasks[i]);
+    }
+    for (i = 0; i < CLIENTS; i++)
+    {
+        pthread_join(clients[i], NULL);
+        failures += tasks[i].failures;
+    }
+
+    if (connectClient(&c, path) != 0)
+    {
+        printf("cannot connect to %s\n", path);
+        return 1;
+    }
+    failures += checkSearch(&c, MC_1_12, 181201211981019340LL, 40000);
+    failures += checkSearch(&c, MC_1_14, 1, 40000);
+
+    reply = request(&c, "search 1.14 1 30000000 2 timeout=100");
+    if (strstr(reply, " partial\n") == NULL)
+    {
+        printf("search with a deadline: got %s", reply);
+        failures++;
+    }
+    // a limit has to be a positive number
+    reply = request(&c, "search 1.14 1 40000 2 0,0 abc");
+    failures += strncmp(reply, "ERR usage", 9) != 0;
+    reply = request(&c, "search 1.14 1 40000 2 0,0 -5");
+    failures += strncmp(reply, "ERR usage", 9) != 0;
+    reply = request(&c, "search 1.14 1 40000 2 0,0 0");
+    failures += strncmp(reply, "ERR usage", 9) != 0;
+    reply = request(&c, "search 1.14 1 40000 2 0,0 1");
+    failures += strcmp(reply, "OK 1 complete\n") != 0;
+    reply = request(&c, "huts 1.14 1 0 0 100000000 100000000");
+    failures += strncmp(reply, "ERR", 3) != 0;
+    reply = request(&c, "biome 1.14");
+    failures += strncmp(reply, "ERR", 3) != 0;
+    reply = request(&c, "biome 1.99 1 0 0");
+    failures += strncmp(reply, "ERR", 3) != 0;
+    reply = request(&c, "unknown 1.14 1");
+    failures += strncmp(reply, "ERR", 3) != 0;
+    reply = request(&c, "ping");
+    failures += strcmp(reply, "OK\n") != 0;
+    closeClient(&c);
+
+    // a search running when the server stops is cut short
+    tasks[0].failures = 0;
+    pthread_create(&clients[0], NULL, stoppedSearchThread, &tasks[0]);
+    usleep(500000);
+    requestServerStop();
+    pthread_join(clients[0], NULL);
+    failures += tasks[0].failures;
+    pthread_join(server, &status);
+    if (*(int *) status != 0 || access(path, F_OK) == 0)
+    {
+        printf("the server did not stop cleanly\n");
+        failures++;
+    }
+
+    // the stop does not carry over to the searches of the next server
+    pthread_create(&server, NULL, serverThread, &config);
+    if (connectClient(&c, path) != 0)
+    {
+        printf("cannot connect to %s\n", path);
+        return 1;
+    }
+    failures += checkSearch(&c, MC_1_14, 1, 40000);
+    closeClient(&c);
+    requestServerStop();
+    pthread_join(server, NULL);
+
+    printf("%s: %d failures\n", failures ? "FAILED" : "OK", failures);
+    return failures != 0;
+}
@@ -0,0 +1,155 @@
+/* Differential test of the vectorised layer kernels against the scalar ones.
+ *
+ * Every layer of the 1.7 and 1.13 generators is evaluated for random seeds and
+ * random areas with each SimdLevel the CPU supports. The outputs have to match
+ * the scalar result cell by cell, the first mismatch is reported and the test
+ * fails. The time spent per level is printed alongside as a speedup table.
+ *
+ * usage: simd_diff [seeds] [rngseed]
+ */
+
+#include "layers.h"
+#include "generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define MAX_WIDTH   300
+#define MAX_HEIGHT  64
+
+static uint64_t rng;
+
+static int nextRandom(int mod)
+{
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((rng >> 33) % (uint64_t)mod);
+}
+
+/* Generates the area at the given level and returns the time it took. */
+static clock_t timedGen(Layer *l, int level, int *out, int x, int z, int w, int h)
+{
+    clock_t start;
+
+    setSimdLevel(level);
+    start = clock();
+    genArea(l, out, x, z, w, h);
+    return clock() - start;
+}
+
+/* Compares one stack for 'seeds' random seeds. Returns the number of failing
+ * layer/level combinations.
+ */
+static int testStack(const char *name, LayerStack g, int seeds, int best)
+{
+    clock_t (*times)[SIMD_NUM] = calloc(g.layerNum, sizeof(*times));
+    int64_t *cells = calloc(g.layerNum, sizeof(*cells));
+    int *failed = calloc(g.layerNum * SIMD_NUM, sizeof(*failed));
+    int fails = 0, size = 0;
+    int s, i, level;
+
+    for (i = 0; i < g.layerNum; i++)
+    {
+        int n = calcRequiredBuf(&g.layers[i], MAX_WIDTH, MAX_HEIGHT);
+        if (n > size)
+            size = n;
+    }
+    int *ref = (int *) malloc(size * sizeof(*ref));
+    int *out = (int *) malloc(size * sizeof(*out));
+
+    for (s = 0; s < seeds; s++)
+    {
+        int64_t seed = (int64_t)(((uint64_t)nextRandom(1 << 30) << 34) ^ ((uint64_t)nextRandom(1 << 30) << 4) ^ s);
+        applySeed(&g, seed);
+
+        for (i = 0; i < g.layerNum; i++)
+        {
+            Layer *l = &g.layers[i];
+            // layers that are not reachable from the top layer are never seeded
+            if (l->worldSeed == 0)
+                continue;
+
+            int w = 1 + nextRandom(MAX_WIDTH);
+            int h = 1 + nextRandom(MAX_HEIGHT);
+            int x = nextRandom(20001) - 10000;
+            int z = nextRandom(20001) - 10000;
+
+            times[i][SIMD_SCALAR] += timedGen(l, SIMD_SCALAR, ref, x, z, w, h);
+            cells[i] += w * h;
+
+            for (level = SIMD_SCALAR + 1; level <= best; level++)
+            {
+                times[i][level] += timedGen(l, level, out, x, z, w, h);
+
+                if (failed[i*SIMD_NUM + level] || memcmp(ref, out, w*h*sizeof(*out)) == 0)
+                    continue;
+
+                int k = 0;
+                while (ref[k] == out[k])
+                    k++;
+                printf("MISMATCH %s layer %d (%s) with %s: seed %" PRId64 ", area (%d, %d, %d, %d), "
+                        "cell (%d, %d): scalar %d, got %d\n",
+                        name, i, getLayerName(l), simdLevelName(level), seed, x, z, w, h,
+                        k % w, k / w, ref[k], out[k]);
+                failed[i*SIMD_NUM + level] = 1;
+                fails++;
+            }
+        }
+    }
+
+    printf("\n%s: %d seeds\n%-6s %-22s %10s", name, seeds, "layer", "function", "cells");
+    for (level = SIMD_SCALAR; level <= best; level++)
+        printf(" %9s", simdLevelName(level));
+    printf("   (ms, speedup vs scalar)\n");
+
+    for (i = 0; i < g.layerNum; i++)
+    {
+        if (cells[i] == 0)
+            continue;
+        printf("%-6d %-22s %10" PRId64, i, getLayerName(&g.layers[i]), cells[i]);
+        for (level = SIMD_SCALAR; level <= best; level++)
+        {
+            double ms = times[i][level] * 1000.0 / CLOCKS_PER_SEC;
+            if (level == SIMD_SCALAR || times[i][level] == 0)
+                printf(" %9.1f", ms);
+            else
+                printf(" %6.1f/%-4.2f", ms, (double)times[i][SIMD_SCALAR] / times[i][level]);
+        }
+        printf("%s\n", i == g.layerNum-1 ? "   (full stack)" : "");
+    }
+
+    free(failed);
+    free(cells);
+    free(times);
+    free(out);
+    free(ref);
+    return fails;
+}
+
+int main(int argc, char *argv[])
+{
+    int seeds = argc > 1 ? atoi(argv[1]) : 40;
+    rng = argc > 2 ? strtoull(argv[2], NULL, 10) : 20200401;
+
+    initBiomes();
+    int best = detectSimdLevel();
+    printf("Comparing scalar against levels up to %s\n", simdLevelName(best));
+
+    LayerStack g17 = setupGeneratorMC17();
+    LayerStack g113 = setupGeneratorMC113();
+    int fails = testStack("MC17", g17, seeds, best) + testStack("MC113", g113, seeds, best);
+    freeGenerator(g113);
+    freeGenerator(g17);
+
+    setSimdLevel(best);
+
+    if (fails)
+    {
+        printf("\n%d layer kernels differ from the scalar reference\n", fails);
+        return 1;
+    }
+    printf("\nAll layers are bit-exact\n");
+    return 0;
+}
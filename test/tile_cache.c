@@ -0,0 +1,185 @@
+/* Test of the tile cache files against corrupt indices.
+ *
+ * A cache of the scale 4 layer is filled and flushed, then the index of its
+ * file is damaged: a slot past the tiles, then two entries at one position.
+ * Each time the cache has to ignore the file, give the cells of genArea() and
+ * write a sound file again on the next flush.
+ *
+ * usage: tile_cache
+ */
+
+#include "tilecache.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SIDE    64
+#define AREA    256
+
+/* Start of the file, as written by flushTileCache(). */
+STRUCT(FileHeader)
+{
+    char magic[4];
+    int32_t format;
+    int64_t seed;
+    int32_t mcversion, layerId;
+    int32_t tileSide, cellBytes;
+    int32_t maxTiles, tileNum;
+    int32_t indexCap, pad;
+};
+
+STRUCT(FileEntry)
+{
+    int32_t x, z;
+    uint32_t slot;
+};
+
+static int findFile(const char *dir, char *path)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int found = 0;
+
+    while (d && (e = readdir(d)))
+    {
+        if (strstr(e->d_name, ".tiles") && !strstr(e->d_name, ".tmp"))
+        {
+            sprintf(path, "%s/%s", dir, e->d_name);
+            found = 1;
+        }
+    }
+    if (d)
+        closedir(d);
+    return found;
+}
+
+/* Fills the cache with the area, flushes it and checks the cells. Returns the
+ * number of tiles found in the file.
+ */
+static int fillCache(const char *dir, LayerStack *g, const int *expected, int *failures)
+{
+    TileCache *c = openTileCache(dir, 1, MC_1_14, -2, SIDE, 16 << 20);
+    TileCacheStats stats;
+    int *out = (int *) malloc(AREA * AREA * sizeof(int));
+
+    if (c == NULL)
+    {
+        printf("cannot open the cache in %s\n", dir);
+        (*failures)++;
+        free(out);
+        return -1;
+    }
+    getTileCacheStats(c, &stats);
+    genAreaCached(c, g, out, -100, -100, AREA, AREA);
+    if (memcmp(out, expected, AREA * AREA * sizeof(int)) != 0)
+    {
+        printf("the cached cells differ from genArea\n");
+        (*failures)++;
+    }
+    closeTileCache(c);
+    free(out);
+    return stats.fileTiles;
+}
+
+/* Changes the index of the file with 'corrupt', returns 0 if it has no two
+ * entries to work with.
+ */
+static int damageFile(const char *path, void (*corrupt)(FileEntry *a, FileEntry *b))
+{
+    FILE *fp = fopen(path, "r+b");
+    FileHeader h;
+    FileEntry *index, *a = NULL, *b = NULL;
+    int i;
+
+    if (fp == NULL || fread(&h, sizeof(h), 1, fp) != 1)
+        return 0;
+    index = (FileEntry *) malloc(h.indexCap * sizeof(FileEntry));
+    if (fread(index, sizeof(FileEntry), h.indexCap, fp) != (size_t) h.indexCap)
+        h.indexCap = 0;
+    for (i = 0; i < h.indexCap; i++)
+    {
+        if (index[i].slot == 0)
+            continue;
+        if (a == NULL)
+            a = &index[i];
+        else if (b == NULL)
+            b = &index[i];
+    }
+    if (b)
+    {
+        corrupt(a, b);
+        fseek(fp, sizeof(h), SEEK_SET);
+        fwrite(index, sizeof(FileEntry), h.indexCap, fp);
+    }
+    fclose(fp);
+    free(index);
+    return b != NULL;
+}
+
+static void slotPastEnd(FileEntry *a, FileEntry *b)
+{
+    (void) b;
+    a->slot = 1 << 30;
+}
+
+static void samePosition(FileEntry *a, FileEntry *b)
+{
+    b->x = a->x;
+    b->z = a->z;
+}
+
+int main(void)
+{
+    static void (*const corruptions[])(FileEntry *, FileEntry *) = {slotPastEnd, samePosition};
+    LayerStack g;
+    char dir[64], path[512];
+    int *expected;
+    int failures = 0;
+    int i;
+
+    initBiomes();
+    g = setupGenerator(MC_1_14);
+    applySeed(&g, 1);
+    expected = allocCache(&g.layers[g.layerNum-2], AREA, AREA);
+    genArea(&g.layers[g.layerNum-2], expected, -100, -100, AREA, AREA);
+
+    sprintf(dir, "/tmp/tile_cache_%d", (int) getpid());
+    fillCache(dir, &g, expected, &failures);
+    if (!findFile(dir, path) || fillCache(dir, &g, expected, &failures) <= 0)
+    {
+        printf("the tiles were not kept in %s\n", dir);
+        failures++;
+    }
+
+    for (i = 0; i < (int) (sizeof(corruptions) / sizeof(*corruptions)); i++)
+    {
+        if (!damageFile(path, corruptions[i]))
+        {
+            printf("cannot damage %s\n", path);
+            failures++;
+            continue;
+        }
+        // the damaged file is ignored, then replaced by a sound one
+        if (fillCache(dir, &g, expected, &failures) != 0)
+        {
+            printf("corruption %d: the damaged index was used\n", i);
+            failures++;
+        }
+        if (fillCache(dir, &g, expected, &failures) <= 0)
+        {
+            printf("corruption %d: the cache was not rebuilt\n", i);
+            failures++;
+        }
+    }
+
+    remove(path);
+    rmdir(dir);
+    free(expected);
+    freeGenerator(g);
+    printf("%s: %d failures\n", failures ? "FAILED" : "OK", failures);
+    return failures != 0;
+}
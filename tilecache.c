@@ -0,0 +1,450 @@
+#include "tilecache.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* The file holds the header, the index of 'indexCap' entries, then from the
+ * next multiple of 64 bytes 'tileNum' tiles of tileSide^2 cells of
+ * 'cellBytes' bytes, row by row.
+ */
+STRUCT(TileCacheHeader)
+{
+    char magic[4];
+    int32_t format;
+    int64_t seed;
+    int32_t mcversion, layerId;
+    int32_t tileSide, cellBytes;
+    int32_t maxTiles, tileNum;
+    int32_t indexCap, pad;
+};
+
+/* Open addressing index of the tile positions, with linear probing. */
+STRUCT(TileEntry)
+{
+    int32_t x, z;       // position in tiles
+    uint32_t slot;      // tile number + 1, 0 for an empty entry
+};
+
+struct TileCache
+{
+    char *path;
+    int64_t seed;
+    int mcversion, layerId;
+    int tileSide, cellBytes;
+    size_t tileBytes;
+    int maxTiles, indexCap;
+    TileEntry *index;   // covers the tiles of the file and the pending ones
+
+    unsigned char *map; // read-only mapping of the file
+    size_t mapSize;
+    int fileNum;
+    unsigned char *pending;
+    int pendingNum, pendingCap;
+
+    // readers copy tiles out, the writer adds pending tiles or remaps
+    pthread_rwlock_t lock;
+    int64_t hits, misses, dropped;
+};
+
+static size_t getDataOffset(int indexCap)
+{
+    return (sizeof(TileCacheHeader) + indexCap * sizeof(TileEntry) + 63) & ~(size_t) 63;
+}
+
+static int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static TileEntry *findTile(TileCache *c, int x, int z)
+{
+    uint32_t h = (uint32_t) x * 0x9e3779b1u ^ (uint32_t) z * 0x85ebca77u;
+    TileEntry *e;
+
+    h ^= h >> 15;
+    for (;; h++)
+    {
+        e = &c->index[h & (c->indexCap - 1)];
+        if (e->slot == 0 || (e->x == x && e->z == z))
+            return e;
+    }
+}
+
+static const unsigned char *getTileData(const TileCache *c, uint32_t slot)
+{
+    size_t i = slot - 1;
+    if (i < (size_t) c->fileNum)
+        return c->map + getDataOffset(c->indexCap) + i * c->tileBytes;
+    return c->pending + (i - c->fileNum) * c->tileBytes;
+}
+
+/* Copies the index of a file into a new one, the entries being inserted
+ * again. Returns NULL if an entry points past the tiles of the file or if two
+ * entries have the same position or tile, the file is then corrupt or from
+ * another build.
+ */
+static TileEntry *readIndex(const TileCacheHeader *h, const TileEntry *entries)
+{
+    TileCache tmp;
+    unsigned char *used = (unsigned char *) calloc(h->tileNum + 1, 1);
+    int i;
+
+    tmp.indexCap = h->indexCap;
+    tmp.index = (TileEntry *) calloc(h->indexCap, sizeof(TileEntry));
+    for (i = 0; i < h->indexCap; i++)
+    {
+        const TileEntry *e = &entries[i];
+        TileEntry *t;
+        if (e->slot == 0)
+            continue;
+        // distinct slots also keep the index half empty, so findTile() ends
+        if (e->slot > (uint32_t) h->tileNum || used[e->slot])
+            break;
+        used[e->slot] = 1;
+        t = findTile(&tmp, e->x, e->z);
+        if (t->slot)
+            break;
+        *t = *e;
+    }
+    free(used);
+    if (i < h->indexCap)
+    {
+        free(tmp.index);
+        return NULL;
+    }
+    return tmp.index;
+}
+
+/* Maps the file if it matches the cache, returns 1 if it was mapped, 0 if it
+ * is missing, belongs to another layer or has a corrupt index and -1 if it
+ * cannot be mapped.
+ */
+static int mapFile(TileCache *c)
+{
+    TileCacheHeader h;
+    struct stat st;
+    int fd = open(c->path, O_RDONLY);
+    TileEntry *index;
+    void *map;
+
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || read(fd, &h, sizeof(h)) != sizeof(h))
+    {
+        close(fd);
+        return 0;
+    }
+    if (memcmp(h.magic, TILE_CACHE_MAGIC, 4) != 0 || h.format != TILE_CACHE_FORMAT ||
+        h.seed != c->seed || h.mcversion != c->mcversion || h.layerId != c->layerId ||
+        h.tileSide != c->tileSide || h.cellBytes != c->cellBytes ||
+        h.indexCap <= 0 || (h.indexCap & (h.indexCap - 1)) || h.tileNum < 0 ||
+        h.tileNum > h.maxTiles || 2 * (int64_t) h.maxTiles > h.indexCap ||
+        (size_t) st.st_size < getDataOffset(h.indexCap) + h.tileNum * c->tileBytes)
+    {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    index = readIndex(&h, (const TileEntry *) ((unsigned char *) map + sizeof(h)));
+    if (index == NULL)
+    {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    c->map = (unsigned char *) map;
+    c->mapSize = st.st_size;
+    c->fileNum = h.tileNum;
+    c->maxTiles = h.maxTiles;
+    c->indexCap = h.indexCap;
+    free(c->index);
+    c->index = index;
+    return 1;
+}
+
+TileCache *openTileCache(const char *dir, int64_t seed, int mcversion, int layerId,
+        int tileSide, int64_t maxBytes)
+{
+    LayerStack g = setupGenerator(mcversion);
+    TileCache *c;
+    int64_t maxTiles;
+
+    if (layerId < 0)
+        layerId += g.layerNum;
+    if (layerId < 0 || layerId >= g.layerNum || tileSide <= 0)
+    {
+        freeGenerator(g);
+        return NULL;
+    }
+    c = (TileCache *) calloc(1, sizeof(*c));
+    c->seed = seed;
+    c->mcversion = mcversion;
+    c->layerId = layerId;
+    c->tileSide = tileSide;
+    c->cellBytes = getLayerBits(&g.layers[layerId]) / 8;
+    c->tileBytes = (size_t) tileSide * tileSide * c->cellBytes;
+    freeGenerator(g);
+
+    if (dir)
+    {
+        mkdir(dir, 0777);
+        c->path = (char *) malloc(strlen(dir) + 64);
+        sprintf(c->path, "%s/%" PRId64 "_%d_%d_%d.tiles", dir, seed, mcversion, layerId, tileSide);
+    }
+
+    switch (c->path ? mapFile(c) : 0)
+    {
+    case -1:
+        free(c->path);
+        free(c);
+        return NULL;
+    case 0:
+        // half the index stays empty
+        maxTiles = (maxBytes - (int64_t) getDataOffset(0)) / (int64_t) (c->tileBytes + 2 * sizeof(TileEntry));
+        if (maxTiles < 0)
+            maxTiles = 0;
+        if (maxTiles > 1 << 28)
+            maxTiles = 1 << 28;
+        c->maxTiles = (int) maxTiles;
+        for (c->indexCap = 1; c->indexCap < 2 * c->maxTiles; c->indexCap *= 2);
+        c->index = (TileEntry *) calloc(c->indexCap, sizeof(TileEntry));
+        break;
+    }
+    pthread_rwlock_init(&c->lock, NULL);
+    return c;
+}
+
+/* Copies the cells of a tile at (tileX, tileZ) that are inside the area to
+ * 'out', the tile holds side^2 cells of 'cellBytes' bytes.
+ */
+static void copyTile(const void *data, int side, int cellBytes, int tileX, int tileZ,
+        int *out, int areaX, int areaZ, int areaWidth, int areaHeight)
+{
+    const unsigned char *tile = (const unsigned char *) data;
+    int x0 = tileX > areaX ? tileX : areaX;
+    int z0 = tileZ > areaZ ? tileZ : areaZ;
+    int x1 = tileX + side < areaX + areaWidth ? tileX + side : areaX + areaWidth;
+    int z1 = tileZ + side < areaZ + areaHeight ? tileZ + side : areaZ + areaHeight;
+    int x, z;
+
+    for (z = z0; z < z1; z++)
+    {
+        size_t src = (size_t) (z - tileZ) * side + (x0 - tileX);
+        int *dst = out + (size_t) (z - areaZ) * areaWidth + (x0 - areaX);
+        switch (cellBytes)
+        {
+        case 1:
+            for (x = x0; x < x1; x++, src++)
+                *dst++ = tile[src];
+            break;
+        case 2:
+            for (x = x0; x < x1; x++, src++)
+                *dst++ = ((const uint16_t *) tile)[src];
+            break;
+        default:
+            memcpy(dst, (const int32_t *) tile + src, (x1 - x0) * sizeof(int));
+            break;
+        }
+    }
+}
+
+/* Keeps a generated tile until the next flush, the write lock is held. */
+static void addTile(TileCache *c, TileEntry *e, int x, int z, const int *buf)
+{
+    const size_t cells = (size_t) c->tileSide * c->tileSide;
+    unsigned char *tile;
+    size_t i;
+
+    if (c->fileNum + c->pendingNum >= c->maxTiles)
+    {
+        c->dropped++;
+        return;
+    }
+    if (c->pendingNum == c->pendingCap)
+    {
+        c->pendingCap = c->pendingCap ? 2 * c->pendingCap : 16;
+        c->pending = (unsigned char *) realloc(c->pending, c->pendingCap * c->tileBytes);
+    }
+    tile = c->pending + c->pendingNum * c->tileBytes;
+    switch (c->cellBytes)
+    {
+    case 1:
+        for (i = 0; i < cells; i++)
+            tile[i] = (uint8_t) buf[i];
+        break;
+    case 2:
+        for (i = 0; i < cells; i++)
+            ((uint16_t *) tile)[i] = (uint16_t) buf[i];
+        break;
+    default:
+        memcpy(tile, buf, cells * sizeof(int));
+        break;
+    }
+    c->pendingNum++;
+    e->x = x;
+    e->z = z;
+    e->slot = c->fileNum + c->pendingNum;
+}
+
+void genAreaCached(TileCache *c, LayerStack *g, int *out, int areaX, int areaZ,
+        int areaWidth, int areaHeight)
+{
+    Layer *layer = &g->layers[c->layerId];
+    const int side = c->tileSide;
+    int x0 = floorDiv(areaX, side), x1 = floorDiv(areaX + areaWidth - 1, side);
+    int z0 = floorDiv(areaZ, side), z1 = floorDiv(areaZ + areaHeight - 1, side);
+    int *buf = NULL;
+    int x, z;
+
+    for (z = z0; z <= z1; z++)
+    {
+        for (x = x0; x <= x1; x++)
+        {
+            TileEntry *e;
+
+            pthread_rwlock_rdlock(&c->lock);
+            e = findTile(c, x, z);
+            if (e->slot)
+            {
+                copyTile(getTileData(c, e->slot), side, c->cellBytes, x * side, z * side,
+                        out, areaX, areaZ, areaWidth, areaHeight);
+                pthread_rwlock_unlock(&c->lock);
+                __atomic_fetch_add(&c->hits, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            pthread_rwlock_unlock(&c->lock);
+
+            // generated without the lock, two threads may both miss a tile
+            if (buf == NULL)
+                buf = allocCache(layer, side, side);
+            genArea(layer, buf, x * side, z * side, side, side);
+            __atomic_fetch_add(&c->misses, 1, __ATOMIC_RELAXED);
+
+            pthread_rwlock_wrlock(&c->lock);
+            e = findTile(c, x, z);
+            if (e->slot == 0)
+                addTile(c, e, x, z, buf);
+            pthread_rwlock_unlock(&c->lock);
+
+            copyTile(buf, side, sizeof(int), x * side, z * side, out, areaX, areaZ, areaWidth, areaHeight);
+        }
+    }
+    free(buf);
+}
+
+int getCachedBiome(TileCache *c, LayerStack *g, int x, int z)
+{
+    int id;
+    genAreaCached(c, g, &id, x, z, 1, 1);
+    return id;
+}
+
+int flushTileCache(TileCache *c)
+{
+    TileCacheHeader h;
+    char *tmp;
+    FILE *fp;
+    size_t offset;
+    int ok;
+
+    if (c->path == NULL)
+        return 0;
+    pthread_rwlock_wrlock(&c->lock);
+    if (c->pendingNum == 0)
+    {
+        pthread_rwlock_unlock(&c->lock);
+        return 0;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TILE_CACHE_MAGIC, 4);
+    h.format = TILE_CACHE_FORMAT;
+    h.seed = c->seed;
+    h.mcversion = c->mcversion;
+    h.layerId = c->layerId;
+    h.tileSide = c->tileSide;
+    h.cellBytes = c->cellBytes;
+    h.maxTiles = c->maxTiles;
+    h.tileNum = c->fileNum + c->pendingNum;
+    h.indexCap = c->indexCap;
+    offset = getDataOffset(c->indexCap);
+
+    tmp = (char *) malloc(strlen(c->path) + 32);
+    sprintf(tmp, "%s.tmp.%d", c->path, (int) getpid());
+    fp = fopen(tmp, "wb");
+    ok = fp != NULL;
+    if (ok)
+    {
+        static const char zeros[64];
+        ok &= fwrite(&h, sizeof(h), 1, fp) == 1;
+        ok &= fwrite(c->index, sizeof(TileEntry), c->indexCap, fp) == (size_t) c->indexCap;
+        ok &= fwrite(zeros, 1, offset - sizeof(h) - c->indexCap * sizeof(TileEntry), fp) ==
+                offset - sizeof(h) - c->indexCap * sizeof(TileEntry);
+        if (c->fileNum)
+            ok &= fwrite(c->map + offset, c->tileBytes, c->fileNum, fp) == (size_t) c->fileNum;
+        ok &= fwrite(c->pending, c->tileBytes, c->pendingNum, fp) == (size_t) c->pendingNum;
+        ok &= fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+        ok &= fclose(fp) == 0;
+    }
+    // the old file stays in place until the new one is complete
+    if (!ok || rename(tmp, c->path) != 0)
+    {
+        remove(tmp);
+        free(tmp);
+        pthread_rwlock_unlock(&c->lock);
+        return -1;
+    }
+    free(tmp);
+
+    if (c->map)
+        munmap(c->map, c->mapSize);
+    c->map = NULL;
+    c->fileNum = 0;
+    if (mapFile(c) != 1)
+    {
+        // the file is written but cannot be read back, start over
+        memset(c->index, 0, c->indexCap * sizeof(TileEntry));
+        c->map = NULL;
+    }
+    free(c->pending);
+    c->pending = NULL;
+    c->pendingNum = c->pendingCap = 0;
+    pthread_rwlock_unlock(&c->lock);
+    return 0;
+}
+
+void closeTileCache(TileCache *c)
+{
+    flushTileCache(c);
+    pthread_rwlock_destroy(&c->lock);
+    if (c->map)
+        munmap(c->map, c->mapSize);
+    free(c->pending);
+    free(c->index);
+    free(c->path);
+    free(c);
+}
+
+void getTileCacheStats(TileCache *c, TileCacheStats *stats)
+{
+    pthread_rwlock_rdlock(&c->lock);
+    stats->hits = __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+    stats->dropped = c->dropped;
+    stats->fileTiles = c->fileNum;
+    stats->pendingTiles = c->pendingNum;
+    stats->maxTiles = c->maxTiles;
+    pthread_rwlock_unlock(&c->lock);
+}
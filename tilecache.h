@@ -0,0 +1,58 @@
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include "generator.h"
+
+#define TILE_CACHE_MAGIC    "WHTC"
+#define TILE_CACHE_FORMAT   1
+
+typedef struct TileCache TileCache;
+
+STRUCT(TileCacheStats)
+{
+    int64_t hits;       // tiles read from the file or the pending ones
+    int64_t misses;     // tiles generated
+    int64_t dropped;    // tiles generated but not kept, the cache being full
+    int fileTiles;      // tiles in the mapped file
+    int pendingTiles;   // tiles waiting for the next flush
+    int maxTiles;
+};
+
+/* Opens the cache of the layer 'layerId' of the generator of 'mcversion'
+ * seeded with 'seed', stored in the directory 'dir' as one file per seed,
+ * version, layer and tile size. A negative 'layerId' counts from the end of
+ * the stack, -1 being the scale 1 layer and -2 the scale 4 one. The file is
+ * mapped read-only and holds square tiles of 'tileSide' cells found with an
+ * index of tile positions. A new file holds at most 'maxBytes', an existing
+ * one keeps its own limit. A file of another layer or with a corrupt index is
+ * ignored, the cache starts empty and replaces it on the next flush. With a NULL 'dir' the tiles are only kept in
+ * memory, up to 'maxBytes'. Returns NULL if the file exists but cannot be
+ * mapped.
+ */
+TileCache *openTileCache(const char *dir, int64_t seed, int mcversion, int layerId,
+        int tileSide, int64_t maxBytes);
+
+/* Same as genArea() on the cached layer of 'g', which has to be seeded with
+ * the seed of the cache. The tiles found in the cache are copied, the missing
+ * ones are generated with 'g' and kept until the next flush while there is
+ * room. Several threads can share a cache, each with its own 'g'.
+ */
+void genAreaCached(TileCache *cache, LayerStack *g, int *out, int areaX, int areaZ,
+        int areaWidth, int areaHeight);
+
+/* Value of the cell (x, z) of the cached layer, see genAreaCached(). */
+int getCachedBiome(TileCache *cache, LayerStack *g, int x, int z);
+
+/* Writes the file and its new tiles to a temporary file next to it, which is
+ * synced and renamed over the old one, so a crash leaves either of the two
+ * complete. The cache is then mapped again. Returns 0 on success, -1 if the
+ * file could not be written, the pending tiles are then kept.
+ */
+int flushTileCache(TileCache *cache);
+
+/* Flushes the cache and frees it. */
+void closeTileCache(TileCache *cache);
+
+void getTileCacheStats(TileCache *cache, TileCacheStats *stats);
+
+#endif /* TILECACHE_H_ */